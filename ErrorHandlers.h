@@ -42,6 +42,10 @@ void clearErrorHandler();
     //! Clean up globalCallStack functionallity
     void globalCallStackFinalize();
 
+    //! Get the global call stacks for the ranks in a sub-communicator (see getGlobalCallStacks).
+    //! The callback is required so getGlobalCallStacks( nullptr ) is not ambiguous.
+    global_stack_info getGlobalCallStacks( MPI_Comm comm, std::function<void( const global_stack_info & )> callback );
+
 #else
     template<class COMM> inline void setMPIErrorHandler( COMM ) {}
     template<class COMM> inline void clearMPIErrorHandler( COMM ) {}
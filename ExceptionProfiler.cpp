@@ -0,0 +1,237 @@
+#include "StackTrace/ExceptionProfiler.h"
+#include "StackTrace/Fingerprint.h"
+#include "StackTrace/StackTrace.h"
+#include "StackTrace/Utilities.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <vector>
+
+
+// Detect the OS
+// clang-format off
+#if defined( WIN32 ) || defined( _WIN32 ) || defined( WIN64 ) || defined( _WIN64 ) || defined( _MSC_VER )
+    #define USE_WINDOWS
+#elif defined( __APPLE__ )
+    #define USE_MAC
+#elif defined( __linux ) || defined( __linux__ ) || defined( __unix ) || defined( __posix )
+    #define USE_LINUX
+#else
+    #error Unknown OS
+#endif
+// clang-format on
+
+
+// Include system dependent headers
+// clang-format off
+#ifdef USE_LINUX
+    #include <execinfo.h>
+    #define NO_INLINE __attribute__( ( noinline ) )
+    // Defined by the stacktrace_exception_hooks (or stacktrace_hooks) library
+    extern "C" __attribute__( ( weak ) ) int stacktrace_exception_hooks;
+#else
+    #define NO_INLINE
+#endif
+// clang-format on
+
+
+/****************************************************************************
+ *  Internal data for the exception profiler                                 *
+ ****************************************************************************/
+static constexpr int MAX_FRAMES      = 32;   // Maximum number of frames for a throw
+static constexpr int SKIP_FRAMES     = 2;    // recordThrow, __cxa_throw
+static constexpr uint32_t MAX_STACKS = 1024; // Number of unique type/call stacks
+static constexpr int MAX_PROBE       = 64;   // Maximum number of probes for the table
+static constexpr int MAX_RECENT      = 4;    // Number of recent throws kept per thread
+
+
+// Throw site (type and call stack)
+//    state: 0 - empty, 1 - being written, 2 - valid
+struct throw_stack {
+    std::atomic<int> state     = 0;
+    uint64_t hash              = 0;
+    const std::type_info *type = nullptr;
+    int N                      = 0;
+    void *frames[MAX_FRAMES]   = {};
+    std::atomic<int64_t> count = 0;
+};
+
+
+// Recent throws for a thread
+struct throw_record {
+    const void *exception = nullptr;
+    int N                 = 0;
+    void *frames[MAX_FRAMES];
+};
+struct throw_thread_struct {
+    int next = 0;
+    throw_record recent[MAX_RECENT];
+};
+
+
+static std::atomic<bool> throw_running( false );
+static std::atomic<size_t> throw_count( 0 );
+static throw_stack throw_stacks[MAX_STACKS];
+static thread_local throw_thread_struct throw_thread;
+
+
+/****************************************************************************
+ *  Helper functions                                                         *
+ ****************************************************************************/
+// Find/add the type/call stack, returning the index (or MAX_STACKS if the table is full)
+static uint32_t findStack( const std::type_info *type, int N, void *const *frames )
+{
+    uint64_t hash = StackTrace::hashStack( frames, N ) ^ reinterpret_cast<uint64_t>( type );
+    for ( int k = 0; k < MAX_PROBE; k++ ) {
+        auto &stack = throw_stacks[( hash + k ) % MAX_STACKS];
+        int state   = stack.state.load( std::memory_order_acquire );
+        if ( state == 0 && stack.state.compare_exchange_strong( state, 1 ) ) {
+            stack.hash = hash;
+            stack.type = type;
+            stack.N    = N;
+            memcpy( stack.frames, frames, N * sizeof( void * ) );
+            stack.state.store( 2, std::memory_order_release );
+            return ( hash + k ) % MAX_STACKS;
+        }
+        while ( state == 1 )
+            state = stack.state.load( std::memory_order_acquire );
+        if ( stack.hash == hash && stack.type == type && stack.N == N &&
+             memcmp( stack.frames, frames, N * sizeof( void * ) ) == 0 )
+            return ( hash + k ) % MAX_STACKS;
+    }
+    return MAX_STACKS;
+}
+
+
+/****************************************************************************
+ *  Record the exceptions                                                    *
+ ****************************************************************************/
+NO_INLINE void StackTrace::ExceptionProfiler::recordThrow( const void *exception,
+                                                           const std::type_info *type )
+{
+    if ( !throw_running.load( std::memory_order_relaxed ) )
+        return;
+#ifdef USE_LINUX
+    // Get the call stack
+    auto &thread = throw_thread;
+    auto &record = thread.recent[thread.next];
+    thread.next  = ( thread.next + 1 ) % MAX_RECENT;
+    void *frames[MAX_FRAMES + SKIP_FRAMES];
+    int N            = std::max( ::backtrace( frames, MAX_FRAMES + SKIP_FRAMES ) - SKIP_FRAMES, 0 );
+    record.exception = exception;
+    record.N         = N;
+    memcpy( record.frames, &frames[SKIP_FRAMES], N * sizeof( void * ) );
+    // Add the throw site
+    uint32_t id = findStack( type, N, record.frames );
+    if ( id != MAX_STACKS )
+        throw_stacks[id].count.fetch_add( 1, std::memory_order_relaxed );
+    throw_count++;
+#else
+    (void) exception;
+    (void) type;
+#endif
+}
+std::vector<void *> StackTrace::ExceptionProfiler::getThrowStack( const void *exception )
+{
+    auto &thread = throw_thread;
+    for ( int i = 1; i <= MAX_RECENT; i++ ) {
+        auto &record = thread.recent[( thread.next + MAX_RECENT - i ) % MAX_RECENT];
+        if ( record.N == 0 )
+            break;
+        if ( exception == nullptr || exception == record.exception )
+            return std::vector<void *>( record.frames, record.frames + record.N );
+    }
+    return {};
+}
+
+
+/****************************************************************************
+ *  Start/stop the exception profiler                                        *
+ ****************************************************************************/
+bool StackTrace::ExceptionProfiler::hooksInstalled()
+{
+#ifdef USE_LINUX
+    return &stacktrace_exception_hooks != nullptr;
+#else
+    return false;
+#endif
+}
+void StackTrace::ExceptionProfiler::start()
+{
+#ifdef USE_LINUX
+    if ( !hooksInstalled() ) {
+        static bool print = true;
+        if ( print ) {
+            std::cerr << "Exception profiler requires linking with stacktrace_exception_hooks\n";
+            print = false;
+        }
+    }
+    throw_running.store( true );
+#else
+    static bool print = true;
+    if ( print ) {
+        std::cerr << "Exception profiler is not supported on this compiler/OS\n";
+        print = false;
+    }
+#endif
+}
+void StackTrace::ExceptionProfiler::stop() { throw_running.store( false ); }
+bool StackTrace::ExceptionProfiler::running() { return throw_running.load(); }
+size_t StackTrace::ExceptionProfiler::throws() { return throw_count.load(); }
+void StackTrace::ExceptionProfiler::clear()
+{
+    for ( auto &stack : throw_stacks )
+        stack.count.store( 0 );
+    throw_count.store( 0 );
+}
+
+
+/****************************************************************************
+ *  Get the results                                                          *
+ ****************************************************************************/
+static void setTypes( StackTrace::multi_stack_info &stack,
+                      const std::map<void *, std::string> &types )
+{
+    if ( stack.children.empty() ) {
+        auto it = types.find( stack.stack.address );
+        if ( it != types.end() ) {
+            stack.stack.clear();
+            stack.stack.address  = it->first;
+            stack.stack.address2 = it->first;
+            auto &function       = stack.stack.function;
+            snprintf( function.data(), function.size(), "throw %s", it->second.data() );
+        }
+    }
+    for ( auto &child : stack.children )
+        setTypes( child, types );
+}
+StackTrace::multi_stack_info StackTrace::ExceptionProfiler::getProfile()
+{
+    // Get the call stacks with the type as the innermost frame
+    std::vector<std::vector<void *>> trace;
+    std::vector<int> count;
+    std::map<void *, std::string> types;
+    for ( auto &stack : throw_stacks ) {
+        if ( stack.state.load( std::memory_order_acquire ) != 2 )
+            continue;
+        int64_t N = stack.count.load( std::memory_order_relaxed );
+        if ( N <= 0 )
+            continue;
+        auto type = const_cast<std::type_info *>( stack.type );
+        types[type] = Utilities::getTypeName( *type );
+        trace.emplace_back( stack.N + 1 );
+        trace.back()[0] = type;
+        std::copy( stack.frames, stack.frames + stack.N, &trace.back()[1] );
+        count.push_back( std::min<int64_t>( N, std::numeric_limits<int>::max() ) );
+    }
+    auto profile = generateMultiStack( trace, count );
+    // Replace the type info with the type name
+    setTypes( profile, types );
+    return profile;
+}
@@ -0,0 +1,76 @@
+#ifndef included_StackTrace_ExceptionProfiler
+#define included_StackTrace_ExceptionProfiler
+
+#include <cstddef>
+#include <typeinfo>
+#include <vector>
+
+#include "StackTrace/StackTrace.h"
+
+
+namespace StackTrace::ExceptionProfiler {
+
+
+/*!
+ * @brief  Start the exception profiler
+ * @details  This function starts recording the raw call stack and type of every
+ *    exception that is thrown.  The counts are aggregated for each unique type and
+ *    throw site.
+ *    Note: the exceptions are only seen if the executable is linked with the
+ *    stacktrace_exception_hooks library (or stacktrace_hooks which contains all of the hooks),
+ *    or it is preloaded.  The library only interposes the functions this profiler
+ *    needs.  This functionality is currently only availible on Linux.
+ */
+void start();
+
+
+//! Stop recording the exceptions
+void stop();
+
+
+//! Check if the exception profiler is running
+bool running();
+
+
+//! Check if the exception hooks are installed (stacktrace_exception_hooks is linked)
+bool hooksInstalled();
+
+
+//! Clear the recorded exceptions
+void clear();
+
+
+//! Return the number of exceptions thrown while the profiler was running
+size_t throws();
+
+
+/*!
+ * @brief  Get the exception profile
+ * @details  This function returns the call stacks of the throw sites, where the count
+ *    for each entry is the number of exceptions thrown.  The innermost entry for each
+ *    call stack is the type of the exception ("throw <type>").
+ * @return              Returns the call stacks of the throw sites
+ */
+multi_stack_info getProfile();
+
+
+/*!
+ * @brief  Get the call stack of a thrown exception
+ * @details  This function returns the raw call stack recorded when the exception was
+ *    thrown (the most recent exceptions thrown by the current thread are kept).  This
+ *    is intended to be called from a catch block, for example:
+ *       catch ( const std::exception &e ) { auto stack = getThrowStack( &e ); }
+ *    The call stack can be resolved with getStackInfo.
+ * @param[in] exception     Pointer to the exception object (nullptr for the most recent)
+ * @return              Returns the raw call stack (empty if not found)
+ */
+std::vector<void *> getThrowStack( const void *exception = nullptr );
+
+
+//! Record an exception (called by the __cxa_throw hook)
+void recordThrow( const void *exception, const std::type_info *type );
+
+
+} // namespace StackTrace::ExceptionProfiler
+
+#endif
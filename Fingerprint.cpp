@@ -0,0 +1,329 @@
+#include "StackTrace/Fingerprint.h"
+#include "StackTrace/StackTrace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+
+// Detect the OS
+// clang-format off
+#if defined( WIN32 ) || defined( _WIN32 ) || defined( WIN64 ) || defined( _WIN64 ) || defined( _MSC_VER )
+    #define USE_WINDOWS
+#elif defined( __APPLE__ )
+    #define USE_MAC
+#elif defined( __linux ) || defined( __linux__ ) || defined( __unix ) || defined( __posix )
+    #define USE_LINUX
+#else
+    #error Unknown OS
+#endif
+// clang-format on
+
+
+// Include system dependent headers
+// clang-format off
+#ifdef USE_LINUX
+    #include <link.h>
+#endif
+// clang-format on
+
+
+/****************************************************************************
+ *  List of the loaded objects                                               *
+ *  Note: the list is immutable once it is published so it can be read      *
+ *    without a lock.  Old lists are never freed since another thread may    *
+ *    still be reading them (they are only replaced when dlopen is called).  *
+ ****************************************************************************/
+struct module_range {
+    uintptr_t start; // Start of the segment
+    uintptr_t end;   // End of the segment
+    uintptr_t base;  // Base address of the object
+    uint64_t id;     // Hash of the object name
+    uint64_t build;  // Hash of the build id (0 if not availible)
+};
+struct module_list {
+    unsigned long long changes = 0; // Number of objects added/removed (dl_iterate_phdr)
+    std::vector<module_range> modules;
+    std::vector<std::pair<uint64_t, std::string>> names; // Full name of each object
+};
+static std::atomic<module_list *> fingerprint_modules( nullptr );
+static std::mutex fingerprint_mutex;
+static inline uint64_t hashName( std::string_view name )
+{
+    uint64_t hash = 0xcbf29ce484222325;
+    for ( char c : name ) {
+        hash ^= static_cast<uint8_t>( c );
+        hash *= 0x100000001b3;
+    }
+    return hash;
+}
+#ifdef USE_LINUX
+static uint64_t getBuildId( dl_phdr_info *info )
+{
+    // Search the notes for the GNU build id
+    for ( int i = 0; i < info->dlpi_phnum; i++ ) {
+        const auto &phdr = info->dlpi_phdr[i];
+        if ( phdr.p_type != PT_NOTE )
+            continue;
+        auto ptr = reinterpret_cast<const char *>( info->dlpi_addr + phdr.p_vaddr );
+        auto end = ptr + phdr.p_memsz;
+        while ( ptr + sizeof( ElfW( Nhdr ) ) <= end ) {
+            auto note    = reinterpret_cast<const ElfW( Nhdr ) *>( ptr );
+            auto name    = ptr + sizeof( ElfW( Nhdr ) );
+            auto desc    = name + ( ( note->n_namesz + 3 ) & ~3 );
+            auto next    = desc + ( ( note->n_descsz + 3 ) & ~3 );
+            bool buildId = note->n_type == NT_GNU_BUILD_ID && note->n_namesz == 4 &&
+                           memcmp( name, "GNU", 4 ) == 0;
+            if ( buildId && next <= end )
+                return hashName( std::string_view( desc, note->n_descsz ) );
+            ptr = next;
+        }
+    }
+    return 0;
+}
+static int getChanges( dl_phdr_info *info, size_t, void *data )
+{
+    *reinterpret_cast<unsigned long long *>( data ) = info->dlpi_adds + info->dlpi_subs;
+    return 1;
+}
+static int addModule( dl_phdr_info *info, size_t, void *data )
+{
+    auto list     = reinterpret_cast<module_list *>( data );
+    list->changes = info->dlpi_adds + info->dlpi_subs;
+    // Use the name of the object without the path (the executable has an empty name)
+    std::string_view name( info->dlpi_name ? info->dlpi_name : "" );
+    name    = name.substr( name.find_last_of( '/' ) + 1 );
+    auto id    = hashName( name );
+    auto build = getBuildId( info );
+    for ( int i = 0; i < info->dlpi_phnum; i++ ) {
+        const auto &phdr = info->dlpi_phdr[i];
+        if ( phdr.p_type != PT_LOAD )
+            continue;
+        uintptr_t start = info->dlpi_addr + phdr.p_vaddr;
+        list->modules.push_back( { start, start + phdr.p_memsz, info->dlpi_addr, id, build } );
+    }
+    list->names.emplace_back( id, info->dlpi_name ? info->dlpi_name : "" );
+    return 0;
+}
+#endif
+static const module_list *updateModules( const module_list *old )
+{
+    std::lock_guard<std::mutex> lock( fingerprint_mutex );
+    auto current = fingerprint_modules.load();
+    if ( current != old )
+        return current; // Another thread updated the list
+#ifdef USE_LINUX
+    unsigned long long changes = 0;
+    dl_iterate_phdr( getChanges, &changes );
+    if ( current && current->changes == changes )
+        return current; // No new objects
+    auto list = new module_list;
+    dl_iterate_phdr( addModule, list );
+    auto compare = []( const module_range &a, const module_range &b ) { return a.start < b.start; };
+    std::sort( list->modules.begin(), list->modules.end(), compare );
+#else
+    if ( current )
+        return current;
+    auto list = new module_list;
+#endif
+    fingerprint_modules.store( list );
+    return list;
+}
+static inline const module_range *findModule( const module_list *list, uintptr_t address )
+{
+    if ( !list )
+        return nullptr;
+    auto compare = []( uintptr_t x, const module_range &m ) { return x < m.start; };
+    auto it      = std::upper_bound( list->modules.begin(), list->modules.end(), address, compare );
+    if ( it == list->modules.begin() )
+        return nullptr;
+    --it;
+    return address < it->end ? &( *it ) : nullptr;
+}
+
+
+/****************************************************************************
+ *  Fingerprint a call stack                                                 *
+ ****************************************************************************/
+uint64_t StackTrace::fingerprint( const void *const *stack, size_t N )
+{
+    const module_list *list = fingerprint_modules.load( std::memory_order_acquire );
+    if ( !list )
+        list = updateModules( nullptr );
+    // Convert the addresses to module relative addresses and hash them
+    constexpr size_t blockSize = 64;
+    uint64_t hash              = N;
+    void *tmp[blockSize];
+    const module_range *module = nullptr;
+    for ( size_t i0 = 0; i0 < N; i0 += blockSize ) {
+        size_t N2 = std::min( N - i0, blockSize );
+        for ( size_t i = 0; i < N2; i++ ) {
+            // Check the module of the previous frame first (usually the same module)
+            auto address = reinterpret_cast<uintptr_t>( stack[i0 + i] );
+            if ( !module || address < module->start || address >= module->end )
+                module = findModule( list, address );
+            if ( !module && address != 0 ) {
+                list   = updateModules( list );
+                module = findModule( list, address );
+            }
+            if ( module )
+                address = ( address - module->base ) ^ module->id;
+            tmp[i] = reinterpret_cast<void *>( address );
+        }
+        hash = hashStack( tmp, N2 ) ^ ( hash * 0x9e3779b97f4a7c15 );
+    }
+    return hash == 0 ? 1 : hash;
+}
+
+
+/****************************************************************************
+ *  Module relative addresses                                                *
+ ****************************************************************************/
+void StackTrace::getModuleAddress( const void *const *stack, size_t N, module_address *address )
+{
+    const module_list *list = fingerprint_modules.load( std::memory_order_acquire );
+    if ( !list )
+        list = updateModules( nullptr );
+    const module_range *module = nullptr;
+    for ( size_t i = 0; i < N; i++ ) {
+        auto ptr = reinterpret_cast<uintptr_t>( stack[i] );
+        if ( !module || ptr < module->start || ptr >= module->end )
+            module = findModule( list, ptr );
+        if ( !module && ptr != 0 ) {
+            list   = updateModules( list );
+            module = findModule( list, ptr );
+        }
+        if ( module )
+            address[i] = { module->id, module->build, ptr - module->base };
+        else
+            address[i] = { 0, 0, ptr };
+    }
+}
+static const module_range *findModule( const module_list *list, uint64_t id, uint64_t build )
+{
+    for ( const auto &module : list->modules ) {
+        bool match = module.build == build || module.build == 0 || build == 0;
+        if ( module.id == id && match )
+            return &module;
+    }
+    return nullptr;
+}
+void *StackTrace::getLocalAddress( const module_address &address )
+{
+    if ( address.module == 0 )
+        return nullptr;
+    const module_list *list = fingerprint_modules.load( std::memory_order_acquire );
+    if ( !list )
+        list = updateModules( nullptr );
+    auto module = findModule( list, address.module, address.build );
+    if ( !module ) {
+        list   = updateModules( list );
+        module = findModule( list, address.module, address.build );
+    }
+    if ( !module )
+        return nullptr;
+    return reinterpret_cast<void *>( module->base + address.offset );
+}
+std::string StackTrace::getModuleName( uint64_t module )
+{
+    const module_list *list = fingerprint_modules.load( std::memory_order_acquire );
+    if ( !list )
+        list = updateModules( nullptr );
+    for ( const auto &[id, name] : list->names ) {
+        if ( id == module )
+            return name;
+    }
+    return {};
+}
+
+
+/****************************************************************************
+ *  FingerprintTable                                                         *
+ ****************************************************************************/
+static constexpr size_t MAX_PROBE = 64; // Maximum number of probes for the table
+StackTrace::FingerprintTable::FingerprintTable( size_t capacity )
+{
+    size_t N = 16;
+    while ( N < capacity )
+        N *= 2;
+    d_mask  = N - 1;
+    d_slots = std::make_unique<slot_struct[]>( N );
+}
+int64_t StackTrace::FingerprintTable::add( const void *const *stack, size_t N, int64_t count )
+{
+    return add( fingerprint( stack, N ), stack, N, count );
+}
+int64_t StackTrace::FingerprintTable::add(
+    uint64_t key, const void *const *stack, size_t N, int64_t count )
+{
+    key = key == 0 ? 1 : key;
+    for ( size_t k = 0; k < std::min( MAX_PROBE, d_mask + 1 ); k++ ) {
+        auto &slot   = d_slots[( key + k ) & d_mask];
+        uint64_t old = slot.key.load( std::memory_order_acquire );
+        if ( old == 0 && slot.key.compare_exchange_strong( old, key ) ) {
+            // Store the call stack
+            slot.frames = std::min<size_t>( N, MAX_FRAMES );
+            memcpy( slot.stack, stack, slot.frames * sizeof( void * ) );
+            slot.state.store( 2, std::memory_order_release );
+            d_size++;
+            return slot.N.fetch_add( count ) + count;
+        }
+        if ( old == key )
+            return slot.N.fetch_add( count ) + count;
+    }
+    d_dropped++;
+    return 0;
+}
+int64_t StackTrace::FingerprintTable::count( uint64_t key ) const
+{
+    key = key == 0 ? 1 : key;
+    for ( size_t k = 0; k < std::min( MAX_PROBE, d_mask + 1 ); k++ ) {
+        auto &slot   = d_slots[( key + k ) & d_mask];
+        uint64_t old = slot.key.load( std::memory_order_acquire );
+        if ( old == 0 )
+            return 0;
+        if ( old == key )
+            return slot.N.load();
+    }
+    return 0;
+}
+std::vector<StackTrace::FingerprintTable::Entry> StackTrace::FingerprintTable::entries() const
+{
+    std::vector<Entry> data;
+    for ( size_t i = 0; i <= d_mask; i++ ) {
+        auto &slot = d_slots[i];
+        if ( slot.state.load( std::memory_order_acquire ) != 2 )
+            continue;
+        std::vector<void *> stack( slot.stack, slot.stack + slot.frames );
+        data.push_back( { slot.key.load(), slot.N.load(), std::move( stack ) } );
+    }
+    return data;
+}
+StackTrace::multi_stack_info StackTrace::FingerprintTable::getMultiStack() const
+{
+    std::vector<std::vector<void *>> trace;
+    std::vector<int> count;
+    for ( auto &entry : entries() ) {
+        trace.push_back( std::move( entry.stack ) );
+        count.push_back( std::min<int64_t>( entry.count, std::numeric_limits<int>::max() ) );
+    }
+    return generateMultiStack( trace, count );
+}
+void StackTrace::FingerprintTable::clear()
+{
+    for ( size_t i = 0; i <= d_mask; i++ ) {
+        auto &slot = d_slots[i];
+        slot.key.store( 0 );
+        slot.state.store( 0 );
+        slot.N.store( 0 );
+        slot.frames = 0;
+    }
+    d_size.store( 0 );
+    d_dropped.store( 0 );
+}
@@ -0,0 +1,190 @@
+#ifndef included_StackTrace_Fingerprint
+#define included_StackTrace_Fingerprint
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "StackTrace/StackTrace.h"
+
+
+namespace StackTrace {
+
+
+/*!
+ * @brief  Hash a raw call stack
+ * @details  This function computes a fast 64-bit hash of the raw addresses.  The hash
+ *    is only valid within the current process (see fingerprint for a hash that is stable
+ *    across processes).  The addresses are hashed in 4 independent lanes so the compiler
+ *    can vectorize/pipeline the loop.
+ * @param[in] stack     The raw call stack
+ * @param[in] N         The number of frames
+ * @return              Returns the hash
+ */
+inline uint64_t hashStack( const void *const *stack, size_t N )
+{
+    constexpr uint64_t prime = 0x9e3779b97f4a7c15;
+
+    uint64_t h[4] = { 0xcbf29ce484222325, 0x84222325cbf29ce4, 0x100000001b3, 0x1b300000001 };
+    size_t i      = 0;
+    for ( ; i + 4 <= N; i += 4 ) {
+        for ( size_t j = 0; j < 4; j++ )
+            h[j] = ( h[j] ^ reinterpret_cast<uint64_t>( stack[i + j] ) ) * prime;
+    }
+    for ( size_t j = 0; i < N; i++, j++ )
+        h[j] = ( h[j] ^ reinterpret_cast<uint64_t>( stack[i] ) ) * prime;
+    uint64_t hash = h[0] ^ ( h[1] >> 16 | h[1] << 48 ) ^ ( h[2] >> 32 | h[2] << 32 ) ^
+                    ( h[3] >> 48 | h[3] << 16 ) ^ N;
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccd;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+
+/*!
+ * @brief  Fingerprint a raw call stack
+ * @details  This function computes a 64-bit fingerprint of the call stack using the
+ *    address relative to the loaded object (executable or shared library) and the name
+ *    of the object.  The fingerprint is stable across runs (address space layout
+ *    randomization) and across ranks running the same executable.  The list of loaded
+ *    objects is cached and updated when an address is not found.
+ *    Note: this is currently only availible on Linux (the raw address is used otherwise).
+ * @param[in] stack     The raw call stack
+ * @param[in] N         The number of frames
+ * @return              Returns the fingerprint (never 0)
+ */
+uint64_t fingerprint( const void *const *stack, size_t N );
+
+
+//! Fingerprint a raw call stack
+inline uint64_t fingerprint( const std::vector<void *> &stack )
+{
+    return fingerprint( stack.data(), stack.size() );
+}
+
+
+//! Address relative to a loaded object (executable or shared library)
+struct module_address {
+    uint64_t module; //!< Id of the object (hash of the name, 0 if the address is not found)
+    uint64_t build;  //!< Hash of the build id of the object (0 if not availible)
+    uint64_t offset; //!< Address relative to the base of the object
+};
+
+
+/*!
+ * @brief  Convert raw addresses to module relative addresses
+ * @details  This function converts the raw addresses to addresses relative to the loaded
+ *    object (see fingerprint).  The module relative addresses can be sent to another
+ *    process running the same executable and converted back with getLocalAddress so the
+ *    addresses can be symbolized in a single process.  This does not access the file
+ *    system (the list of loaded objects is cached).
+ *    Note: this is currently only availible on Linux (the raw address is used otherwise).
+ * @param[in] stack     The raw call stack
+ * @param[in] N         The number of frames
+ * @param[out] address  The module relative addresses (size N)
+ */
+void getModuleAddress( const void *const *stack, size_t N, module_address *address );
+
+
+/*!
+ * @brief  Convert module relative addresses to addresses in the current process
+ * @details  This function converts addresses from getModuleAddress (possibly from another
+ *    process) to raw addresses in the current process.  The address is only converted if
+ *    the same object (name and build id) is loaded in the current process.
+ * @param[in] address   The module relative address
+ * @return              Returns the raw address (nullptr if the object is not loaded)
+ */
+void *getLocalAddress( const module_address &address );
+
+
+//! Get the name of the object (including the path) for a module id (empty if not found)
+std::string getModuleName( uint64_t module );
+
+
+/*!
+ * @brief  Table of unique call stacks
+ * @details  This class stores the count and the first raw call stack for each unique
+ *    fingerprint.  The table is fixed size and lock-free so it can be used to
+ *    deduplicate call stacks from multiple threads (e.g. to aggregate errors or to rate
+ *    limit messages from the same location).
+ */
+class FingerprintTable final
+{
+public:
+    //! Maximum number of frames stored for each call stack
+    static constexpr int MAX_FRAMES = 64;
+
+    //! Entry in the table
+    struct Entry {
+        uint64_t fingerprint;      //!< Fingerprint of the call stack
+        int64_t count;             //!< Number of times the call stack was added
+        std::vector<void *> stack; //!< First raw call stack that was added
+    };
+
+    /*!
+     * @brief  Default constructor
+     * @param[in] capacity  Maximum number of unique call stacks (rounded to a power of 2)
+     */
+    explicit FingerprintTable( size_t capacity = 4096 );
+
+    /*!
+     * @brief  Add a call stack
+     * @details  This function adds the call stack to the table and returns the count
+     *    for the fingerprint (including this call).  If the table is full the call stack
+     *    is not recorded and 0 is returned.
+     * @param[in] stack     The raw call stack
+     * @param[in] N         The number of frames
+     * @param[in] count     The count to add
+     * @return              Returns the total count for the call stack
+     */
+    int64_t add( const void *const *stack, size_t N, int64_t count = 1 );
+
+    //! Add a call stack
+    inline int64_t add( const std::vector<void *> &stack, int64_t count = 1 )
+    {
+        return add( stack.data(), stack.size(), count );
+    }
+
+    //! Add a call stack with a precomputed fingerprint
+    int64_t add( uint64_t fingerprint, const void *const *stack, size_t N, int64_t count = 1 );
+
+    //! Return the count for the fingerprint (0 if not found)
+    int64_t count( uint64_t fingerprint ) const;
+
+    //! Return the number of unique call stacks
+    size_t size() const { return d_size.load(); }
+
+    //! Return the number of call stacks that could not be added (table is full)
+    size_t dropped() const { return d_dropped.load(); }
+
+    //! Return the entries in the table
+    std::vector<Entry> entries() const;
+
+    //! Return the call stacks in the table
+    multi_stack_info getMultiStack() const;
+
+    //! Clear the table (not thread-safe)
+    void clear();
+
+private:
+    struct slot_struct {
+        std::atomic<uint64_t> key = 0; // 0 - empty
+        std::atomic<int> state    = 0; // 0 - empty, 1 - being written, 2 - valid
+        std::atomic<int64_t> N    = 0;
+        int frames                = 0;
+        void *stack[MAX_FRAMES]   = {};
+    };
+    size_t d_mask;
+    std::unique_ptr<slot_struct[]> d_slots;
+    std::atomic<size_t> d_size    = 0;
+    std::atomic<size_t> d_dropped = 0;
+};
+
+
+} // namespace StackTrace
+
+#endif
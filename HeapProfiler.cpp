@@ -0,0 +1,288 @@
+#include "StackTrace/HeapProfiler.h"
+#include "StackTrace/Fingerprint.h"
+#include "StackTrace/StackTrace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+
+// Detect the OS
+// clang-format off
+#if defined( WIN32 ) || defined( _WIN32 ) || defined( WIN64 ) || defined( _WIN64 ) || defined( _MSC_VER )
+    #define USE_WINDOWS
+#elif defined( __APPLE__ )
+    #define USE_MAC
+#elif defined( __linux ) || defined( __linux__ ) || defined( __unix ) || defined( __posix )
+    #define USE_LINUX
+#else
+    #error Unknown OS
+#endif
+// clang-format on
+
+
+// Include system dependent headers
+// clang-format off
+#ifdef USE_LINUX
+    #include <execinfo.h>
+    #define TLS_INITIAL_EXEC __attribute__( ( tls_model( "initial-exec" ) ) )
+    #define NO_INLINE __attribute__( ( noinline ) )
+    #define ALWAYS_INLINE inline __attribute__( ( always_inline ) )
+    // Defined by the stacktrace_heap_hooks (or stacktrace_hooks) library
+    extern "C" __attribute__( ( weak ) ) int stacktrace_heap_hooks;
+#else
+    #define TLS_INITIAL_EXEC
+    #define NO_INLINE
+    #define ALWAYS_INLINE inline
+#endif
+// clang-format on
+
+
+/****************************************************************************
+ *  Internal data for the heap profiler                                      *
+ *  Note: the tables are fixed size and lock-free since they are used from   *
+ *    inside malloc/free                                                     *
+ ****************************************************************************/
+static constexpr int MAX_FRAMES      = 64;      // Maximum number of frames for a sample
+static constexpr int SKIP_FRAMES     = 2;       // recordAlloc, malloc
+static constexpr uint32_t MAX_STACKS = 4096;    // Number of unique call stacks
+static constexpr uint32_t MAX_ALLOCS = 1 << 16; // Number of live sampled allocations
+static constexpr int MAX_PROBE       = 64;      // Maximum number of probes for the tables
+
+
+// Call stack for the sampled allocations
+//    state: 0 - empty, 1 - being written, 2 - valid
+struct heap_stack {
+    std::atomic<int> state     = 0;
+    uint64_t hash              = 0;
+    int N                      = 0;
+    void *frames[MAX_FRAMES]   = {};
+    std::atomic<int64_t> bytes = 0; // Estimated bytes in use
+};
+
+
+// Live sampled allocation (ptr: nullptr - empty, TOMBSTONE - freed, BUSY - being written)
+struct heap_alloc {
+    std::atomic<void *> ptr = nullptr;
+    uint32_t stack          = 0;
+    int64_t weight          = 0;
+};
+static void *const TOMBSTONE = reinterpret_cast<void *>( 1 );
+static void *const BUSY      = reinterpret_cast<void *>( 2 );
+
+
+// Per-thread data (trivial so the thread_local does not need initialization)
+struct heap_thread_struct {
+    int64_t countdown; // Bytes until the next sample
+    uint64_t rng;      // Random number state (0 if not initialized)
+    bool busy;         // Recording a sample (prevents recursion)
+};
+
+
+static std::atomic<bool> heap_running( false );
+static std::atomic<int64_t> heap_rate( 512 * 1024 );
+static std::atomic<int64_t> heap_live( 0 );
+static std::atomic<int64_t> heap_bytes( 0 );
+static std::atomic<size_t> heap_dropped( 0 );
+static heap_stack heap_stacks[MAX_STACKS];
+static heap_alloc heap_allocs[MAX_ALLOCS];
+static thread_local heap_thread_struct heap_thread TLS_INITIAL_EXEC;
+
+
+/****************************************************************************
+ *  Helper functions                                                         *
+ ****************************************************************************/
+static inline uint64_t hashPtr( const void *ptr )
+{
+    auto x = reinterpret_cast<uint64_t>( ptr );
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccd;
+    x ^= x >> 33;
+    return x;
+}
+// Draw the number of bytes until the next sample (exponential distribution)
+static int64_t nextSample( uint64_t &rng )
+{
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    double u    = ( ( rng >> 11 ) + 0.5 ) / 9007199254740992.0;
+    double rate = heap_rate.load( std::memory_order_relaxed );
+    return static_cast<int64_t>( -std::log( u ) * rate ) + 1;
+}
+// Find/add the call stack, returning the index (or MAX_STACKS if the table is full)
+static uint32_t findStack( int N, void *const *frames )
+{
+    uint64_t hash = StackTrace::hashStack( frames, N );
+    for ( int k = 0; k < MAX_PROBE; k++ ) {
+        auto &stack = heap_stacks[( hash + k ) % MAX_STACKS];
+        int state   = stack.state.load( std::memory_order_acquire );
+        if ( state == 0 && stack.state.compare_exchange_strong( state, 1 ) ) {
+            stack.hash = hash;
+            stack.N    = N;
+            memcpy( stack.frames, frames, N * sizeof( void * ) );
+            stack.state.store( 2, std::memory_order_release );
+            return ( hash + k ) % MAX_STACKS;
+        }
+        while ( state == 1 )
+            state = stack.state.load( std::memory_order_acquire );
+        if ( stack.hash == hash && stack.N == N &&
+             memcmp( stack.frames, frames, N * sizeof( void * ) ) == 0 )
+            return ( hash + k ) % MAX_STACKS;
+    }
+    return MAX_STACKS;
+}
+
+
+/****************************************************************************
+ *  Record the allocations                                                   *
+ ****************************************************************************/
+// Note: this must be inlined into recordAlloc for the call stack to be correct
+static ALWAYS_INLINE void sampleAlloc( void *ptr, size_t bytes )
+{
+    auto &thread = heap_thread;
+    if ( thread.busy )
+        return;
+    thread.busy = true;
+    if ( thread.rng == 0 ) {
+        // First allocation on the thread: initialize the random numbers
+        thread.rng       = hashPtr( &thread ) ^ hashPtr( ptr ) ^ 0x9e3779b97f4a7c15;
+        thread.countdown = nextSample( thread.rng );
+        thread.busy      = false;
+        return;
+    }
+    thread.countdown = nextSample( thread.rng );
+    // Estimate the bytes represented by the sample (the probability of sampling the
+    //    allocation is 1-exp(-bytes/rate))
+    double rate    = heap_rate.load( std::memory_order_relaxed );
+    int64_t weight = bytes / ( 1.0 - std::exp( -( bytes / rate ) ) );
+#ifdef USE_LINUX
+    // Get the call stack
+    void *frames[MAX_FRAMES + SKIP_FRAMES];
+    int N        = std::max( ::backtrace( frames, MAX_FRAMES + SKIP_FRAMES ) - SKIP_FRAMES, 0 );
+    uint32_t id  = findStack( N, &frames[SKIP_FRAMES] );
+    bool success = false;
+    if ( id != MAX_STACKS ) {
+        // Add the allocation
+        uint64_t hash = hashPtr( ptr );
+        for ( int k = 0; k < MAX_PROBE && !success; k++ ) {
+            auto &alloc = heap_allocs[( hash + k ) % MAX_ALLOCS];
+            void *old   = alloc.ptr.load( std::memory_order_relaxed );
+            if ( old != nullptr && old != TOMBSTONE )
+                continue;
+            if ( !alloc.ptr.compare_exchange_strong( old, BUSY ) )
+                continue;
+            alloc.stack  = id;
+            alloc.weight = weight;
+            alloc.ptr.store( ptr, std::memory_order_release );
+            success = true;
+        }
+    }
+    if ( success ) {
+        heap_stacks[id].bytes.fetch_add( weight, std::memory_order_relaxed );
+        heap_bytes.fetch_add( weight, std::memory_order_relaxed );
+        heap_live.fetch_add( 1, std::memory_order_relaxed );
+    } else {
+        heap_dropped++;
+    }
+#endif
+    thread.busy = false;
+}
+NO_INLINE void StackTrace::HeapProfiler::recordAlloc( void *ptr, size_t bytes )
+{
+    if ( !heap_running.load( std::memory_order_relaxed ) || ptr == nullptr )
+        return;
+    auto &thread = heap_thread;
+    thread.countdown -= bytes;
+    if ( thread.countdown > 0 )
+        return;
+    sampleAlloc( ptr, bytes );
+}
+void StackTrace::HeapProfiler::recordFree( void *ptr )
+{
+    if ( heap_live.load( std::memory_order_relaxed ) == 0 || ptr == nullptr )
+        return;
+    uint64_t hash = hashPtr( ptr );
+    for ( int k = 0; k < MAX_PROBE; k++ ) {
+        auto &alloc = heap_allocs[( hash + k ) % MAX_ALLOCS];
+        void *old   = alloc.ptr.load( std::memory_order_acquire );
+        if ( old == nullptr )
+            return;
+        if ( old == ptr ) {
+            uint32_t id    = alloc.stack;
+            int64_t weight = alloc.weight;
+            if ( alloc.ptr.compare_exchange_strong( old, TOMBSTONE ) ) {
+                heap_stacks[id].bytes.fetch_sub( weight, std::memory_order_relaxed );
+                heap_bytes.fetch_sub( weight, std::memory_order_relaxed );
+                heap_live.fetch_sub( 1, std::memory_order_relaxed );
+            }
+            return;
+        }
+    }
+}
+
+
+/****************************************************************************
+ *  Start/stop the heap profiler                                             *
+ ****************************************************************************/
+bool StackTrace::HeapProfiler::hooksInstalled()
+{
+#ifdef USE_LINUX
+    return &stacktrace_heap_hooks != nullptr;
+#else
+    return false;
+#endif
+}
+void StackTrace::HeapProfiler::start( size_t sampleBytes )
+{
+#ifdef USE_LINUX
+    if ( !hooksInstalled() ) {
+        static bool print = true;
+        if ( print ) {
+            std::cerr << "Heap profiler requires linking with stacktrace_heap_hooks\n";
+            print = false;
+        }
+    }
+    // Call backtrace once to make sure it is loaded before calling it from malloc
+    void *tmp[4];
+    ::backtrace( tmp, 4 );
+    heap_rate.store( std::max<int64_t>( sampleBytes, 1 ) );
+    heap_running.store( true );
+#else
+    static bool print = true;
+    if ( print ) {
+        std::cerr << "Heap profiler is not supported on this compiler/OS\n";
+        print = false;
+    }
+    (void) sampleBytes;
+#endif
+}
+void StackTrace::HeapProfiler::stop() { heap_running.store( false ); }
+bool StackTrace::HeapProfiler::running() { return heap_running.load(); }
+size_t StackTrace::HeapProfiler::liveBytes() { return std::max<int64_t>( heap_bytes.load(), 0 ); }
+size_t StackTrace::HeapProfiler::dropped() { return heap_dropped.load(); }
+
+
+/****************************************************************************
+ *  Get the results                                                          *
+ ****************************************************************************/
+StackTrace::multi_stack_info StackTrace::HeapProfiler::getProfile()
+{
+    std::vector<std::vector<void *>> trace;
+    std::vector<int> count;
+    for ( auto &stack : heap_stacks ) {
+        if ( stack.state.load( std::memory_order_acquire ) != 2 )
+            continue;
+        int64_t kb = ( stack.bytes.load( std::memory_order_relaxed ) + 512 ) / 1024;
+        if ( kb <= 0 || stack.N == 0 )
+            continue;
+        trace.emplace_back( stack.frames, stack.frames + stack.N );
+        count.push_back( kb );
+    }
+    return generateMultiStack( trace, count );
+}
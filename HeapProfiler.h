@@ -0,0 +1,68 @@
+#ifndef included_StackTrace_HeapProfiler
+#define included_StackTrace_HeapProfiler
+
+#include <cstddef>
+
+#include "StackTrace/StackTrace.h"
+
+
+namespace StackTrace::HeapProfiler {
+
+
+/*!
+ * @brief  Start the heap profiler
+ * @details  This function starts sampling the memory allocations.  On average one
+ *    allocation is sampled for every sampleBytes bytes allocated (Poisson sampling),
+ *    and the raw call stack of the sampled allocations is recorded until the memory
+ *    is freed.  Sampled allocations are tracked until they are freed (even after the
+ *    profiler is stopped).
+ *    Note: the allocations are only seen if the executable is linked with the
+ *    stacktrace_heap_hooks library (or stacktrace_hooks which contains all of the hooks),
+ *    or it is preloaded.  The library only interposes the functions this profiler
+ *    needs.  This functionality is currently only availible on Linux.
+ * @param[in] sampleBytes   Average number of bytes allocated between samples
+ */
+void start( size_t sampleBytes = 512 * 1024 );
+
+
+//! Stop sampling new allocations
+void stop();
+
+
+//! Check if the heap profiler is running
+bool running();
+
+
+//! Check if the allocation hooks are installed (stacktrace_heap_hooks is linked)
+bool hooksInstalled();
+
+
+//! Return the estimated number of bytes in use (from the sampled allocations)
+size_t liveBytes();
+
+
+//! Return the number of samples that could not be recorded (tables are full)
+size_t dropped();
+
+
+/*!
+ * @brief  Get the heap profile
+ * @details  This function returns the call stacks of the sampled allocations that
+ *    have not been freed, where the count for each entry is the estimated memory in
+ *    use (in KiB) allocated by the call stack.
+ * @return              Returns the call stacks of the memory in use
+ */
+multi_stack_info getProfile();
+
+
+//! Record an allocation (called by the allocation hooks)
+void recordAlloc( void *ptr, size_t bytes );
+
+
+//! Record a free (called by the allocation hooks)
+void recordFree( void *ptr );
+
+
+} // namespace StackTrace::HeapProfiler
+
+#endif
@@ -0,0 +1,260 @@
+#include "StackTrace/LockProfiler.h"
+#include "StackTrace/Fingerprint.h"
+#include "StackTrace/StackTrace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+
+// Detect the OS
+// clang-format off
+#if defined( WIN32 ) || defined( _WIN32 ) || defined( WIN64 ) || defined( _WIN64 ) || defined( _MSC_VER )
+    #define USE_WINDOWS
+#elif defined( __APPLE__ )
+    #define USE_MAC
+#elif defined( __linux ) || defined( __linux__ ) || defined( __unix ) || defined( __posix )
+    #define USE_LINUX
+#else
+    #error Unknown OS
+#endif
+// clang-format on
+
+
+// Include system dependent headers
+// clang-format off
+#ifdef USE_LINUX
+    #include <execinfo.h>
+    #define NO_INLINE __attribute__( ( noinline ) )
+    #define ALWAYS_INLINE inline __attribute__( ( always_inline ) )
+#else
+    #define NO_INLINE
+    #define ALWAYS_INLINE inline
+#endif
+// clang-format on
+
+
+/****************************************************************************
+ *  Internal data for the lock profiler                                      *
+ *  Note: the tables are fixed size and protected by a spin lock since they  *
+ *    are used from inside pthread_mutex_lock                                *
+ ****************************************************************************/
+static constexpr int MAX_FRAMES      = StackTrace::LockProfiler::owner_stack::MAX_FRAMES;
+static constexpr uint32_t MAX_STACKS = 1024; // Number of unique call stacks
+static constexpr int MAX_PROBE       = 64;   // Maximum number of probes for the tables
+
+
+// Call stack with the total time waited
+struct lock_stack {
+    uint64_t hash            = 0;
+    int N                    = 0;
+    void *frames[MAX_FRAMES] = {};
+    int64_t ns               = 0;
+};
+
+
+// Table of call stacks
+struct lock_table {
+    std::atomic_flag lock = ATOMIC_FLAG_INIT;
+    lock_stack stacks[MAX_STACKS];
+};
+
+
+static std::atomic<bool> lock_running( false );
+static std::atomic<int64_t> lock_threshold( 1000000 );
+static std::atomic<size_t> lock_count( 0 );
+static lock_table lock_waiters;
+static lock_table lock_owners;
+
+
+/****************************************************************************
+ *  Helper functions                                                         *
+ ****************************************************************************/
+static inline void acquire( std::atomic_flag &lock )
+{
+    while ( lock.test_and_set( std::memory_order_acquire ) )
+        std::this_thread::yield();
+}
+static inline void release( std::atomic_flag &lock ) { lock.clear( std::memory_order_release ); }
+static void addStack( lock_table &table, int N, void *const *frames, int64_t ns )
+{
+    N             = std::min( N, MAX_FRAMES );
+    uint64_t hash = StackTrace::hashStack( frames, N );
+    acquire( table.lock );
+    for ( int k = 0; k < MAX_PROBE; k++ ) {
+        auto &stack = table.stacks[( hash + k ) % MAX_STACKS];
+        if ( stack.N == 0 ) {
+            stack.hash = hash;
+            stack.N    = N;
+            stack.ns   = 0;
+            memcpy( stack.frames, frames, N * sizeof( void * ) );
+        }
+        if ( stack.hash == hash && stack.N == N &&
+             memcmp( stack.frames, frames, N * sizeof( void * ) ) == 0 ) {
+            stack.ns += ns;
+            break;
+        }
+    }
+    release( table.lock );
+}
+static StackTrace::multi_stack_info getStacks( lock_table &table )
+{
+    std::vector<std::vector<void *>> trace;
+    std::vector<int> count;
+    acquire( table.lock );
+    for ( auto &stack : table.stacks ) {
+        if ( stack.N == 0 )
+            continue;
+        int64_t us = std::min<int64_t>( ( stack.ns + 500 ) / 1000, INT_MAX );
+        trace.emplace_back( stack.frames, stack.frames + stack.N );
+        count.push_back( std::max<int64_t>( us, 1 ) );
+    }
+    release( table.lock );
+    return StackTrace::generateMultiStack( trace, count );
+}
+static inline int64_t now()
+{
+    auto t = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>( t ).count();
+}
+
+
+/****************************************************************************
+ *  Record the contention                                                    *
+ ****************************************************************************/
+void StackTrace::LockProfiler::recordWait(
+    int N_waiter, void *const *waiter, int N_owner, void *const *owner, int64_t ns )
+{
+    if ( N_waiter > 0 )
+        addStack( lock_waiters, N_waiter, waiter, ns );
+    if ( N_owner > 0 )
+        addStack( lock_owners, N_owner, owner, ns );
+    lock_count++;
+}
+NO_INLINE void StackTrace::LockProfiler::owner_stack::record()
+{
+#ifdef USE_LINUX
+    // Get the call stack (skipping this function)
+    void *tmp[MAX_FRAMES + 1];
+    int N2 = std::max( ::backtrace( tmp, MAX_FRAMES + 1 ) - 1, 0 );
+    acquire( lock );
+    N = N2;
+    memcpy( frames, &tmp[1], N2 * sizeof( void * ) );
+    release( lock );
+#endif
+}
+int StackTrace::LockProfiler::owner_stack::get( void **frames2 )
+{
+    // Get the call stack and clear it (the next owner will record a new stack)
+    acquire( lock );
+    int N2 = N;
+    memcpy( frames2, frames, N2 * sizeof( void * ) );
+    N = 0;
+    release( lock );
+    return N2;
+}
+
+
+/****************************************************************************
+ *  Slow path for the instrumented mutexes                                   *
+ ****************************************************************************/
+// Note: this must be inlined into lockSlow for the call stack to be correct
+template<class TYPE>
+static ALWAYS_INLINE void waitForLock( TYPE &mutex, std::atomic<int> &waiters,
+                                       StackTrace::LockProfiler::owner_stack &owner, bool shared )
+{
+    auto lock = [&mutex, shared]( std::chrono::nanoseconds timeout ) {
+        if constexpr ( std::is_same_v<TYPE, std::shared_timed_mutex> ) {
+            if ( shared )
+                return mutex.try_lock_shared_for( timeout );
+        }
+        return mutex.try_lock_for( timeout );
+    };
+    if ( !StackTrace::LockProfiler::running() ) {
+        while ( !lock( std::chrono::seconds( 1 ) ) ) {}
+        return;
+    }
+    int64_t start     = now();
+    int64_t threshold = StackTrace::LockProfiler::threshold();
+    if ( lock( std::chrono::nanoseconds( threshold ) ) )
+        return;
+    // We waited longer than the threshold
+    // Note: we avoid mutex.lock() since it may call an interposed pthread_mutex_lock
+    waiters++;
+    void *waiter[MAX_FRAMES + 1];
+    int N_waiter = 0;
+#ifdef USE_LINUX
+    // Get the call stack (skipping lockSlow)
+    N_waiter = std::max( ::backtrace( waiter, MAX_FRAMES + 1 ) - 1, 0 );
+#endif
+    while ( !lock( std::chrono::seconds( 1 ) ) ) {}
+    waiters--;
+    int64_t ns = now() - start;
+    void *frames[MAX_FRAMES];
+    int N_owner = owner.get( frames );
+    StackTrace::LockProfiler::recordWait( N_waiter, &waiter[1], N_owner, frames, ns );
+}
+NO_INLINE void StackTrace::mutex::lockSlow()
+{
+    waitForLock( d_mutex, d_waiters, d_owner, false );
+}
+NO_INLINE void StackTrace::shared_mutex::lockSlow( bool shared )
+{
+    waitForLock( d_mutex, d_waiters, d_owner, shared );
+}
+
+
+/****************************************************************************
+ *  Start/stop the lock profiler                                             *
+ ****************************************************************************/
+void StackTrace::LockProfiler::start( double threshold )
+{
+#ifdef USE_LINUX
+    // Call backtrace once to make sure it is loaded before calling it from a lock
+    void *tmp[4];
+    ::backtrace( tmp, 4 );
+    lock_threshold.store( std::max<int64_t>( 1e9 * threshold, 1 ) );
+    lock_running.store( true );
+#else
+    static bool print = true;
+    if ( print ) {
+        std::cerr << "Lock profiler is not supported on this compiler/OS\n";
+        print = false;
+    }
+    (void) threshold;
+#endif
+}
+void StackTrace::LockProfiler::stop() { lock_running.store( false ); }
+bool StackTrace::LockProfiler::running() { return lock_running.load( std::memory_order_relaxed ); }
+int64_t StackTrace::LockProfiler::threshold() { return lock_threshold.load(); }
+size_t StackTrace::LockProfiler::contentions() { return lock_count.load(); }
+void StackTrace::LockProfiler::clear()
+{
+    for ( auto table : { &lock_waiters, &lock_owners } ) {
+        acquire( table->lock );
+        for ( auto &stack : table->stacks )
+            stack.N = 0;
+        release( table->lock );
+    }
+    lock_count.store( 0 );
+}
+
+
+/****************************************************************************
+ *  Get the results                                                          *
+ ****************************************************************************/
+StackTrace::multi_stack_info StackTrace::LockProfiler::getWaiters()
+{
+    return getStacks( lock_waiters );
+}
+StackTrace::multi_stack_info StackTrace::LockProfiler::getOwners()
+{
+    return getStacks( lock_owners );
+}
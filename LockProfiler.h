@@ -0,0 +1,171 @@
+#ifndef included_StackTrace_LockProfiler
+#define included_StackTrace_LockProfiler
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <shared_mutex>
+
+#include "StackTrace/StackTrace.h"
+
+
+namespace StackTrace {
+
+
+namespace LockProfiler {
+
+
+/*!
+ * @brief  Start the lock contention profiler
+ * @details  This function starts recording the lock contention for the instrumented
+ *    mutexes (StackTrace::mutex and StackTrace::shared_mutex) and pthread mutexes if the
+ *    executable is linked with the stacktrace_lock_hooks (or stacktrace_hooks) library.
+ *    The library only interposes pthread_mutex_lock.  When a thread waits longer
+ *    than the threshold to acquire a lock, the call stack of the waiting thread and of
+ *    the owner (when it releases the lock) are recorded along with the total wait time.
+ *    Note: the owner stack is not availible for pthread mutexes.  This functionality is
+ *    currently only availible on Linux.
+ * @param[in] threshold     Minimum wait time to record (s)
+ */
+void start( double threshold = 1e-3 );
+
+
+//! Stop the lock contention profiler
+void stop();
+
+
+//! Check if the lock contention profiler is running
+bool running();
+
+
+//! Return the threshold (ns)
+int64_t threshold();
+
+
+//! Clear the contention data
+void clear();
+
+
+//! Return the number of waits that exceeded the threshold
+size_t contentions();
+
+
+/*!
+ * @brief  Get the call stacks of the waiting threads
+ * @details  This function returns the call stacks of the threads that waited longer
+ *    than the threshold to acquire a lock, where the count for each entry is the total
+ *    time spent waiting (us).
+ * @return              Returns the call stacks of the waiting threads
+ */
+multi_stack_info getWaiters();
+
+
+/*!
+ * @brief  Get the call stacks of the lock owners
+ * @details  This function returns the call stacks of the lock owners (when the lock
+ *    was released) that caused a thread to wait longer than the threshold, where the
+ *    count for each entry is the total time the other threads spent waiting (us).
+ * @return              Returns the call stacks of the lock owners
+ */
+multi_stack_info getOwners();
+
+
+//! Record a wait (internal use, the stacks are raw call stacks)
+void recordWait( int N_waiter, void *const *waiter, int N_owner, void *const *owner,
+                 int64_t ns );
+
+
+//! Storage for the call stack of the owner of an instrumented mutex (internal use)
+struct owner_stack {
+    static constexpr int MAX_FRAMES = 32;
+    std::atomic_flag lock           = ATOMIC_FLAG_INIT;
+    int N                           = 0;
+    void *frames[MAX_FRAMES];
+    void record();
+    int get( void **frames );
+};
+
+
+} // namespace LockProfiler
+
+
+/*!
+ * @brief  Instrumented mutex
+ * @details  This class is a drop-in replacement for std::mutex that records the lock
+ *    contention (see LockProfiler).  An uncontended lock is a single atomic operation.
+ */
+class mutex final
+{
+public:
+    mutex()                           = default;
+    mutex( const mutex & )            = delete;
+    mutex &operator=( const mutex & ) = delete;
+    inline void lock()
+    {
+        if ( !d_mutex.try_lock() )
+            lockSlow();
+    }
+    inline bool try_lock() { return d_mutex.try_lock(); }
+    inline void unlock()
+    {
+        if ( d_waiters.load( std::memory_order_relaxed ) > 0 )
+            d_owner.record();
+        d_mutex.unlock();
+    }
+
+private:
+    void lockSlow();
+    std::timed_mutex d_mutex;
+    std::atomic<int> d_waiters = 0;
+    LockProfiler::owner_stack d_owner;
+};
+
+
+/*!
+ * @brief  Instrumented shared mutex
+ * @details  This class is a drop-in replacement for std::shared_mutex that records the
+ *    lock contention (see LockProfiler).  An uncontended lock is a single atomic operation.
+ */
+class shared_mutex final
+{
+public:
+    shared_mutex()                                  = default;
+    shared_mutex( const shared_mutex & )            = delete;
+    shared_mutex &operator=( const shared_mutex & ) = delete;
+    inline void lock()
+    {
+        if ( !d_mutex.try_lock() )
+            lockSlow( false );
+    }
+    inline bool try_lock() { return d_mutex.try_lock(); }
+    inline void unlock()
+    {
+        if ( d_waiters.load( std::memory_order_relaxed ) > 0 )
+            d_owner.record();
+        d_mutex.unlock();
+    }
+    inline void lock_shared()
+    {
+        if ( !d_mutex.try_lock_shared() )
+            lockSlow( true );
+    }
+    inline bool try_lock_shared() { return d_mutex.try_lock_shared(); }
+    inline void unlock_shared()
+    {
+        if ( d_waiters.load( std::memory_order_relaxed ) > 0 )
+            d_owner.record();
+        d_mutex.unlock_shared();
+    }
+
+private:
+    void lockSlow( bool shared );
+    std::shared_timed_mutex d_mutex;
+    std::atomic<int> d_waiters = 0;
+    LockProfiler::owner_stack d_owner;
+};
+
+
+} // namespace StackTrace
+
+#endif
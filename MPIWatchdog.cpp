@@ -0,0 +1,284 @@
+#include "StackTrace/MPIWatchdog.h"
+#include "StackTrace/StackTrace.h"
+#include "StackTraceInternal.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+// Detect the OS
+// clang-format off
+#if defined( WIN32 ) || defined( _WIN32 ) || defined( WIN64 ) || defined( _WIN64 ) || defined( _MSC_VER )
+    #define USE_WINDOWS
+#elif defined( __APPLE__ )
+    #define USE_MAC
+#elif defined( __linux ) || defined( __linux__ ) || defined( __unix ) || defined( __posix )
+    #define USE_LINUX
+#else
+    #error Unknown OS
+#endif
+// clang-format on
+
+
+// Include system dependent headers
+// clang-format off
+#ifdef USE_WINDOWS
+    #include <process.h>
+    #define getpid _getpid
+#else
+    #include <unistd.h>
+#endif
+#if defined( _MSC_VER ) && ( defined( _M_X64 ) || defined( _M_IX86 ) )
+    #include <intrin.h>
+    #define USE_RDTSC
+#elif defined( __x86_64__ ) || defined( __i386__ )
+    #include <x86intrin.h>
+    #define USE_RDTSC
+#endif
+#ifdef USE_LINUX
+    #define TLS_INITIAL_EXEC __attribute__( ( tls_model( "initial-exec" ) ) )
+    // Defined by the stacktrace_pmpi library
+    extern "C" __attribute__( ( weak ) ) int stacktrace_mpi_hooks;
+#else
+    #define TLS_INITIAL_EXEC
+#endif
+// clang-format on
+
+
+using StackTrace::detail::getGlobalRank;
+using StackTrace::detail::getLastRemoteRequest;
+
+
+/****************************************************************************
+ *  Internal data for the MPI watchdog                                       *
+ *  Note: the calls are timed with the time stamp counter (if available) and *
+ *    each thread only writes to its own slot so recording a call is cheap   *
+ ****************************************************************************/
+static constexpr int MAX_THREADS = 1024; // Maximum number of threads calling MPI
+
+
+// Current time stamp counter
+static inline uint64_t ticks()
+{
+#ifdef USE_RDTSC
+    return __rdtsc();
+#else
+    auto t = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>( t ).count();
+#endif
+}
+
+
+// Blocking MPI call in progress for a thread
+//    start: time stamp counter at the start of the call (0 if not in a call)
+struct call_slot {
+    std::atomic<bool> used         = false;
+    std::atomic<uint64_t> start    = 0;
+    std::atomic<const char *> call = nullptr; // Name of the MPI call
+    std::atomic<const char *> comm = nullptr; // Name of the communicator
+    std::atomic<uint64_t> id       = 0;       // Handle for the communicator
+    std::atomic<int> tid           = -1;      // Thread id (the slot may be claimed again)
+    int depth                      = 0;       // Number of nested calls (owning thread only)
+};
+
+
+// Watchdog data (the settings are protected by mpi_mutex)
+static std::mutex mpi_mutex;
+static std::condition_variable mpi_cv;
+static std::thread mpi_thread;
+static bool mpi_running     = false;
+static double mpi_threshold = 0;
+static double mpi_ticks     = 1e9; // Time stamp counter ticks per second
+static std::string mpi_filename;
+static StackTrace::printStackType mpi_type = StackTrace::printStackType::global;
+static std::atomic<size_t> mpi_reports( 0 );
+static call_slot mpi_slots[MAX_THREADS];
+
+
+// Slot for the current thread (trivial so the thread_local does not need initialization)
+struct mpi_thread_struct {
+    call_slot *slot;
+};
+static thread_local mpi_thread_struct mpi_current TLS_INITIAL_EXEC;
+
+
+// Release the slot when the thread exits
+thread_local struct MPIThread {
+    ~MPIThread()
+    {
+        auto slot = mpi_current.slot;
+        if ( slot ) {
+            slot->start.store( 0 );
+            slot->used.store( false, std::memory_order_release );
+        }
+        mpi_current.slot = nullptr;
+    }
+} mpiThread;
+
+
+/****************************************************************************
+ *  Record the MPI calls                                                     *
+ ****************************************************************************/
+static call_slot *getSlot()
+{
+    for ( auto &slot : mpi_slots ) {
+        bool used = false;
+        if ( !slot.used.compare_exchange_strong( used, true ) )
+            continue;
+        slot.depth = 0;
+        slot.tid.store( StackTrace::getSystemThreadID( StackTrace::thisThread() ),
+                        std::memory_order_relaxed );
+        mpi_current.slot = &slot;
+        [[maybe_unused]] auto tmp = &mpiThread; // Release the slot when the thread exits
+        return &slot;
+    }
+    return nullptr;
+}
+void StackTrace::MPIWatchdog::enter( const char *call, const char *comm, uint64_t id )
+{
+    auto slot = mpi_current.slot;
+    if ( !slot ) {
+        slot = getSlot();
+        if ( !slot )
+            return;
+    }
+    if ( slot->depth++ > 0 )
+        return;
+    slot->call.store( call, std::memory_order_relaxed );
+    slot->comm.store( comm, std::memory_order_relaxed );
+    slot->id.store( id, std::memory_order_relaxed );
+    slot->start.store( ticks(), std::memory_order_release );
+}
+void StackTrace::MPIWatchdog::leave()
+{
+    auto slot = mpi_current.slot;
+    if ( slot && --slot->depth == 0 )
+        slot->start.store( 0, std::memory_order_release );
+}
+
+
+/****************************************************************************
+ *  Watchdog thread                                                          *
+ ****************************************************************************/
+static void runMPIWatchdogThread()
+{
+    // Check the calls 4 times per threshold (at most every second)
+    auto interval = std::chrono::duration<double>( std::min( mpi_threshold / 4, 1.0 ) );
+    char comm[64], reason[256];
+    // Call that was last reported for each slot (only used by this thread)
+    // Note: the start of a call is unique, so a new claim of the slot does not need a reset
+    std::vector<uint64_t> reported( MAX_THREADS, 0 );
+    std::unique_lock<std::mutex> lock( mpi_mutex );
+    while ( mpi_running ) {
+        mpi_cv.wait_for( lock, interval );
+        if ( !mpi_running )
+            break;
+        // The ranks wait up to 50% longer than the threshold (lower ranks report first)
+        int rank = 0, size = 1;
+        getGlobalRank( rank, size );
+        double delay = mpi_threshold * ( 1 + 0.5 * std::log2( 1 + rank ) / std::log2( 1 + size ) );
+        uint64_t t   = ticks();
+        for ( int i = 0; i < MAX_THREADS; i++ ) {
+            auto &slot     = mpi_slots[i];
+            uint64_t start = slot.start.load( std::memory_order_acquire );
+            if ( start == 0 || start == reported[i] || t < start )
+                continue;
+            auto call = slot.call.load( std::memory_order_relaxed );
+            auto name = slot.comm.load( std::memory_order_relaxed );
+            auto id   = slot.id.load( std::memory_order_relaxed );
+            int tid   = slot.tid.load( std::memory_order_relaxed );
+            if ( slot.start.load( std::memory_order_acquire ) != start )
+                continue; // The call finished while reading the data
+            double time = ( t - start ) / mpi_ticks;
+            if ( time < delay )
+                continue;
+            reported[i] = start;
+            // Only gather the global call stacks if another rank has not requested them
+            // while the call was blocked
+            auto now = std::chrono::steady_clock::now().time_since_epoch();
+            auto t0  = std::chrono::duration_cast<std::chrono::nanoseconds>( now ).count() -
+                      static_cast<int64_t>( 1e9 * time );
+            auto type      = mpi_type;
+            bool requested = getLastRemoteRequest() > t0;
+            if ( type == StackTrace::printStackType::global && requested )
+                type = StackTrace::printStackType::threaded;
+            if ( name )
+                snprintf( comm, sizeof( comm ), " on %s", name );
+            else if ( id != 0 )
+                snprintf( comm, sizeof( comm ), " on communicator 0x%llx",
+                          static_cast<unsigned long long>( id ) );
+            else
+                comm[0] = 0;
+            snprintf( reason, sizeof( reason ), "%s%s blocked for %0.1f s on rank %i (thread %i)%s",
+                      call, comm, time, rank, tid,
+                      requested ? " (global call stacks were requested by another rank)" : "" );
+            lock.unlock();
+            if ( StackTrace::detail::writeWatchdogReport( reason, mpi_filename, type ) )
+                mpi_reports++;
+            lock.lock();
+        }
+    }
+}
+
+
+/****************************************************************************
+ *  Start/stop the MPI watchdog                                              *
+ ****************************************************************************/
+bool StackTrace::MPIWatchdog::hooksInstalled()
+{
+#ifdef USE_LINUX
+    return &stacktrace_mpi_hooks != nullptr;
+#else
+    return false;
+#endif
+}
+void StackTrace::MPIWatchdog::start( double threshold, const std::string &filename,
+                                     printStackType type )
+{
+    std::lock_guard<std::mutex> lock( mpi_mutex );
+    if ( mpi_running )
+        return;
+    if ( threshold <= 0 )
+        throw std::logic_error( "MPI watchdog threshold must be positive" );
+#ifdef USE_RDTSC
+    // Calibrate the time stamp counter
+    auto t0 = std::chrono::steady_clock::now();
+    auto c0 = ticks();
+    std::this_thread::sleep_for( std::chrono::milliseconds( 20 ) );
+    auto c1   = ticks();
+    auto t1   = std::chrono::steady_clock::now();
+    mpi_ticks = ( c1 - c0 ) / std::chrono::duration<double>( t1 - t0 ).count();
+#endif
+    mpi_threshold = threshold;
+    mpi_filename  = filename;
+    mpi_type      = type;
+    if ( mpi_filename.empty() )
+        mpi_filename = "StackTrace.mpi." + std::to_string( getpid() );
+    mpi_running = true;
+    mpi_thread  = std::thread( runMPIWatchdogThread );
+}
+void StackTrace::MPIWatchdog::stop()
+{
+    std::unique_lock<std::mutex> lock( mpi_mutex );
+    if ( !mpi_running )
+        return;
+    mpi_running = false;
+    lock.unlock();
+    mpi_cv.notify_all();
+    mpi_thread.join();
+}
+bool StackTrace::MPIWatchdog::running()
+{
+    std::lock_guard<std::mutex> lock( mpi_mutex );
+    return mpi_running;
+}
+size_t StackTrace::MPIWatchdog::reports() { return mpi_reports.load(); }
@@ -0,0 +1,67 @@
+#ifndef included_StackTrace_MPIWatchdog
+#define included_StackTrace_MPIWatchdog
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "StackTrace/StackTrace.h"
+
+
+namespace StackTrace::MPIWatchdog {
+
+
+/*!
+ * @brief  Start watching the blocking MPI calls
+ * @details  This function starts a background thread that checks the blocking MPI calls
+ *    (collectives, blocking send/recv and waits) that are in progress.  If a call blocks
+ *    for longer than the threshold, the call stacks are captured and appended to the
+ *    report file with the MPI call, communicator and elapsed time.  A call is only
+ *    reported once.  When many ranks block in the same call (e.g. mismatched
+ *    collectives), the ranks wait up to 50% longer than the threshold (based on the
+ *    rank) and a rank only gathers the global call stacks if no other rank has requested
+ *    them while the call was blocked.
+ *    Note: the MPI calls are only seen if the executable is linked with the
+ *    stacktrace_pmpi library before the MPI library.
+ * @param[in] threshold  Time a call may block before it is reported (s)
+ * @param[in] filename   File to write the reports (default is StackTrace.mpi.<pid>)
+ * @param[in] type       Stacks to capture (global: all processes, threaded: all threads)
+ */
+void start( double threshold, const std::string &filename = "",
+            printStackType type = printStackType::global );
+
+
+//! Stop watching the MPI calls
+void stop();
+
+
+//! Check if the MPI calls are being watched
+bool running();
+
+
+//! Check if the MPI wrappers are installed (stacktrace_pmpi is linked)
+bool hooksInstalled();
+
+
+//! Return the number of reports written
+size_t reports();
+
+
+/*!
+ * @brief  Record the start of a blocking MPI call
+ * @details  This function is called by the PMPI wrappers before calling the MPI library.
+ *    It only reads the time stamp counter and updates a per thread record.
+ * @param[in] call      Name of the MPI call (must be a string literal)
+ * @param[in] comm      Name of the communicator (string literal, may be null)
+ * @param[in] id        Handle for the communicator (0 if the call has no communicator)
+ */
+void enter( const char *call, const char *comm, uint64_t id );
+
+
+//! Record the end of a blocking MPI call (called by the PMPI wrappers)
+void leave();
+
+
+} // namespace StackTrace::MPIWatchdog
+
+#endif
@@ -0,0 +1,481 @@
+#include "StackTrace/Fingerprint.h"
+#include "StackTrace/Profiler.h"
+#include "StackTrace/StackTrace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+
+// Detect the OS
+// clang-format off
+#if defined( WIN32 ) || defined( _WIN32 ) || defined( WIN64 ) || defined( _WIN64 ) || defined( _MSC_VER )
+    #define USE_WINDOWS
+#elif defined( __APPLE__ )
+    #define USE_MAC
+#elif defined( __linux ) || defined( __linux__ ) || defined( __unix ) || defined( __posix )
+    #define USE_LINUX
+#else
+    #error Unknown OS
+#endif
+// clang-format on
+
+
+// Include system dependent headers
+// clang-format off
+#ifdef USE_LINUX
+    #include <csignal>
+    #include <ctime>
+    #include <execinfo.h>
+    #include <linux/perf_event.h>
+    #include <pthread.h>
+    #include <sys/ioctl.h>
+    #include <sys/mman.h>
+    #include <sys/syscall.h>
+    #include <unistd.h>
+#endif
+// clang-format on
+
+
+/****************************************************************************
+ *  Internal data for the profiler                                           *
+ ****************************************************************************/
+static constexpr int MAX_FRAMES       = 128; // Maximum number of frames for a sample
+static constexpr int SKIP_FRAMES      = 2;   // Frames from the signal handler / trampoline
+static constexpr uint32_t BUFFER_SIZE = 64;  // Number of samples stored for each thread
+
+
+// Raw call stack for a single sample
+struct sample_struct {
+    int N;
+    void *frames[MAX_FRAMES];
+};
+
+
+// Lock-free ring buffer for a single thread
+//    The signal handler running on the sampled thread is the only producer and
+//    the background thread aggregating the samples is the only consumer
+//    When using perf_event_open the kernel writes the samples to the mmap ring instead
+struct thread_buffer {
+    std::thread::native_handle_type thread;
+    bool active = false;
+#ifdef USE_LINUX
+    timer_t timer;
+#endif
+    int fd           = -1;      // perf_event_open file descriptor
+    void *ring       = nullptr; // perf_event_open ring buffer
+    size_t ring_size = 0;       // Size of the ring buffer (including the header page)
+    std::atomic<uint32_t> head    = 0;
+    std::atomic<uint32_t> tail    = 0;
+    std::atomic<uint32_t> dropped = 0;
+    sample_struct samples[BUFFER_SIZE];
+};
+
+
+// Hash a raw call stack
+struct rawStackHash {
+    size_t operator()( const std::vector<void *> &stack ) const
+    {
+        return StackTrace::hashStack( stack.data(), stack.size() );
+    }
+};
+
+
+// Profiler data (protected by profiler_mutex)
+// Note: the thread buffers are never freed since a signal may still reference them
+static std::mutex profiler_mutex;
+static std::condition_variable profiler_cv;
+static std::thread profiler_thread;
+static bool profiler_running = false;
+static int profiler_hz       = 100;
+static size_t profiler_count = 0;
+static size_t profiler_drop  = 0;
+static auto profiler_backend = StackTrace::Profiler::Backend::signal;
+static std::thread::native_handle_type profiler_caller;
+static std::vector<std::thread::native_handle_type> profiler_failed;
+static std::vector<std::unique_ptr<thread_buffer>> profiler_buffers;
+static std::unordered_map<std::vector<void *>, int, rawStackHash> profiler_stacks;
+
+
+/****************************************************************************
+ *  Signal handler / timers to sample the threads                            *
+ ****************************************************************************/
+#ifdef USE_LINUX
+static struct sigaction profiler_old_action;
+static void _profiler_signal_handler( int, siginfo_t *info, void * )
+{
+    if ( info == nullptr || info->si_code != SI_TIMER || info->si_value.sival_ptr == nullptr )
+        return;
+    int err       = errno;
+    auto buffer   = static_cast<thread_buffer *>( info->si_value.sival_ptr );
+    uint32_t head = buffer->head.load( std::memory_order_relaxed );
+    uint32_t tail = buffer->tail.load( std::memory_order_acquire );
+    if ( head - tail >= BUFFER_SIZE ) {
+        buffer->dropped.fetch_add( 1, std::memory_order_relaxed );
+    } else {
+        auto &sample = buffer->samples[head % BUFFER_SIZE];
+        sample.N     = ::backtrace( sample.frames, MAX_FRAMES );
+        buffer->head.store( head + 1, std::memory_order_release );
+    }
+    errno = err;
+}
+static bool startTimer( thread_buffer &buffer )
+{
+    clockid_t clock;
+    int tid = StackTrace::getSystemThreadID( buffer.thread );
+    if ( tid == -1 || pthread_getcpuclockid( buffer.thread, &clock ) != 0 )
+        return false;
+    struct sigevent event;
+    memset( &event, 0, sizeof( event ) );
+    event.sigev_notify          = SIGEV_THREAD_ID;
+    event.sigev_signo           = SIGPROF;
+    event.sigev_value.sival_ptr = &buffer;
+    event._sigev_un._tid        = tid;
+    if ( timer_create( clock, &event, &buffer.timer ) != 0 )
+        return false;
+    long ns = 1000000000 / profiler_hz;
+    struct itimerspec spec;
+    spec.it_interval.tv_sec  = ns / 1000000000;
+    spec.it_interval.tv_nsec = ns % 1000000000;
+    spec.it_value            = spec.it_interval;
+    if ( timer_settime( buffer.timer, 0, &spec, nullptr ) != 0 ) {
+        timer_delete( buffer.timer );
+        return false;
+    }
+    return true;
+}
+static void stopTimer( thread_buffer &buffer ) { timer_delete( buffer.timer ); }
+#else
+static bool startTimer( thread_buffer & ) { return false; }
+static void stopTimer( thread_buffer & ) {}
+#endif
+
+
+/****************************************************************************
+ *  Sample the threads using perf_event_open                                 *
+ *  The kernel collects the user call stack for each sample into a ring      *
+ *    buffer that is read by the profiler thread (the thread is not          *
+ *    interrupted by a signal)                                               *
+ ****************************************************************************/
+#ifdef USE_LINUX
+static bool startPerf( thread_buffer &buffer )
+{
+    int tid = StackTrace::getSystemThreadID( buffer.thread );
+    if ( tid == -1 )
+        return false;
+    struct perf_event_attr attr;
+    memset( &attr, 0, sizeof( attr ) );
+    attr.size                     = sizeof( attr );
+    attr.type                     = PERF_TYPE_SOFTWARE;
+    attr.config                   = PERF_COUNT_SW_TASK_CLOCK;
+    attr.sample_period            = 1000000000 / profiler_hz;
+    attr.sample_type              = PERF_SAMPLE_TID | PERF_SAMPLE_CALLCHAIN;
+    attr.exclude_kernel           = 1;
+    attr.exclude_hv               = 1;
+    attr.exclude_callchain_kernel = 1;
+    int fd = syscall( SYS_perf_event_open, &attr, tid, -1, -1, PERF_FLAG_FD_CLOEXEC );
+    if ( fd == -1 )
+        return false;
+    // Size the ring to hold the samples between drains
+    size_t page  = sysconf( _SC_PAGESIZE );
+    size_t bytes = profiler_hz * ( 8 * MAX_FRAMES + 32 ) / 5; // 2x the samples in 100 ms
+    size_t pages = 8;
+    while ( pages * page < bytes && pages < 256 )
+        pages *= 2;
+    size_t size = ( pages + 1 ) * page;
+    void *ring  = mmap( nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+    if ( ring == MAP_FAILED ) {
+        close( fd );
+        return false;
+    }
+    buffer.fd        = fd;
+    buffer.ring      = ring;
+    buffer.ring_size = size;
+    return true;
+}
+static void drainPerf( thread_buffer &buffer )
+{
+    auto meta     = static_cast<perf_event_mmap_page *>( buffer.ring );
+    auto data     = static_cast<const char *>( buffer.ring ) + meta->data_offset;
+    uint64_t size = meta->data_size;
+    uint64_t head = __atomic_load_n( &meta->data_head, __ATOMIC_ACQUIRE );
+    uint64_t tail = meta->data_tail;
+    // Copy a record from the ring (the record may wrap around the end of the ring)
+    // Note: the size of a record is stored as a 16-bit integer
+    uint64_t record[8192];
+    auto copy = [data, size, &record]( uint64_t pos, size_t bytes ) {
+        size_t offset = pos % size;
+        size_t N1     = std::min<size_t>( bytes, size - offset );
+        memcpy( record, &data[offset], N1 );
+        memcpy( reinterpret_cast<char *>( record ) + N1, data, bytes - N1 );
+    };
+    std::vector<void *> stack;
+    while ( tail < head ) {
+        copy( tail, sizeof( perf_event_header ) );
+        perf_event_header header;
+        memcpy( &header, record, sizeof( header ) );
+        if ( header.size < sizeof( perf_event_header ) )
+            break;
+        copy( tail, header.size );
+        if ( header.type == PERF_RECORD_SAMPLE ) {
+            // Layout: header, pid/tid, nr, ips[nr]
+            uint64_t N = std::min<uint64_t>( record[2], header.size / 8 - 3 );
+            stack.clear();
+            for ( uint64_t i = 0; i < N; i++ ) {
+                if ( record[3 + i] < PERF_CONTEXT_MAX ) // Skip the context markers
+                    stack.push_back( reinterpret_cast<void *>( record[3 + i] ) );
+            }
+            if ( !stack.empty() ) {
+                profiler_stacks[stack]++;
+                profiler_count++;
+            }
+        } else if ( header.type == PERF_RECORD_LOST ) {
+            // Layout: header, id, lost
+            profiler_drop += record[2];
+        }
+        tail += header.size;
+    }
+    __atomic_store_n( &meta->data_tail, head, __ATOMIC_RELEASE );
+}
+static void stopPerf( thread_buffer &buffer )
+{
+    ioctl( buffer.fd, PERF_EVENT_IOC_DISABLE, 0 );
+    drainPerf( buffer );
+    munmap( buffer.ring, buffer.ring_size );
+    close( buffer.fd );
+    buffer.fd   = -1;
+    buffer.ring = nullptr;
+}
+#else
+static bool startPerf( thread_buffer & ) { return false; }
+static void drainPerf( thread_buffer & ) {}
+static void stopPerf( thread_buffer & ) {}
+#endif
+
+
+/****************************************************************************
+ *  Start/stop sampling a thread (falls back to the signal backend)          *
+ ****************************************************************************/
+static bool startSampling( thread_buffer &buffer )
+{
+    if ( profiler_backend == StackTrace::Profiler::Backend::perf && startPerf( buffer ) )
+        return true;
+    return startTimer( buffer );
+}
+static void stopSampling( thread_buffer &buffer )
+{
+    if ( buffer.fd != -1 )
+        stopPerf( buffer );
+    else
+        stopTimer( buffer );
+}
+
+
+/****************************************************************************
+ *  Aggregate the samples / update the threads being sampled                 *
+ *  Note: these functions must be called while holding profiler_mutex        *
+ ****************************************************************************/
+static void drainBuffers()
+{
+    std::vector<void *> stack;
+    for ( auto &buffer : profiler_buffers ) {
+        if ( buffer->fd != -1 )
+            drainPerf( *buffer );
+        uint32_t tail = buffer->tail.load( std::memory_order_relaxed );
+        uint32_t head = buffer->head.load( std::memory_order_acquire );
+        for ( ; tail != head; tail++ ) {
+            const auto &sample = buffer->samples[tail % BUFFER_SIZE];
+            if ( sample.N <= SKIP_FRAMES )
+                continue;
+            stack.assign( &sample.frames[SKIP_FRAMES], &sample.frames[sample.N] );
+            profiler_stacks[stack]++;
+            profiler_count++;
+        }
+        buffer->tail.store( tail, std::memory_order_release );
+        profiler_drop += buffer->dropped.exchange( 0 );
+    }
+}
+static void updateThreads()
+{
+    auto threads = StackTrace::registeredThreads();
+    if ( std::find( threads.begin(), threads.end(), profiler_caller ) == threads.end() )
+        threads.push_back( profiler_caller );
+    // Stop sampling threads that are no longer registered
+    for ( auto &buffer : profiler_buffers ) {
+        if ( buffer->active &&
+             std::find( threads.begin(), threads.end(), buffer->thread ) == threads.end() ) {
+            stopSampling( *buffer );
+            buffer->active = false;
+        }
+    }
+    // Start sampling any new threads
+    for ( auto thread : threads ) {
+        bool found = std::find( profiler_failed.begin(), profiler_failed.end(), thread ) !=
+                     profiler_failed.end();
+        for ( const auto &buffer : profiler_buffers )
+            found = found || ( buffer->active && buffer->thread == thread );
+        if ( found )
+            continue;
+        thread_buffer *buffer = nullptr;
+        for ( auto &tmp : profiler_buffers ) {
+            if ( !tmp->active && buffer == nullptr )
+                buffer = tmp.get();
+        }
+        if ( buffer == nullptr ) {
+            profiler_buffers.push_back( std::make_unique<thread_buffer>() );
+            buffer = profiler_buffers.back().get();
+        }
+        buffer->thread = thread;
+        buffer->active = startSampling( *buffer );
+        if ( !buffer->active )
+            profiler_failed.push_back( thread );
+    }
+}
+static void runProfilerThread()
+{
+    // Drain the buffers before they can fill (at most every 100 ms)
+    int64_t us = std::min<int64_t>( 100000, 250000 * BUFFER_SIZE / profiler_hz );
+    std::unique_lock<std::mutex> lock( profiler_mutex );
+    while ( profiler_running ) {
+        profiler_cv.wait_for( lock, std::chrono::microseconds( us ) );
+        drainBuffers();
+        updateThreads();
+    }
+}
+
+
+/****************************************************************************
+ *  Start/stop the profiler                                                  *
+ ****************************************************************************/
+void StackTrace::Profiler::start( int hz, Backend backend )
+{
+#ifdef USE_LINUX
+    std::lock_guard<std::mutex> lock( profiler_mutex );
+    if ( profiler_running )
+        return;
+    // Call backtrace once to make sure it is loaded before calling it from a signal
+    void *tmp[4];
+    ::backtrace( tmp, 4 );
+    // Set the signal handler
+    struct sigaction sa;
+    memset( &sa, 0, sizeof( sa ) );
+    sigemptyset( &sa.sa_mask );
+    sa.sa_flags     = SA_SIGINFO | SA_RESTART;
+    sa.sa_sigaction = _profiler_signal_handler;
+    sigaction( SIGPROF, &sa, &profiler_old_action );
+    // Start sampling the threads
+    profiler_hz      = std::clamp( hz, 1, 10000 );
+    profiler_backend = backend;
+    profiler_caller  = StackTrace::thisThread();
+    profiler_running = true;
+    profiler_failed.clear();
+    updateThreads();
+    profiler_thread = std::thread( runProfilerThread );
+#else
+    static bool print = true;
+    if ( print ) {
+        std::cerr << "Profiler is not supported on this compiler/OS\n";
+        print = false;
+    }
+    (void) hz;
+    (void) backend;
+#endif
+}
+void StackTrace::Profiler::stop()
+{
+    std::unique_lock<std::mutex> lock( profiler_mutex );
+    if ( !profiler_running )
+        return;
+    profiler_running = false;
+    lock.unlock();
+    profiler_cv.notify_all();
+    profiler_thread.join();
+    lock.lock();
+    for ( auto &buffer : profiler_buffers ) {
+        if ( buffer->active )
+            stopSampling( *buffer );
+        buffer->active = false;
+    }
+    drainBuffers();
+#ifdef USE_LINUX
+    sigaction( SIGPROF, &profiler_old_action, nullptr );
+#endif
+}
+bool StackTrace::Profiler::running()
+{
+    std::lock_guard<std::mutex> lock( profiler_mutex );
+    return profiler_running;
+}
+StackTrace::Profiler::Backend StackTrace::Profiler::backend()
+{
+    std::lock_guard<std::mutex> lock( profiler_mutex );
+    for ( const auto &buffer : profiler_buffers ) {
+        if ( buffer->active && buffer->fd != -1 )
+            return Backend::perf;
+    }
+    return Backend::signal;
+}
+
+
+/****************************************************************************
+ *  Get/clear the results                                                    *
+ ****************************************************************************/
+void StackTrace::Profiler::clear()
+{
+    std::lock_guard<std::mutex> lock( profiler_mutex );
+    drainBuffers();
+    profiler_stacks.clear();
+    profiler_count = 0;
+    profiler_drop  = 0;
+}
+size_t StackTrace::Profiler::samples()
+{
+    std::lock_guard<std::mutex> lock( profiler_mutex );
+    drainBuffers();
+    return profiler_count;
+}
+size_t StackTrace::Profiler::dropped()
+{
+    std::lock_guard<std::mutex> lock( profiler_mutex );
+    drainBuffers();
+    return profiler_drop;
+}
+StackTrace::multi_stack_info StackTrace::Profiler::getProfile()
+{
+    // Copy the raw call stacks
+    std::vector<std::vector<void *>> trace;
+    std::vector<int> count;
+    profiler_mutex.lock();
+    drainBuffers();
+    trace.reserve( profiler_stacks.size() );
+    count.reserve( profiler_stacks.size() );
+    for ( const auto &[stack, N] : profiler_stacks ) {
+        trace.push_back( stack );
+        count.push_back( N );
+    }
+    profiler_mutex.unlock();
+    // Resolve the symbols and create the multi-stack
+    return generateMultiStack( trace, count );
+}
+void StackTrace::Profiler::writePprof( const std::string &filename )
+{
+    auto profile = getProfile();
+    profiler_mutex.lock();
+    int64_t period = 1000000000 / profiler_hz;
+    profiler_mutex.unlock();
+    std::ofstream fid( filename, std::ios::binary );
+    if ( !fid.is_open() )
+        throw std::logic_error( "Unable to open " + filename );
+    profile.printPprof( fid, period );
+}
@@ -0,0 +1,88 @@
+#ifndef included_StackTrace_Profiler
+#define included_StackTrace_Profiler
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "StackTrace/StackTrace.h"
+
+
+namespace StackTrace::Profiler {
+
+
+/*!
+ * @brief  Sampling backend
+ * @details  signal: each thread is interrupted by a cpu timer and the call stack is
+ *    captured in the signal handler using backtrace.
+ *    perf: the kernel collects the call stacks (perf_event_open) into a buffer without
+ *    interrupting the thread.  The kernel walks the frame pointers, so the stacks are
+ *    only complete for code compiled with -fno-omit-frame-pointer.  Threads where
+ *    perf_event_open is not permitted (see /proc/sys/kernel/perf_event_paranoid) use
+ *    the signal backend.
+ */
+enum class Backend : uint8_t { signal = 0, perf = 1 };
+
+
+/*!
+ * @brief  Start the sampling profiler
+ * @details  This function starts a low-overhead sampling profiler for the calling thread
+ *    and all registered threads (threads registered while the profiler is running
+ *    are added automatically).  Each thread is interrupted at the given frequency of
+ *    consumed cpu time and the raw call stack is written to a per-thread buffer.
+ *    A background thread aggregates the samples and the symbols are only resolved
+ *    when the profile is requested.  Samples from previous runs are kept until
+ *    clear() is called.
+ *    Note: This functionality is currently only availible on Linux
+ * @param[in] hz        Sampling frequency (samples per second of cpu time for each thread)
+ * @param[in] backend   Sampling backend to use
+ */
+void start( int hz = 100, Backend backend = Backend::signal );
+
+
+//! Stop the sampling profiler (the samples are kept)
+void stop();
+
+
+//! Check if the profiler is running
+bool running();
+
+
+//! Return the backend used (perf if any thread is sampled with perf_event_open)
+Backend backend();
+
+
+//! Clear the samples collected
+void clear();
+
+
+//! Return the number of samples collected
+size_t samples();
+
+
+//! Return the number of samples dropped (samples arriving while the buffer is full)
+size_t dropped();
+
+
+/*!
+ * @brief  Get the profile
+ * @details  This function returns the call stacks sampled by the profiler, where the
+ *    count for each entry is the number of samples containing the call stack.
+ *    The profiler may be running while this function is called.
+ * @return              Returns the sampled call stacks
+ */
+multi_stack_info getProfile();
+
+
+/*!
+ * @brief  Write the profile in the pprof format
+ * @details  This function writes the profile to a file in the (uncompressed) pprof
+ *    format including the cpu time for each call stack.
+ * @param[in] filename  Name of the file to write
+ */
+void writePprof( const std::string &filename );
+
+
+} // namespace StackTrace::Profiler
+
+#endif
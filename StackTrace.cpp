@@ -4,17 +4,20 @@
 #include "StackTrace/StaticVector.h"
 #include "StackTrace/Utilities.h"
 #include "StackTrace/Utilities.hpp"
+#include "StackTraceInternal.h"
 
 #include <algorithm>
 #include <atomic>
+#include <cctype>
 #include <cerrno>
 #include <csignal>
 #include <cstring>
 #include <iostream>
+#include <iterator>
+#include <limits>
 #include <map>
 #include <memory>
 #include <mutex>
-#include <random>
 #include <set>
 #include <sstream>
 #include <stdexcept>
@@ -78,6 +81,11 @@
     #define USE_ABI
     #include <cxxabi.h>
 #endif
+#if defined( USE_LINUX ) || defined( USE_MAC )
+    #define NO_INLINE __attribute__( ( noinline ) )
+#else
+    #define NO_INLINE
+#endif
 
 
 using namespace StackTrace::Utilities;
@@ -87,10 +95,6 @@ using namespace StackTrace::Utilities;
 static std::mutex StackTrace_mutex;
 
 
-// Helper thread
-static std::shared_ptr<std::thread> globalMonitorThread;
-
-
 // Function to replace all instances of a string with another
 static constexpr size_t replace( char *str, size_t N, size_t pos, size_t len,
                                  const std::string_view &r ) noexcept
@@ -154,6 +158,17 @@ static inline void *subtractAddress( void *a, void *b ) noexcept
 }
 
 
+// Maximum depth of an unpacked multi_stack_info (limits the recursion for invalid data)
+static constexpr int MAX_UNPACK_DEPTH = 4096;
+
+
+// Check that the buffer [ptr,end) contains at least the given number of bytes
+static inline bool checkBytes( const char *ptr, const char *end, size_t bytes ) noexcept
+{
+    return ptr && end && ptr <= end && static_cast<size_t>( end - ptr ) >= bytes;
+}
+
+
 /****************************************************************************
  *  Windows specific functions                                               *
  ****************************************************************************/
@@ -389,6 +404,173 @@ const char *StackTrace::stack_info::unpack( const char *ptr )
     memcpy( this, ptr, sizeof( *this ) );
     return ptr + sizeof( *this );
 }
+const char *StackTrace::stack_info::unpack( const char *ptr, const char *end )
+{
+    if ( !checkBytes( ptr, end, sizeof( *this ) ) )
+        return nullptr;
+    ptr = unpack( ptr );
+    // Make sure the strings are terminated
+    object.back()       = 0;
+    objectPath.back()   = 0;
+    filename.back()     = 0;
+    filenamePath.back() = 0;
+    function.back()     = 0;
+    return ptr;
+}
+
+
+/****************************************************************************
+ *  RankSet                                                                  *
+ ****************************************************************************/
+StackTrace::RankSet::RankSet( std::vector<int> ranks )
+{
+    std::sort( ranks.begin(), ranks.end() );
+    for ( int rank : ranks ) {
+        if ( !d_ranges.empty() && rank <= d_ranges.back().second + 1 )
+            d_ranges.back().second = std::max( d_ranges.back().second, rank );
+        else
+            d_ranges.emplace_back( rank, rank );
+    }
+}
+void StackTrace::RankSet::insert( int rank )
+{
+    if ( d_ranges.empty() || rank > d_ranges.back().second + 1 ) {
+        d_ranges.emplace_back( rank, rank ); // Fast path for ranks added in order
+    } else if ( rank == d_ranges.back().second + 1 ) {
+        d_ranges.back().second = rank;
+    } else if ( !contains( rank ) ) {
+        insert( RankSet( rank ) );
+    }
+}
+void StackTrace::RankSet::insert( int first, int last )
+{
+    if ( first > last )
+        return;
+    if ( d_ranges.empty() || first > d_ranges.back().second + 1 ) {
+        d_ranges.emplace_back( first, last );
+    } else {
+        RankSet set;
+        set.d_ranges.emplace_back( first, last );
+        insert( set );
+    }
+}
+void StackTrace::RankSet::insert( const RankSet &set )
+{
+    if ( set.empty() )
+        return;
+    // Merge the sorted ranges, combining ranges that overlap or are adjacent
+    std::vector<std::pair<int, int>> ranges;
+    ranges.reserve( d_ranges.size() + set.d_ranges.size() );
+    std::merge( d_ranges.begin(), d_ranges.end(), set.d_ranges.begin(), set.d_ranges.end(),
+                std::back_inserter( ranges ) );
+    d_ranges.clear();
+    for ( const auto &range : ranges ) {
+        if ( !d_ranges.empty() && range.first <= d_ranges.back().second + 1 )
+            d_ranges.back().second = std::max( d_ranges.back().second, range.second );
+        else
+            d_ranges.push_back( range );
+    }
+}
+void StackTrace::RankSet::erase( const RankSet &set )
+{
+    if ( set.empty() || empty() )
+        return;
+    std::vector<std::pair<int, int>> ranges;
+    auto it = set.d_ranges.begin();
+    for ( auto range : d_ranges ) {
+        // Skip the ranges that are before the current range
+        while ( it != set.d_ranges.end() && it->second < range.first )
+            ++it;
+        // Remove the overlapping ranges
+        for ( auto it2 = it; it2 != set.d_ranges.end() && it2->first <= range.second; ++it2 ) {
+            if ( it2->first > range.first )
+                ranges.emplace_back( range.first, it2->first - 1 );
+            range.first = std::max( range.first, it2->second + 1 );
+        }
+        if ( range.first <= range.second )
+            ranges.push_back( range );
+    }
+    d_ranges = std::move( ranges );
+}
+bool StackTrace::RankSet::contains( int rank ) const
+{
+    auto compare = []( int r, const std::pair<int, int> &range ) { return r < range.first; };
+    auto it      = std::upper_bound( d_ranges.begin(), d_ranges.end(), rank, compare );
+    return it != d_ranges.begin() && rank <= ( --it )->second;
+}
+size_t StackTrace::RankSet::count() const
+{
+    size_t N = 0;
+    for ( const auto &range : d_ranges )
+        N += range.second - range.first + 1;
+    return N;
+}
+std::vector<int> StackTrace::RankSet::ranks() const
+{
+    std::vector<int> ranks;
+    ranks.reserve( count() );
+    for ( const auto &range : d_ranges ) {
+        for ( int rank = range.first; rank <= range.second; rank++ )
+            ranks.push_back( rank );
+    }
+    return ranks;
+}
+std::string StackTrace::RankSet::print() const
+{
+    std::string str = "[";
+    for ( size_t i = 0; i < d_ranges.size(); i++ ) {
+        if ( i > 0 )
+            str += ',';
+        str += std::to_string( d_ranges[i].first );
+        if ( d_ranges[i].second != d_ranges[i].first )
+            str += '-' + std::to_string( d_ranges[i].second );
+    }
+    str += ']';
+    return str;
+}
+size_t StackTrace::RankSet::size() const { return ( 1 + 2 * d_ranges.size() ) * sizeof( int ); }
+char *StackTrace::RankSet::pack( char *ptr ) const
+{
+    std::vector<int> data( 1 + 2 * d_ranges.size() );
+    data[0] = d_ranges.size();
+    for ( size_t i = 0; i < d_ranges.size(); i++ ) {
+        data[2 * i + 1] = d_ranges[i].first;
+        data[2 * i + 2] = d_ranges[i].second;
+    }
+    memcpy( ptr, data.data(), data.size() * sizeof( int ) );
+    return ptr + data.size() * sizeof( int );
+}
+const char *StackTrace::RankSet::unpack( const char *ptr )
+{
+    int N;
+    memcpy( &N, ptr, sizeof( int ) );
+    ptr += sizeof( int );
+    std::vector<int> data( 2 * N );
+    memcpy( data.data(), ptr, data.size() * sizeof( int ) );
+    d_ranges.resize( N );
+    for ( int i = 0; i < N; i++ )
+        d_ranges[i] = std::make_pair( data[2 * i], data[2 * i + 1] );
+    return ptr + data.size() * sizeof( int );
+}
+const char *StackTrace::RankSet::unpack( const char *ptr, const char *end )
+{
+    int N = 0;
+    if ( !checkBytes( ptr, end, sizeof( int ) ) )
+        return nullptr;
+    memcpy( &N, ptr, sizeof( int ) );
+    if ( N < 0 || !checkBytes( ptr + sizeof( int ), end, 2 * sizeof( int ) * N ) )
+        return nullptr;
+    ptr = unpack( ptr );
+    // The ranges must be sorted and must not overlap
+    for ( size_t i = 0; i < d_ranges.size(); i++ ) {
+        int64_t last = i == 0 ? std::numeric_limits<int64_t>::min() : d_ranges[i - 1].second;
+        if ( d_ranges[i].first > d_ranges[i].second || d_ranges[i].first <= last + 1 ) {
+            d_ranges.clear();
+            return nullptr;
+        }
+    }
+    return ptr;
+}
 
 
 /****************************************************************************
@@ -415,6 +597,7 @@ void StackTrace::multi_stack_info::clear()
     N = 0;
     stack.clear();
     children.clear();
+    ranks.clear();
 }
 template<class FUN>
 void StackTrace::multi_stack_info::print2( int Np, char *prefix, int w[3], bool c, FUN &fun ) const
@@ -423,6 +606,11 @@ void StackTrace::multi_stack_info::print2( int Np, char *prefix, int w[3], bool
         prefix[Np] = 0;
         char line[4096];
         int N2 = sprintf( line, "%s[%i] ", prefix, N );
+        if ( !ranks.empty() ) {
+            auto str = ranks.print();
+            str.resize( std::min<size_t>( str.size(), 1024 ) );
+            N2 += sprintf( &line[N2], "%s ", str.data() );
+        }
         stack.print2( &line[N2], w[0], w[1], w[2] );
         fun( line );
         prefix[Np++] = c ? '|' : ' ';
@@ -487,28 +675,32 @@ int StackTrace::multi_stack_info::getFunctionWidth() const
         w = std::max( w, child.getFunctionWidth() );
     return w;
 }
-void StackTrace::multi_stack_info::add( size_t len, const stack_info *stack )
+void StackTrace::multi_stack_info::add( size_t len, const stack_info *stack, int count,
+                                        const RankSet &ranks )
 {
     if ( len == 0 )
         return;
     const auto &s = stack[len - 1];
     for ( auto &i : children ) {
         if ( i.stack == s ) {
-            i.N++;
+            i.N += count;
+            i.ranks.insert( ranks );
             if ( len > 1 )
-                i.add( len - 1, stack );
+                i.add( len - 1, stack, count, ranks );
             return;
         }
     }
     children.resize( children.size() + 1 );
-    children.back().N     = 1;
+    children.back().N     = count;
     children.back().stack = s;
+    children.back().ranks = ranks;
     if ( len > 1 )
-        children.back().add( len - 1, stack );
+        children.back().add( len - 1, stack, count, ranks );
 }
 void StackTrace::multi_stack_info::add( const multi_stack_info &rhs )
 {
     N += rhs.N;
+    ranks.insert( rhs.ranks );
     for ( const auto &x : rhs.children ) {
         bool found = false;
         for ( auto &tmp : children ) {
@@ -521,9 +713,15 @@ void StackTrace::multi_stack_info::add( const multi_stack_info &rhs )
             children.push_back( x );
     }
 }
+void StackTrace::multi_stack_info::setRanks( const RankSet &rhs )
+{
+    ranks = rhs;
+    for ( auto &child : children )
+        child.setRanks( rhs );
+}
 size_t StackTrace::multi_stack_info::size() const
 {
-    size_t bytes = 2 * sizeof( int ) + stack.size();
+    size_t bytes = 2 * sizeof( int ) + stack.size() + ranks.size();
     for ( const auto &tmp : children )
         bytes += tmp.size();
     return bytes;
@@ -534,6 +732,7 @@ char *StackTrace::multi_stack_info::pack( char *ptr ) const
     memcpy( ptr, &N2, sizeof( int ) );
     ptr += sizeof( int );
     ptr    = stack.pack( ptr );
+    ptr    = ranks.pack( ptr );
     int Nc = children.size();
     memcpy( ptr, &Nc, sizeof( int ) );
     ptr += sizeof( int );
@@ -548,6 +747,7 @@ const char *StackTrace::multi_stack_info::unpack( const char *ptr )
     ptr += sizeof( int );
     N   = N2;
     ptr = stack.unpack( ptr );
+    ptr = ranks.unpack( ptr );
     memcpy( &Nc, ptr, sizeof( int ) );
     ptr += sizeof( int );
     children.resize( Nc );
@@ -555,6 +755,39 @@ const char *StackTrace::multi_stack_info::unpack( const char *ptr )
         ptr = tmp.unpack( ptr );
     return ptr;
 }
+static const char *unpackMultiStack( StackTrace::multi_stack_info &stack, const char *ptr,
+                                     const char *end, int depth )
+{
+    int N = 0, Nc = 0;
+    if ( depth > MAX_UNPACK_DEPTH || !checkBytes( ptr, end, sizeof( int ) ) )
+        return nullptr;
+    memcpy( &N, ptr, sizeof( int ) );
+    stack.N = N;
+    ptr     = stack.stack.unpack( ptr + sizeof( int ), end );
+    ptr     = ptr ? stack.ranks.unpack( ptr, end ) : nullptr;
+    if ( !checkBytes( ptr, end, sizeof( int ) ) )
+        return nullptr;
+    memcpy( &Nc, ptr, sizeof( int ) );
+    ptr += sizeof( int );
+    // Each child needs at least its counts and stack
+    constexpr size_t minBytes = 3 * sizeof( int ) + sizeof( StackTrace::stack_info );
+    if ( Nc < 0 || static_cast<size_t>( Nc ) > static_cast<size_t>( end - ptr ) / minBytes )
+        return nullptr;
+    stack.children.resize( Nc );
+    for ( auto &child : stack.children ) {
+        ptr = unpackMultiStack( child, ptr, end, depth + 1 );
+        if ( !ptr )
+            return nullptr;
+    }
+    return ptr;
+}
+const char *StackTrace::multi_stack_info::unpack( const char *ptr, const char *end )
+{
+    ptr = unpackMultiStack( *this, ptr, end, 0 );
+    if ( !ptr )
+        clear();
+    return ptr;
+}
 
 
 /****************************************************************************
@@ -1126,33 +1359,44 @@ static int backtrace_thread( const std::thread::native_handle_type &tid, void **
 #endif
     return count;
 }
-std::vector<void *> StackTrace::backtrace( std::thread::native_handle_type tid )
+StackTrace::RawStack<> StackTrace::backtrace( std::thread::native_handle_type tid )
 {
-    std::vector<void *> trace( 1000, nullptr );
-    size_t count = backtrace_thread( tid, trace.data(), trace.size() );
-    trace.resize( count );
+    RawStack<> trace;
+    trace.resize( backtrace_thread( tid, trace.data(), trace.capacity() ) );
     return trace;
 }
-std::vector<void *> StackTrace::backtrace()
+StackTrace::RawStack<> StackTrace::backtrace()
 {
-    std::vector<void *> trace( 1000, nullptr );
-    size_t count = backtrace_thread( thisThread(), trace.data(), trace.size() );
-    trace.resize( count );
+    RawStack<> trace;
+    trace.resize( backtrace_thread( thisThread(), trace.data(), trace.capacity() ) );
     return trace;
 }
-std::vector<std::vector<void *>> StackTrace::backtraceAll()
+std::vector<StackTrace::RawStack<>> StackTrace::backtraceAll()
 {
     // Get the list of threads
     auto threads = registeredThreads();
     // Get the backtrace of each thread
-    std::vector<std::vector<void *>> trace( threads.size() );
-    for ( size_t i = 0; i < threads.size(); i++ ) {
-        trace[i].resize( 1000 );
-        size_t count = backtrace_thread( threads[i], trace[i].data(), trace[i].size() );
-        trace[i].resize( count );
-    }
+    std::vector<RawStack<>> trace( threads.size() );
+    for ( size_t i = 0; i < threads.size(); i++ )
+        trace[i].resize( backtrace_thread( threads[i], trace[i].data(), trace[i].capacity() ) );
     return trace;
 }
+NO_INLINE int StackTrace::backtrace( void **buffer, int size, int skip )
+{
+    // Get the call stack, skipping this function
+    constexpr int MAX_DEPTH = 1024;
+    void *trace[MAX_DEPTH];
+    skip      = std::max( skip, 0 ) + 1;
+    int depth = std::min( size + skip, MAX_DEPTH );
+#if defined( USE_LINUX ) || defined( USE_MAC )
+    int count = ::backtrace( trace, depth );
+#else
+    int count = backtrace_thread( thisThread(), trace, depth );
+#endif
+    count = std::max( std::min( count - skip, size ), 0 );
+    memcpy( buffer, &trace[skip], count * sizeof( void * ) );
+    return count;
+}
 
 
 /****************************************************************************
@@ -1177,23 +1421,14 @@ std::vector<StackTrace::stack_info> StackTrace::getCallStack( std::thread::nativ
 static std::vector<std::vector<StackTrace::stack_info>>
 generateStacks( const std::vector<std::vector<void *>> &trace )
 {
-    // Function to find an address
-    auto find = []( const auto &data, auto x ) {
-        for ( size_t i = 0; i < data.size(); i++ ) {
-            if ( data[i] == x )
-                return static_cast<int>( i );
-        }
-        return -1;
-    };
-    // Get the stack data for all pointers
+    // Get the unique addresses
     std::vector<void *> addresses;
     addresses.reserve( 1024 );
-    for ( const auto &tmp : trace ) {
-        for ( auto ptr : tmp ) {
-            if ( find( addresses, ptr ) == -1 )
-                addresses.push_back( ptr );
-        }
-    }
+    for ( const auto &tmp : trace )
+        addresses.insert( addresses.end(), tmp.begin(), tmp.end() );
+    std::sort( addresses.begin(), addresses.end() );
+    addresses.erase( std::unique( addresses.begin(), addresses.end() ), addresses.end() );
+    // Get the stack data for all pointers
     auto stack_data = StackTrace::getStackInfo( addresses );
     // Create the stack traces
     std::vector<std::vector<StackTrace::stack_info>> stack( trace.size() );
@@ -1201,26 +1436,31 @@ generateStacks( const std::vector<std::vector<void *>> &trace )
         // Create the stack for the given thread trace
         stack[i].resize( trace[i].size() );
         for ( size_t j = 0; j < trace[i].size(); j++ ) {
-            int k       = find( addresses, trace[i][j] );
-            stack[i][j] = stack_data[k];
+            auto it     = std::lower_bound( addresses.begin(), addresses.end(), trace[i][j] );
+            stack[i][j] = stack_data[std::distance( addresses.begin(), it )];
         }
     }
     return stack;
 }
-static StackTrace::multi_stack_info
-generateMultiStack( const std::vector<std::vector<void *>> &trace )
+StackTrace::multi_stack_info
+StackTrace::generateMultiStack( const std::vector<std::vector<void *>> &trace,
+                                const std::vector<int> &count )
 {
+    if ( !count.empty() && count.size() != trace.size() )
+        throw std::logic_error( "generateMultiStack: count does not match the number of stacks" );
     // Get the stack data for all pointers
     auto stack = generateStacks( trace );
     // Create the multi-stack trace
     StackTrace::multi_stack_info multistack;
-    multistack.N = stack.size();
-    for ( const auto &tmp : stack )
-        multistack.add( tmp.size(), tmp.data() );
+    for ( size_t i = 0; i < stack.size(); i++ ) {
+        int N = count.empty() ? 1 : count[i];
+        multistack.N += N;
+        multistack.add( stack[i].size(), stack[i].data(), N );
+    }
     return multistack;
 }
 static StackTrace::multi_stack_info
-generateMultiStack( const std::vector<std::thread::native_handle_type> &threads )
+generateThreadMultiStack( const std::vector<std::thread::native_handle_type> &threads )
 {
     // Get the stack data for all pointers
     std::vector<std::vector<void *>> trace( threads.size() );
@@ -1228,14 +1468,14 @@ generateMultiStack( const std::vector<std::thread::native_handle_type> &threads
     for ( size_t i = 0; i < threads.size(); i++, ++it )
         trace[i] = StackTrace::backtrace( *it );
     // Create the multi-stack trace
-    return generateMultiStack( trace );
+    return StackTrace::generateMultiStack( trace );
 }
 StackTrace::multi_stack_info StackTrace::getAllCallStacks()
 {
     // Get the list of active thread
     auto threads = registeredThreads();
     // Create the multi-stack structure
-    auto stack = generateMultiStack( threads );
+    auto stack = generateThreadMultiStack( threads );
     return stack;
 }
 
@@ -1573,11 +1813,12 @@ StackTrace::abort_error rethrow()
     }
     if ( error.type == StackTrace::terminateType::unknown )
         error.type = StackTrace::terminateType::exception;
-    if ( error.bytes == 0 )
+    auto capture = StackTrace::getDefaultCaptureType();
+    if ( error.bytes == 0 && capture == StackTrace::captureType::full )
         error.bytes = StackTrace::Utilities::getMemoryUsage();
-    if ( error.stack.empty() ) {
+    if ( error.stack.empty() && capture != StackTrace::captureType::none ) {
         error.stackType = StackTrace::printStackType::local;
-        error.stack     = StackTrace::backtrace();
+        error.stack.capture();
     }
     return error;
 }
@@ -1700,173 +1941,6 @@ void StackTrace::clearMPIErrorHandler( MPI_Comm comm )
 #endif
 
 
-/****************************************************************************
- *  Global call stack functionality                                          *
- ****************************************************************************/
-#ifdef STACKTRACE_USE_MPI
-static MPI_Comm globalCommForGlobalCommStack  = MPI_COMM_NULL;
-static volatile int globalMonitorThreadStatus = -1;
-static void runGlobalMonitorThread()
-{
-    int rank = 0;
-    int size = 1;
-    MPI_Comm_size( globalCommForGlobalCommStack, &size );
-    MPI_Comm_rank( globalCommForGlobalCommStack, &rank );
-    while ( globalMonitorThreadStatus == 1 ) {
-        // Check for any messages
-        int flag = 0;
-        MPI_Status status;
-        int err = MPI_Iprobe( MPI_ANY_SOURCE, 1, globalCommForGlobalCommStack, &flag, &status );
-        if ( err != MPI_SUCCESS ) {
-            printf( "Internal error in StackTrace::getGlobalCallStacks::runGlobalMonitorThread\n" );
-            break;
-        } else if ( flag != 0 ) {
-            // We received a request
-            int src_rank = status.MPI_SOURCE;
-            int tag;
-            MPI_Recv( &tag, 1, MPI_INT, src_rank, 1, globalCommForGlobalCommStack, &status );
-            // Get the list of threads (except this)
-            auto threads = StackTrace::registeredThreads();
-            if ( threads.empty() )
-                continue;
-            // Get the stack info for the threads
-            auto multistack = generateMultiStack( threads );
-            // Pack and send the data
-            size_t bytes = multistack.size();
-            char *data   = new char[bytes];
-            multistack.pack( data );
-            MPI_Send( data, bytes, MPI_CHAR, src_rank, tag, globalCommForGlobalCommStack );
-            delete[] data;
-        } else {
-            // No requests recieved
-            std::this_thread::sleep_for( std::chrono::milliseconds( 50 ) );
-        }
-    }
-}
-void StackTrace::globalCallStackInitialize( MPI_Comm comm )
-{
-    globalMonitorThreadStatus = 3;
-    // Check that we have the necessary MPI thread support
-    if ( !MPI_Initialized() ) {
-        printf( "Warning: MPI not initialized before calling globalCallStackInitialize\n" );
-        return;
-    }
-    int rank = 0;
-    MPI_Comm_rank( comm, &rank );
-    int provided;
-    MPI_Query_thread( &provided );
-    if ( provided != MPI_THREAD_MULTIPLE ) {
-        if ( rank == 0 )
-            printf( "Warning: getGlobalCallStacks requires support for MPI_THREAD_MULTIPLE\n" );
-        return;
-    }
-    // Check that we have support to get call stacks from threads
-    int N_threads = 0;
-    if ( rank == 0 ) {
-        std::thread thread( StackTrace::Utilities::sleep_ms, 200 );
-        std::this_thread::yield();
-        auto thread_ids = registeredThreads();
-        N_threads       = thread_ids.size();
-        thread.join();
-    }
-    MPI_Bcast( &N_threads, 1, MPI_INT, 0, comm );
-    if ( N_threads == 1 ) {
-        if ( rank == 0 )
-            printf( "Warning: getAllCallStacks not supported on this OS\n" );
-        return;
-    }
-    // Create the communicator and initialize the helper thread
-    globalMonitorThreadStatus = 1;
-    MPI_Comm_dup( comm, &globalCommForGlobalCommStack );
-    globalMonitorThread.reset( new std::thread( runGlobalMonitorThread ) );
-    std::this_thread::sleep_for( std::chrono::milliseconds( 50 ) );
-}
-void StackTrace::globalCallStackFinalize()
-{
-    if ( globalMonitorThread ) {
-        globalMonitorThreadStatus = 2;
-        globalMonitorThread->join();
-        globalMonitorThread.reset();
-    }
-    if ( globalCommForGlobalCommStack != MPI_COMM_NULL )
-        MPI_Comm_free( &globalCommForGlobalCommStack );
-    globalCommForGlobalCommStack = MPI_COMM_NULL;
-}
-StackTrace::multi_stack_info getRemoteCallStacks()
-{
-    if ( globalMonitorThreadStatus == -1 ) {
-        // User did not call globalCallStackInitialize
-        printf( "Warning: getGlobalCallStacks called without call to globalCallStackInitialize\n" );
-        return StackTrace::multi_stack_info();
-    } else if ( globalMonitorThreadStatus != 1 ) {
-        // globalCallStackInitialize is not supported
-        return StackTrace::multi_stack_info();
-    }
-    // Signal all processes that we want their stack for all threads
-    int rank = 0;
-    int size = 1;
-    MPI_Comm_size( globalCommForGlobalCommStack, &size );
-    MPI_Comm_rank( globalCommForGlobalCommStack, &rank );
-    std::random_device rd;
-    std::mt19937 gen( rd() );
-    std::uniform_int_distribution<> dis( 2, 0x7FFF );
-    int tag = dis( gen );
-    std::vector<MPI_Request> sendRequest( size );
-    for ( int i = 0; i < size; i++ ) {
-        if ( i == rank )
-            continue;
-        MPI_Isend( &tag, 1, MPI_INT, i, 1, globalCommForGlobalCommStack, &sendRequest[i] );
-    }
-    // Recieve the backtrace for all remote processes/threads
-    int N_finished        = 1;
-    auto start            = std::chrono::steady_clock::now();
-    double time           = 0;
-    const double max_time = 10.0 + size * 20e-3;
-    StackTrace::multi_stack_info multistack;
-    while ( N_finished < size && time < max_time ) {
-        int flag = 0;
-        MPI_Status status;
-        int err = MPI_Iprobe( MPI_ANY_SOURCE, tag, globalCommForGlobalCommStack, &flag, &status );
-        if ( err != MPI_SUCCESS ) {
-            printf( "Internal error in StackTrace::getGlobalCallStacks\n" );
-            break;
-        } else if ( flag != 0 ) {
-            // We recieved a response
-            int src_rank = status.MPI_SOURCE;
-            int count;
-            MPI_Get_count( &status, MPI_CHAR, &count );
-            char *data = new char[count];
-            MPI_Recv( data, count, MPI_CHAR, src_rank, tag, globalCommForGlobalCommStack, &status );
-            StackTrace::multi_stack_info tmp;
-            tmp.unpack( data );
-            delete[] data;
-            multistack.add( tmp );
-            N_finished++;
-        } else {
-            auto stop = std::chrono::steady_clock::now();
-            time      = std::chrono::duration_cast<std::chrono::seconds>( stop - start ).count();
-            std::this_thread::yield();
-        }
-    }
-    for ( int i = 0; i < size; i++ ) {
-        if ( i == rank )
-            continue;
-        MPI_Request_free( &sendRequest[i] );
-    }
-    return multistack;
-}
-#else
-StackTrace::multi_stack_info getRemoteCallStacks() { return StackTrace::multi_stack_info(); }
-#endif
-StackTrace::multi_stack_info StackTrace::getGlobalCallStacks()
-{
-    auto threads    = registeredThreads();
-    auto multistack = generateMultiStack( threads );
-    multistack.add( getRemoteCallStacks() );
-    return multistack;
-}
-
-
 /****************************************************************************
  *  Cleanup the call stack                                                   *
  ****************************************************************************/
@@ -2113,7 +2187,7 @@ void StackTrace::cleanupStackTrace( multi_stack_info &stack )
         std::string_view function( it->stack.function.data() );
         std::string_view filename( it->stack.filename.data() );
         // Remove callstack (and all children) for threads that are just contributing
-        if ( filename == "StackTrace.cpp" ) {
+        if ( filename == "StackTrace.cpp" || filename == "StackTraceGlobal.cpp" ) {
             bool test = function.find( "_callstack_signal_handler" ) != npos ||
                         function.find( "getGlobalCallStacks" ) != npos ||
                         function.find( "backtrace" ) != npos || function.find( "(" ) == npos;
@@ -2135,7 +2209,8 @@ void StackTrace::cleanupStackTrace( multi_stack_info &stack )
                 it = stack.children.erase( it );
                 continue;
             } else if ( it->children.size() == 1 ) {
-                *it = it->children[0];
+                auto child = std::move( it->children[0] );
+                *it        = std::move( child );
                 continue;
             }
         }
@@ -2147,6 +2222,7 @@ void StackTrace::cleanupStackTrace( multi_stack_info &stack )
             if ( it->stack == it2->stack ) {
                 remove = true;
                 it2->N += it->N;
+                it2->ranks.insert( it->ranks );
                 for ( auto &tmp : it->children )
                     it2->children.push_back( tmp );
                 cleanupStackTrace( *it2 );
@@ -2161,6 +2237,104 @@ void StackTrace::cleanupStackTrace( multi_stack_info &stack )
 }
 
 
+/****************************************************************************
+ *  Find the ranks that differ from the majority                             *
+ ****************************************************************************/
+static void findStragglers( const StackTrace::multi_stack_info &node, int depth,
+                            std::vector<StackTrace::straggler_info> &list )
+{
+    if ( node.children.empty() || node.ranks.empty() )
+        return;
+    // Find the branch with the most ranks
+    const StackTrace::multi_stack_info *majority = &node.children[0];
+    for ( const auto &child : node.children ) {
+        if ( child.ranks.count() > majority->ranks.count() )
+            majority = &child;
+    }
+    size_t N = node.ranks.count();
+    int N0   = majority->ranks.count();
+    // Check the other branches for ranks that are not in the majority (a rank may be in
+    // multiple branches if it has multiple threads)
+    StackTrace::RankSet active;
+    for ( const auto &child : node.children ) {
+        active.insert( child.ranks );
+        if ( &child == majority )
+            continue;
+        auto ranks = child.ranks;
+        ranks.erase( majority->ranks );
+        if ( !ranks.empty() && 2 * ranks.count() < N )
+            list.push_back( { ranks, N0, depth, child.stack, majority->stack, node.stack } );
+        else
+            findStragglers( child, depth + 1, list );
+    }
+    // Check for ranks that stop at this frame
+    auto ranks = node.ranks;
+    ranks.erase( active );
+    if ( !ranks.empty() && 2 * ranks.count() < N ) {
+        StackTrace::stack_info empty;
+        list.push_back( { ranks, N0, depth, empty, majority->stack, node.stack } );
+    }
+    findStragglers( *majority, depth + 1, list );
+}
+std::vector<StackTrace::straggler_info> StackTrace::findStragglers( const multi_stack_info &stack )
+{
+    std::vector<straggler_info> list;
+    ::findStragglers( stack, 0, list );
+    auto compare = []( const straggler_info &a, const straggler_info &b ) {
+        if ( a.depth != b.depth )
+            return a.depth > b.depth;
+        return a.ranks.count() < b.ranks.count();
+    };
+    std::stable_sort( list.begin(), list.end(), compare );
+    return list;
+}
+static std::string printFrame( const StackTrace::stack_info &frame, bool address = false )
+{
+    char tmp[1024];
+    if ( frame.function[0] != 0 && !address )
+        snprintf( tmp, sizeof( tmp ), "%s", frame.function.data() );
+    else if ( frame.function[0] != 0 )
+        snprintf( tmp, sizeof( tmp ), "%s at %p", frame.function.data(), frame.address );
+    else
+        snprintf( tmp, sizeof( tmp ), "%s %p", frame.object.data(), frame.address );
+    std::string str( tmp );
+    if ( frame.filename[0] != 0 ) {
+        snprintf( tmp, sizeof( tmp ), " (%s:%i)", frame.filename.data(), frame.line );
+        str += tmp;
+    }
+    return str;
+}
+std::string StackTrace::printStragglers( const multi_stack_info &stack, const RankSet &missing )
+{
+    constexpr size_t maxPrint = 10;
+    auto list                 = findStragglers( stack );
+    if ( list.empty() && missing.empty() )
+        return {};
+    std::string msg = "Suspect ranks:\n";
+    if ( !missing.empty() )
+        msg += "   " + missing.print() + " did not respond\n";
+    for ( size_t i = 0; i < std::min( list.size(), maxPrint ); i++ ) {
+        // Print the addresses if the frames are in the same function (different call sites)
+        const auto &data = list[i];
+        bool address     = data.frame.function == data.majorityFrame.function &&
+                       data.frame.line == data.majorityFrame.line;
+        msg += "   " + data.ranks.print();
+        if ( data.frame.address != 0 || data.frame.function[0] != 0 )
+            msg += " in " + printFrame( data.frame, address );
+        else
+            msg += " stopped";
+        msg += " while " + std::to_string( data.majority ) + " ranks are in ";
+        msg += printFrame( data.majorityFrame, address );
+        if ( data.caller.address != 0 || data.caller.function[0] != 0 )
+            msg += ", called from " + printFrame( data.caller );
+        msg += '\n';
+    }
+    if ( list.size() > maxPrint )
+        msg += "   ... (" + std::to_string( list.size() - maxPrint ) + " more)\n";
+    return msg;
+}
+
+
 /****************************************************************************
  *  Generate stack from string                                               *
  ****************************************************************************/
@@ -2222,6 +2396,22 @@ static StackTrace::stack_info parseLine( const char *str )
         stack.line = atoi( p6 + 1 );
     return stack;
 }
+static StackTrace::RankSet parseRanks( const std::string &str )
+{
+    // Parse the range compressed list of ranks ("0-1023,1025")
+    StackTrace::RankSet ranks;
+    const char *p = str.data();
+    while ( isdigit( *p ) ) {
+        char *end = nullptr;
+        int first = strtol( p, &end, 10 );
+        int last  = first;
+        if ( *end == '-' )
+            last = strtol( end + 1, &end, 10 );
+        ranks.insert( first, last );
+        p = *end == ',' ? end + 1 : end;
+    }
+    return ranks;
+}
 StackTrace::multi_stack_info StackTrace::generateFromString( const std::string &str )
 {
     // Break the string according to line breaks
@@ -2252,6 +2442,10 @@ StackTrace::multi_stack_info StackTrace::generateFromString( const std::vector<s
         tmp.N = 1;
         if ( p1 < p2 && p1 < p3 )
             tmp.N = std::stoi( str.substr( p1 + 1, p2 - p1 - 1 ) );
+        auto p4 = str.find( '[', p2 );
+        auto p5 = str.find( ']', p4 );
+        if ( p1 < p2 && p4 < p3 && p5 < p3 )
+            tmp.ranks = parseRanks( str.substr( p4 + 1, p5 - p4 - 1 ) );
         tmp.stack = parseLine( &str[p3 - 1] );
         indent.push_back( std::min( p1, p3 - 1 ) );
         stack.push_back( tmp );
@@ -2281,42 +2475,60 @@ StackTrace::abort_error::abort_error()
     : type( terminateType::unknown ), stackType( printStackType::local ), signal( 0 ), bytes( 0 )
 {
 }
+StackTrace::abort_error::message_cache &
+StackTrace::abort_error::message_cache::operator=( const message_cache & )
+{
+    std::lock_guard<std::mutex> lock( mutex );
+    valid = false;
+    msg.clear();
+    return *this;
+}
 const char *StackTrace::abort_error::what() const noexcept
 {
-    d_msg.clear();
+    // Build the message once (resolving the call stack is expensive)
+    std::lock_guard<std::mutex> lock( d_msg.mutex );
+    if ( !d_msg.valid ) {
+        d_msg.msg   = buildMessage();
+        d_msg.valid = true;
+    }
+    return d_msg.msg.c_str();
+}
+std::string StackTrace::abort_error::buildMessage() const
+{
+    std::string msg;
     if ( type == terminateType::abort ) {
-        d_msg += "Program abort called";
+        msg += "Program abort called";
     } else if ( type == terminateType::signal ) {
-        d_msg += "Unhandled signal (" + std::to_string( signal ) + ") caught";
+        msg += "Unhandled signal (" + std::to_string( signal ) + ") caught";
     } else if ( type == terminateType::exception ) {
-        d_msg += "Unhandled exception caught";
+        msg += "Unhandled exception caught";
     } else if ( type == terminateType::MPI ) {
-        d_msg += "Error calling MPI routine";
+        msg += "Error calling MPI routine";
     } else {
-        d_msg += "Unknown error called";
+        msg += "Unknown error called";
     }
     std::string_view filename( source.file_name() );
     if ( !filename.empty() ) {
-        d_msg += " in file '" + std::string( filename ) + "'";
+        msg += " in file '" + std::string( filename ) + "'";
         if ( source.line() > 0 ) {
-            d_msg += " at line " + std::to_string( source.line() );
+            msg += " at line " + std::to_string( source.line() );
         }
     }
-    d_msg += ":\n";
-    d_msg += "   " + message + "\n";
+    msg += ":\n";
+    msg += "   " + message + "\n";
     if ( bytes > 0 ) {
-        d_msg += "Bytes used = " + std::to_string( bytes ) + "\n";
+        msg += "Bytes used = " + std::to_string( bytes ) + "\n";
     }
     if ( !stack.empty() && stackType != printStackType::none ) {
-        d_msg += "Stack Trace:\n";
+        msg += "Stack Trace:\n";
         if ( stackType == printStackType::local ) {
             for ( const auto &item : getStackInfo( stack ) ) {
                 if ( !keep( item ) )
                     continue;
                 char txt[1000];
                 item.print2( txt );
-                d_msg += " \n";
-                d_msg += txt;
+                msg += " \n";
+                msg += txt;
             }
         } else if ( stackType == printStackType::threaded || stackType == printStackType::global ) {
             // Get the call stack
@@ -2328,22 +2540,26 @@ const char *StackTrace::abort_error::what() const noexcept
             for ( auto tid : threads )
                 trace.push_back( backtrace( tid ) );
             // Generate call stack
-            auto multistack = generateMultiStack( trace );
+            auto multistack = StackTrace::generateMultiStack( trace );
             // Add remote call stack info
-            if ( stackType == printStackType::global )
-                multistack.add( getRemoteCallStacks() );
+            if ( stackType == printStackType::global ) {
+                StackTrace::detail::setLocalRanks( multistack );
+                multistack.add( StackTrace::detail::getRemoteCallStacks() );
+            }
             // Cleanup call stack
             cleanupStackTrace( multistack );
-            // Print the results
-            d_msg += multistack.printString( " " );
+            // Print the results (with the ranks that differ from the others first)
+            if ( stackType == printStackType::global )
+                msg += printStragglers( multistack );
+            msg += multistack.printString( " " );
         } else {
-            d_msg += "Unknown value for stackType\n";
+            msg += "Unknown value for stackType\n";
         }
     }
-    for ( size_t i = 0; i < d_msg.size(); i++ )
-        if ( d_msg[i] == 0 )
-            d_msg.erase( i, 1 );
-    return d_msg.c_str();
+    for ( size_t i = 0; i < msg.size(); i++ )
+        if ( msg[i] == 0 )
+            msg.erase( i, 1 );
+    return msg;
 }
 
 
@@ -2353,3 +2569,11 @@ const char *StackTrace::abort_error::what() const noexcept
 static StackTrace::printStackType abort_stackType = StackTrace::printStackType::global;
 void StackTrace::setDefaultStackType( StackTrace::printStackType type ) { abort_stackType = type; }
 StackTrace::printStackType StackTrace::getDefaultStackType() { return abort_stackType; }
+
+
+/****************************************************************************
+ * Get/Set default capture type                                              *
+ ****************************************************************************/
+static StackTrace::captureType abort_captureType = StackTrace::captureType::full;
+void StackTrace::setDefaultCaptureType( StackTrace::captureType type ) { abort_captureType = type; }
+StackTrace::captureType StackTrace::getDefaultCaptureType() { return abort_captureType; }
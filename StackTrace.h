@@ -4,8 +4,12 @@
 #include <array>
 #include <functional>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <set>
+#include <string>
 #include <thread>
+#include <type_traits>
 #include <vector>
 
 #include "StackTrace/source_location.h"
@@ -47,6 +51,63 @@ struct stack_info {
     char *pack( char *ptr ) const;
     //! Unpack the data from a byte array, returning a pointer to the end of the data
     const char *unpack( const char *ptr );
+    //! Unpack the data from the byte array [ptr,end), returning nullptr if it is invalid
+    const char *unpack( const char *ptr, const char *end );
+};
+
+
+/*!
+ * @brief  Set of ranks
+ * @details  This class stores a set of ranks (processes) as a sorted list of ranges so
+ *    the memory is proportional to the number of contiguous runs rather than the number
+ *    of ranks.  The set is printed as a range compressed list, e.g. "[0-1023,1025-4095]".
+ */
+class RankSet final
+{
+public:
+    //! Empty constructor
+    RankSet() = default;
+    //! Construct a set containing a single rank
+    explicit RankSet( int rank ) : d_ranges( 1, { rank, rank } ) {}
+    //! Construct a set from a list of ranks (does not need to be sorted)
+    explicit RankSet( std::vector<int> ranks );
+    //! Add a rank to the set
+    void insert( int rank );
+    //! Add the ranks [first,last] to the set
+    void insert( int first, int last );
+    //! Add the ranks from another set
+    void insert( const RankSet &set );
+    //! Remove the ranks in another set
+    void erase( const RankSet &set );
+    //! Check if the set contains the given rank
+    bool contains( int rank ) const;
+    //! Return the number of ranks in the set
+    size_t count() const;
+    //! Check if the set is empty
+    bool empty() const { return d_ranges.empty(); }
+    //! Clear the set
+    void clear() { d_ranges.clear(); }
+    //! Return the ranges ([first,last]) in the set
+    const std::vector<std::pair<int, int>> &ranges() const { return d_ranges; }
+    //! Return the ranks in the set
+    std::vector<int> ranks() const;
+    //! Print the set ("[0-1023,1025-4095]")
+    std::string print() const;
+    //! Operator==
+    bool operator==( const RankSet &rhs ) const { return d_ranges == rhs.d_ranges; }
+    //! Operator!=
+    bool operator!=( const RankSet &rhs ) const { return d_ranges != rhs.d_ranges; }
+    //! Compute the number of bytes needed to store the object
+    size_t size() const;
+    //! Pack the data to a byte array, returning a pointer to the end of the data
+    char *pack( char *ptr ) const;
+    //! Unpack the data from a byte array, returning a pointer to the end of the data
+    const char *unpack( const char *ptr );
+    //! Unpack the data from the byte array [ptr,end), returning nullptr if it is invalid
+    const char *unpack( const char *ptr, const char *end );
+
+private:
+    std::vector<std::pair<int, int>> d_ranges;
 };
 
 
@@ -55,6 +116,7 @@ struct multi_stack_info {
     int N = 0;                              // Number of threads/processes
     stack_info stack;                       // Current stack item
     std::vector<multi_stack_info> children; // Children
+    RankSet ranks;                          // Ranks with the stack (empty if not tracked)
     //! Default constructor
     multi_stack_info() : N( 0 ) {}
     //! Construct from a simple call stack
@@ -65,22 +127,36 @@ struct multi_stack_info {
     void clear();
     //! Is the stack empty
     bool empty() const { return N == 0; }
-    //! Add the given stack to the multistack
-    void add( size_t len, const stack_info *stack );
+    //! Add the given stack to the multistack (count is the number of times the stack was seen)
+    void add( size_t len, const stack_info *stack, int count = 1,
+              const RankSet &ranks = RankSet() );
     //! Add the given stack to the multistack
     void add( const multi_stack_info &stack );
+    //! Set the ranks for all entries in the multistack
+    void setRanks( const RankSet &ranks );
     //! Compute the number of bytes needed to store the object
     size_t size() const;
     //! Pack the data to a byte array, returning a pointer to the end of the data
     char *pack( char *ptr ) const;
     //! Unpack the data from a byte array, returning a pointer to the end of the data
     const char *unpack( const char *ptr );
+    //! Unpack the data from the byte array [ptr,end), returning nullptr if it is invalid
+    const char *unpack( const char *ptr, const char *end );
     //! Print the stack info
     std::vector<std::string> print( const std::string &prefix = "" ) const;
     //! Print the stack info
     void print( std::ostream &out, const std::string &prefix = "" ) const;
     //! Print the stack info
     std::string printString( const std::string &prefix = "" ) const;
+    //! Print the stack in the folded format ("a;b;c count" for each path with a self count)
+    void printFolded( std::ostream &out ) const;
+    //! Print the stack as a self-contained SVG flame graph
+    void printFlameGraph( std::ostream &out, const std::string &title = "Flame Graph" ) const;
+    //! Print the stack in the pprof format (uncompressed profile.proto)
+    //!   If the sampling period (ns) is positive, the cpu time is added to each sample
+    void printPprof( std::ostream &out, int64_t period = 0 ) const;
+    //! Print the stack in the callgrind format (self and inclusive costs for each function)
+    void printCallgrind( std::ostream &out, const std::string &event = "Samples" ) const;
 
 private:
     template<class FUN>
@@ -91,9 +167,92 @@ private:
 };
 
 
+/*!
+ * @brief  Capture the current call stack
+ * @details  This function captures the raw call stack for the current thread into a
+ *    user supplied buffer without allocating memory.
+ * @param[out] buffer   The buffer for the call stack
+ * @param[in] size      The size of the buffer (maximum depth)
+ * @param[in] skip      The number of frames to skip (not counting this function)
+ * @return              Returns the number of frames captured
+ */
+int backtrace( void **buffer, int size, int skip = 0 );
+
+
+/*!
+ * @brief  Fixed capacity raw call stack
+ * @details  This class stores a raw call stack (as returned by backtrace) with inline
+ *    storage.  It is trivially copyable so capturing/copying the stack does not allocate
+ *    memory and the stack can be stored in lock-free queues or shared memory.
+ *    If the call stack is deeper than the capacity, the outermost frames are dropped.
+ */
+template<size_t CAPACITY = 256>
+class RawStack final
+{
+public:
+    //! Empty constructor
+    RawStack() = default;
+    //! Construct from a raw call stack (truncated to the capacity)
+    RawStack( void *const *stack, size_t N ) : d_N( N < CAPACITY ? N : CAPACITY )
+    {
+        for ( size_t i = 0; i < d_N; i++ )
+            d_frames[i] = stack[i];
+    }
+    /*!
+     * @brief  Capture the current call stack
+     * @details  Capture the call stack of the caller (this function is always inlined).
+     * @param[in] skip      The number of frames to skip
+     * @param[in] maxDepth  The maximum number of frames to capture
+     */
+    [[gnu::always_inline]] inline void capture( int skip = 0, int maxDepth = CAPACITY )
+    {
+        int N = maxDepth < static_cast<int>( CAPACITY ) ? maxDepth : CAPACITY;
+        d_N   = StackTrace::backtrace( d_frames, N, skip );
+    }
+    //! Return the maximum number of frames
+    static constexpr size_t capacity() { return CAPACITY; }
+    //! Return the number of frames
+    size_t size() const { return d_N; }
+    //! Check if the stack is empty
+    bool empty() const { return d_N == 0; }
+    //! Clear the stack
+    void clear() { d_N = 0; }
+    //! Resize the stack (the size is limited to the capacity)
+    void resize( size_t N ) { d_N = N < CAPACITY ? N : CAPACITY; }
+    //! Access the frames
+    void **data() { return d_frames; }
+    void *const *data() const { return d_frames; }
+    void *operator[]( size_t i ) const { return d_frames[i]; }
+    void *const *begin() const { return d_frames; }
+    void *const *end() const { return d_frames + d_N; }
+    //! Convert to a vector
+    operator std::vector<void *>() const { return std::vector<void *>( begin(), end() ); }
+    //! Operator==
+    bool operator==( const RawStack &rhs ) const
+    {
+        if ( d_N != rhs.d_N )
+            return false;
+        for ( size_t i = 0; i < d_N; i++ ) {
+            if ( d_frames[i] != rhs.d_frames[i] )
+                return false;
+        }
+        return true;
+    }
+    //! Operator!=
+    bool operator!=( const RawStack &rhs ) const { return !operator==( rhs ); }
+
+private:
+    size_t d_N = 0;
+    void *d_frames[CAPACITY];
+};
+static_assert( std::is_trivially_copyable_v<RawStack<>> );
+
+
 //!< Terminate type
 enum class terminateType : uint8_t { signal, exception, abort, MPI, unknown };
 enum class printStackType : uint8_t { local = 1, threaded = 2, global = 3, none = 0 };
+enum class captureType : uint8_t { none = 0, stack = 1, full = 2 };
+enum class symbolizeType : uint8_t { rank = 0, root = 1 };
 
 
 //!< Class to contain exception info from abort
@@ -106,14 +265,24 @@ public:
     printStackType stackType;  //!< Print the local stack, all threads, or global call stack
     uint8_t signal;            //!< Signal number
     size_t bytes;              //!< Memory in use during abort
-    std::vector<void *> stack; //!< Local call stack for abort
+    RawStack<> stack;          //!< Local call stack for abort
 public:
     virtual const char *what() const noexcept override;
     abort_error();
     virtual ~abort_error() {}
 
 private:
-    mutable std::string d_msg;
+    std::string buildMessage() const;
+    // Message returned by what() (built on the first call, reset when copied)
+    struct message_cache {
+        message_cache() = default;
+        message_cache( const message_cache & ) {}
+        message_cache &operator=( const message_cache & );
+        std::mutex mutex;
+        bool valid = false;
+        std::string msg;
+    };
+    mutable message_cache d_msg;
 };
 
 
@@ -165,6 +334,98 @@ multi_stack_info getAllCallStacks();
 multi_stack_info getGlobalCallStacks();
 
 
+//! Class to contain the global call stacks (possibly partial)
+struct global_stack_info {
+    multi_stack_info stack; //!< Merged call stacks for the ranks that responded
+    RankSet missing;        //!< Ranks that did not respond (or have not responded yet)
+};
+
+
+/*!
+ * @brief  Get the current call stack for all threads/processes
+ * @details  This function returns the current call stack for all threads for all
+ *    processes (see getGlobalCallStacks()).  The callback is called (on the calling
+ *    thread) with the merged partial results each time a subtree of ranks responds, so
+ *    the caller can display results while waiting for slow/hung ranks.  The time to wait
+ *    for the ranks adapts to the observed response times, and the ranks that did not
+ *    respond are returned.
+ * @param[in] callback  Function called with the partial results (may be empty)
+ * @return              Returns the call stacks and the ranks that did not respond
+ */
+global_stack_info getGlobalCallStacks( std::function<void( const global_stack_info & )> callback );
+
+
+/*!
+ * @brief  Get the current call stack for a subset of the ranks
+ * @details  This function returns the current call stack for all threads for the given
+ *    ranks (see getGlobalCallStacks()).  Only the given ranks are queried, so the cost
+ *    scales with the number of ranks requested.  The call stacks for this rank are only
+ *    included if this rank is in the set.
+ * @param[in] ranks     Ranks to query (in the communicator passed to globalCallStackInitialize)
+ * @param[in] callback  Function called with the partial results (may be empty)
+ * @return              Returns the call stacks and the ranks that did not respond
+ */
+global_stack_info getGlobalCallStacks(
+    const RankSet &ranks, std::function<void( const global_stack_info & )> callback = nullptr );
+
+
+/*!
+ * @brief  Get a random sample of the ranks
+ * @details  This function returns a random subset of the ranks in the communicator passed
+ *    to globalCallStackInitialize() for use with getGlobalCallStacks( ranks ).
+ * @param[in] fraction  Fraction of the ranks to return (at least one rank is returned)
+ * @return              Returns the ranks
+ */
+RankSet sampleRanks( double fraction );
+
+
+/*!
+ * @brief  Handle for an asynchronous request for the global call stacks
+ * @details  This class is returned by getGlobalCallStacksAsync().  The call stacks are
+ *    gathered by the monitor thread while the caller continues, and the symbols are
+ *    resolved by the thread that calls get().  Multiple requests may be outstanding.
+ *    Copies of the handle refer to the same request.
+ */
+class global_stack_request final
+{
+public:
+    struct data_struct;
+    //! Empty constructor
+    global_stack_request() = default;
+    //! Constructor (used by getGlobalCallStacksAsync)
+    explicit global_stack_request( std::shared_ptr<data_struct> data ) : d_data( std::move( data ) )
+    {
+    }
+    //! Check if the request is valid
+    bool valid() const { return d_data != nullptr; }
+    //! Check if the request has finished (does not block)
+    bool test() const;
+    //! Wait for the request to finish
+    void wait() const;
+    //! Wait for the request to finish, returning false if the timeout (s) expired
+    bool wait_for( double timeout ) const;
+    //! Wait for the request to finish and return the call stacks
+    global_stack_info get() const;
+
+private:
+    std::shared_ptr<data_struct> d_data;
+};
+
+
+/*!
+ * @brief  Get the current call stack for all threads/processes without blocking
+ * @details  This function starts a request for the call stacks for all threads for all
+ *    processes (see getGlobalCallStacks()) and returns immediately.  The local call
+ *    stacks are captured before returning.
+ * @return              Returns the handle for the request
+ */
+global_stack_request getGlobalCallStacksAsync();
+
+
+//! Get the current call stack for a subset of the ranks without blocking
+global_stack_request getGlobalCallStacksAsync( const RankSet &ranks );
+
+
 /*!
  * @brief  Clean up the stack trace
  * @details  This function modifies the stack trace to remove entries
@@ -175,20 +436,69 @@ multi_stack_info getGlobalCallStacks();
 void cleanupStackTrace( multi_stack_info &stack );
 
 
+//! Ranks with call stacks that differ from the majority (see findStragglers)
+struct straggler_info {
+    RankSet ranks;            //!< Ranks that differ from the majority
+    int majority = 0;         //!< Number of ranks in the majority at the divergence point
+    int depth    = 0;         //!< Depth of the divergence point
+    stack_info frame;         //!< First frame that differs (empty if the ranks stop here)
+    stack_info majorityFrame; //!< Frame of the majority at the divergence point
+    stack_info caller;        //!< Last frame in common (empty for the outermost frame)
+};
+
+
+/*!
+ * @brief  Find the ranks with call stacks that differ from the majority
+ * @details  This function searches rank labelled call stacks (e.g. from
+ *    getGlobalCallStacks) for points where the ranks diverge, and returns the ranks
+ *    that are in a minority branch (less than half of the ranks) and not in the majority
+ *    branch, e.g. 1 rank in compute while 4095 ranks are in MPI_Allreduce.  The results
+ *    are sorted with the deepest divergence first.  The search does not descend into the
+ *    minority branches and runs in time linear in the size of the tree.
+ * @param[in] stack     The call stacks (labelled with the ranks)
+ * @return              Returns the suspect ranks
+ */
+std::vector<straggler_info> findStragglers( const multi_stack_info &stack );
+
+
+/*!
+ * @brief  Print a summary of the ranks with call stacks that differ from the majority
+ * @details  This function returns a short summary of findStragglers (and the ranks that
+ *    did not respond) for printing ahead of the full call stacks.
+ * @param[in] stack     The call stacks (labelled with the ranks)
+ * @param[in] missing   Ranks that did not respond
+ * @return              Returns the summary (empty if there are no suspect ranks)
+ */
+std::string printStragglers( const multi_stack_info &stack, const RankSet &missing = RankSet() );
+
+
 //! Function to return the current call stack for the current thread
-std::vector<void *> backtrace();
+RawStack<> backtrace();
 
 //! Function to return the current call stack for the given thread
-std::vector<void *> backtrace( std::thread::native_handle_type id );
+RawStack<> backtrace( std::thread::native_handle_type id );
 
 //! Function to return the current call stack for all registered threads
-std::vector<std::vector<void *>> backtraceAll();
+std::vector<RawStack<>> backtraceAll();
 
 
 //! Function to return the stack info for a given address
 stack_info getStackInfo( void *address );
 
 
+/*!
+ * @brief  Create a multi-stack from raw call stacks
+ * @details  This function creates the multi-stack from a list of raw call stacks
+ *    (as returned by backtrace), resolving the symbols for each unique address once.
+ * @param[in] trace     The raw call stacks
+ * @param[in] count     Number of times each call stack was seen (optional, default is 1)
+ *                      If provided it must have the same size as trace (throws std::logic_error)
+ * @return              Returns the combined call stack
+ */
+multi_stack_info generateMultiStack( const std::vector<std::vector<void *>> &trace,
+                                     const std::vector<int> &count = {} );
+
+
 //! Function to return the stack info for a given address
 std::vector<stack_info> getStackInfo( const std::vector<void *> &address );
 
@@ -275,6 +585,9 @@ std::vector<std::thread::native_handle_type> registeredThreads();
 //! Get a list of the active threads (may be undefined for some operating systems)
 std::vector<std::thread::native_handle_type> activeThreads();
 
+//! Get the operating system id for a thread (Linux only, returns -1 if unavailable)
+int getSystemThreadID( std::thread::native_handle_type );
+
 
 /*!
  * @brief  Create stack from string
@@ -300,6 +613,41 @@ void setDefaultStackType( StackTrace::printStackType );
 //! Get default stack type
 StackTrace::printStackType getDefaultStackType();
 
+/*!
+ * @brief  Set the default capture type
+ * @details  This function sets what is captured when an abort_error is created by
+ *    Utilities::abort or when an unhandled exception is caught:
+ *       none  - Do not capture the call stack or the memory usage
+ *       stack - Capture the raw call stack only
+ *       full  - Capture the raw call stack and the memory usage (default)
+ *    The call stack is only resolved (and the other threads captured) when what() is
+ *    called, so code that throws and catches abort_error frequently may want to use
+ *    none or stack.
+ * @param[in] type          The default capture type
+ */
+void setDefaultCaptureType( StackTrace::captureType type );
+
+//! Get default capture type
+StackTrace::captureType getDefaultCaptureType();
+
+/*!
+ * @brief  Set where the global call stacks are symbolized
+ * @details  This function sets where the symbols are resolved for getGlobalCallStacks:
+ *       rank - Each rank resolves the symbols for its own call stacks
+ *       root - Each rank sends the raw call stacks (addresses relative to the loaded
+ *              objects) and the requesting rank resolves the symbols for the unique
+ *              addresses once (default)
+ *    Resolving the symbols on each rank reads the debug info for the executable and
+ *    libraries from every rank at the same time.  root requires the requesting rank to
+ *    have the same executable/libraries loaded (other objects are reported with only the
+ *    object and offset).
+ * @param[in] type          Where to resolve the symbols
+ */
+void setGlobalSymbolizeType( StackTrace::symbolizeType type );
+
+//! Get where the global call stacks are symbolized
+StackTrace::symbolizeType getGlobalSymbolizeType();
+
 
 } // namespace StackTrace
 
@@ -0,0 +1,39 @@
+// This file contains optional hooks that interpose __cxa_throw for the exception profiler
+// It is built as a separate library (stacktrace_exception_hooks) that must be explicitly linked
+// Note: the hook only calls into the exception profiler which returns immediately when it is
+//    not running
+#include "StackTrace/ExceptionProfiler.h"
+
+#include <cstdlib>
+#include <typeinfo>
+
+#include <dlfcn.h>
+#include <unistd.h>
+
+
+/****************************************************************************
+ *  __cxa_throw hook for the exception profiler                              *
+ *  Note: the type is declared void* to match the declaration the compiler   *
+ *    creates implicitly for throw expressions                               *
+ ****************************************************************************/
+typedef void ( *cxa_throw_fun )( void *, void *, void ( * )( void * ) );
+static cxa_throw_fun getLibcThrow()
+{
+    auto fun = reinterpret_cast<cxa_throw_fun>( dlsym( RTLD_NEXT, "__cxa_throw" ) );
+    if ( !fun ) {
+        const char msg[] = "stacktrace_exception_hooks: unable to find __cxa_throw\n";
+        [[maybe_unused]] auto tmp = write( STDERR_FILENO, msg, sizeof( msg ) - 1 );
+        abort();
+    }
+    return fun;
+}
+extern "C" {
+int stacktrace_exception_hooks = 1;
+void __cxa_throw( void *exception, void *tinfo, void ( *dest )( void * ) )
+{
+    static auto libc_throw = getLibcThrow();
+    StackTrace::ExceptionProfiler::recordThrow( exception, static_cast<std::type_info *>( tinfo ) );
+    libc_throw( exception, tinfo, dest );
+    __builtin_unreachable();
+}
+}
@@ -0,0 +1,566 @@
+#include "StackTrace/StackTrace.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+
+/****************************************************************************
+ *  Helper functions                                                         *
+ ****************************************************************************/
+// Buffered writer to limit the number of calls to the stream
+class BufferedWriter
+{
+public:
+    explicit BufferedWriter( std::ostream &out ) : d_out( out ) { d_buf.reserve( 2 * SIZE ); }
+    ~BufferedWriter() { flush(); }
+    void write( std::string_view str )
+    {
+        d_buf.append( str.data(), str.size() );
+        if ( d_buf.size() > SIZE )
+            flush();
+    }
+    template<class... Args>
+    void printf( const char *format, Args... args )
+    {
+        char tmp[512];
+        int N = snprintf( tmp, sizeof( tmp ), format, args... );
+        if ( N > 0 )
+            write( std::string_view( tmp, std::min<int>( N, sizeof( tmp ) - 1 ) ) );
+    }
+    void flush()
+    {
+        d_out.write( d_buf.data(), d_buf.size() );
+        d_buf.clear();
+    }
+
+private:
+    static constexpr size_t SIZE = 65536;
+    std::ostream &d_out;
+    std::string d_buf;
+};
+
+
+// Get the label for a stack entry
+static std::string getLabel( const StackTrace::stack_info &stack )
+{
+    char tmp[128];
+    if ( stack.function[0] != 0 ) {
+        std::string label( stack.function.data() );
+        std::replace( label.begin(), label.end(), ';', ':' );
+        return label;
+    } else if ( stack.object[0] != 0 ) {
+        snprintf( tmp, sizeof( tmp ), "%s+0x%" PRIxPTR, stack.object.data(),
+                  reinterpret_cast<uintptr_t>( stack.address2 ) );
+    } else {
+        snprintf( tmp, sizeof( tmp ), "0x%" PRIxPTR, reinterpret_cast<uintptr_t>( stack.address ) );
+    }
+    return tmp;
+}
+
+
+// Traverse the stack, merging siblings with the same label
+// The function is called for each merged node in pre-order as
+//    fun( label, depth, x, N, self ), where x is the sum of the counts before the node
+// and returns true if the children should be traversed
+template<class FUN>
+static void foldStack( const std::vector<const StackTrace::multi_stack_info *> &nodes, int depth,
+                       int64_t x, FUN &fun )
+{
+    // Group the children by label
+    std::vector<std::pair<std::string, const StackTrace::multi_stack_info *>> children;
+    for ( auto node : nodes ) {
+        for ( const auto &child : node->children )
+            children.emplace_back( getLabel( child.stack ), &child );
+    }
+    std::stable_sort( children.begin(), children.end(),
+                      []( const auto &a, const auto &b ) { return a.first < b.first; } );
+    // Process each group
+    std::vector<const StackTrace::multi_stack_info *> group;
+    for ( size_t i = 0; i < children.size(); ) {
+        size_t j = i;
+        group.clear();
+        int64_t N = 0, N2 = 0;
+        for ( ; j < children.size() && children[j].first == children[i].first; j++ ) {
+            group.push_back( children[j].second );
+            N += children[j].second->N;
+            for ( const auto &child : children[j].second->children )
+                N2 += child.N;
+        }
+        if ( fun( children[i].first, depth, x, N, N - N2 ) )
+            foldStack( group, depth + 1, x, fun );
+        x += N;
+        i = j;
+    }
+}
+
+
+// Traverse a multi-stack (the root of a multi-stack does not contain a valid entry)
+template<class FUN>
+static void foldStack( const StackTrace::multi_stack_info &stack, FUN &fun )
+{
+    if ( stack.stack.address == nullptr ) {
+        foldStack( { &stack }, 0, 0, fun );
+    } else {
+        StackTrace::multi_stack_info root;
+        root.N        = stack.N;
+        root.children = { stack };
+        foldStack( { &root }, 0, 0, fun );
+    }
+}
+
+
+/****************************************************************************
+ *  Print the folded stack                                                   *
+ ****************************************************************************/
+void StackTrace::multi_stack_info::printFolded( std::ostream &out ) const
+{
+    BufferedWriter writer( out );
+    std::string path;
+    std::vector<size_t> length;
+    auto fun = [&]( const std::string &label, int depth, int64_t, int64_t, int64_t self ) {
+        length.resize( depth + 1 );
+        path.resize( depth == 0 ? 0 : length[depth - 1] );
+        if ( depth > 0 )
+            path += ';';
+        path += label;
+        length[depth] = path.size();
+        if ( self > 0 ) {
+            writer.write( path );
+            writer.printf( " %" PRId64 "\n", self );
+        }
+        return true;
+    };
+    foldStack( *this, fun );
+}
+
+
+/****************************************************************************
+ *  Print a SVG flame graph                                                  *
+ ****************************************************************************/
+static void writeEscaped( BufferedWriter &writer, std::string_view str )
+{
+    size_t i0 = 0;
+    for ( size_t i = 0; i < str.size(); i++ ) {
+        const char *rep = nullptr;
+        if ( str[i] == '<' )
+            rep = "&lt;";
+        else if ( str[i] == '>' )
+            rep = "&gt;";
+        else if ( str[i] == '&' )
+            rep = "&amp;";
+        else if ( str[i] == '"' )
+            rep = "&quot;";
+        if ( rep ) {
+            writer.write( str.substr( i0, i - i0 ) );
+            writer.write( rep );
+            i0 = i + 1;
+        }
+    }
+    writer.write( str.substr( i0 ) );
+}
+void StackTrace::multi_stack_info::printFlameGraph( std::ostream &out,
+                                                    const std::string &title ) const
+{
+    constexpr double width     = 1200; // Width of the image
+    constexpr double pad       = 10;   // Padding on the sides
+    constexpr int frameHeight  = 16;   // Height of each frame
+    constexpr int header       = 40;   // Space for the title
+    constexpr double charWidth = 7;    // Approximate width of a character
+    constexpr double minWidth  = 0.1;  // Frames smaller than this are not drawn
+    // Get the frames to draw
+    struct frame_struct {
+        std::string label;
+        int depth;
+        int64_t x;
+        int64_t N;
+    };
+    std::vector<frame_struct> frames;
+    int64_t total = std::max( N, 1 );
+    double scale  = ( width - 2 * pad ) / total;
+    int maxDepth  = 0;
+    auto fun = [&]( const std::string &label, int depth, int64_t x, int64_t N2, int64_t ) {
+        if ( N2 * scale < minWidth )
+            return false;
+        frames.push_back( { label, depth, x, N2 } );
+        maxDepth = std::max( maxDepth, depth );
+        return true;
+    };
+    foldStack( *this, fun );
+    // Write the image
+    int height = header + ( maxDepth + 1 ) * frameHeight + 2 * pad;
+    BufferedWriter writer( out );
+    writer.write( "<?xml version=\"1.0\" standalone=\"no\"?>\n" );
+    writer.printf( "<svg version=\"1.1\" width=\"%i\" height=\"%i\" viewBox=\"0 0 %i %i\" "
+                   "xmlns=\"http://www.w3.org/2000/svg\">\n",
+                   (int) width, height, (int) width, height );
+    writer.write( "<style>text { font-family: Verdana, sans-serif; font-size: 12px; } "
+                  "rect { stroke: white; stroke-width: 0.5; }</style>\n" );
+    writer.printf( "<rect x=\"0\" y=\"0\" width=\"%i\" height=\"%i\" fill=\"#f8f8f8\"/>\n",
+                   (int) width, height );
+    writer.printf( "<text x=\"%i\" y=\"24\" text-anchor=\"middle\" style=\"font-size: 17px\">",
+                   (int) width / 2 );
+    writeEscaped( writer, title );
+    writer.write( "</text>\n" );
+    for ( const auto &frame : frames ) {
+        double x = pad + frame.x * scale;
+        double w = frame.N * scale;
+        int y    = height - pad - ( frame.depth + 1 ) * frameHeight;
+        // Choose a warm color from the label
+        uint64_t hash = 0xcbf29ce484222325;
+        for ( char c : frame.label )
+            hash = ( hash ^ static_cast<uint8_t>( c ) ) * 0x100000001b3;
+        int r = 205 + hash % 51;
+        int g = ( hash >> 8 ) % 231;
+        int b = ( hash >> 16 ) % 56;
+        writer.write( "<g><title>" );
+        writeEscaped( writer, frame.label );
+        writer.printf(
+            " (%" PRId64 " samples, %0.2f%%)</title>", frame.N, 100.0 * frame.N / total );
+        writer.printf( "<rect x=\"%0.1f\" y=\"%i\" width=\"%0.1f\" height=\"%i\" "
+                       "fill=\"rgb(%i,%i,%i)\"/>",
+                       x, y, w, frameHeight - 1, r, g, b );
+        // Add the text if it fits
+        size_t chars = ( w - 6 ) / charWidth;
+        if ( chars >= 3 ) {
+            writer.printf( "<text x=\"%0.1f\" y=\"%i\">", x + 3, y + frameHeight - 4 );
+            if ( frame.label.size() <= chars ) {
+                writeEscaped( writer, frame.label );
+            } else {
+                writeEscaped( writer, std::string_view( frame.label ).substr( 0, chars - 2 ) );
+                writer.write( ".." );
+            }
+            writer.write( "</text>" );
+        }
+        writer.write( "</g>\n" );
+    }
+    writer.write( "</svg>\n" );
+}
+
+
+/****************************************************************************
+ *  Print the stack in the pprof format (profile.proto)                      *
+ ****************************************************************************/
+// Minimal protobuf encoder
+class ProtoBuffer
+{
+public:
+    void varint( uint64_t x )
+    {
+        for ( ; x >= 0x80; x >>= 7 )
+            d_buf += static_cast<char>( x | 0x80 );
+        d_buf += static_cast<char>( x );
+    }
+    void writeVarint( int field, uint64_t x )
+    {
+        varint( field << 3 );
+        varint( x );
+    }
+    void writeBytes( int field, std::string_view x )
+    {
+        varint( ( field << 3 ) | 2 );
+        varint( x.size() );
+        d_buf.append( x.data(), x.size() );
+    }
+    void writePacked( int field, const std::vector<uint64_t> &x )
+    {
+        ProtoBuffer tmp;
+        for ( auto y : x )
+            tmp.varint( y );
+        writeBytes( field, tmp.str() );
+    }
+    const std::string &str() const { return d_buf; }
+    void clear() { d_buf.clear(); }
+
+private:
+    std::string d_buf;
+};
+
+
+// Tables for the pprof format (the ids start at 1, the first string must be empty)
+struct pprof_tables {
+    struct mapping_struct {
+        uint64_t start, limit, filename;
+    };
+    struct function_struct {
+        uint64_t name, filename;
+    };
+    struct location_struct {
+        uint64_t mapping, function, address, line;
+    };
+    std::vector<std::string> strings = { "" };
+    std::vector<mapping_struct> mappings;
+    std::vector<function_struct> functions;
+    std::vector<location_struct> locations;
+    std::unordered_map<std::string, uint64_t> stringIndex = { { "", 0 } };
+    std::unordered_map<std::string, uint64_t> mappingIndex;
+    std::unordered_map<std::string, uint64_t> functionIndex;
+    std::unordered_map<const void *, uint64_t> locationIndex;
+    uint64_t getString( const std::string &str )
+    {
+        auto it = stringIndex.find( str );
+        if ( it != stringIndex.end() )
+            return it->second;
+        strings.push_back( str );
+        stringIndex[str] = strings.size() - 1;
+        return strings.size() - 1;
+    }
+    uint64_t getMapping( const StackTrace::stack_info &stack )
+    {
+        if ( stack.object[0] == 0 )
+            return 0;
+        std::string key = stack.object.data();
+        if ( stack.objectPath[0] != 0 )
+            key = std::string( stack.objectPath.data() ) + "/" + key;
+        auto address    = reinterpret_cast<uint64_t>( stack.address );
+        auto it         = mappingIndex.find( key );
+        if ( it != mappingIndex.end() ) {
+            auto &map = mappings[it->second - 1];
+            map.limit = std::max( map.limit, address + 1 );
+            return it->second;
+        }
+        uint64_t start = address - reinterpret_cast<uint64_t>( stack.address2 );
+        mappings.push_back( { start, address + 1, getString( key ) } );
+        mappingIndex[key] = mappings.size();
+        return mappings.size();
+    }
+    uint64_t getFunction( const StackTrace::stack_info &stack )
+    {
+        if ( stack.function[0] == 0 )
+            return 0;
+        std::string key = std::string( stack.function.data() ) + '\0' + stack.filename.data();
+        auto it         = functionIndex.find( key );
+        if ( it != functionIndex.end() )
+            return it->second;
+        auto name     = getString( stack.function.data() );
+        auto filename = getString( stack.filename.data() );
+        functions.push_back( { name, filename } );
+        functionIndex[key] = functions.size();
+        return functions.size();
+    }
+    uint64_t getLocation( const StackTrace::stack_info &stack )
+    {
+        auto it = locationIndex.find( stack.address );
+        if ( it != locationIndex.end() )
+            return it->second;
+        locations.push_back( { getMapping( stack ), getFunction( stack ),
+                               reinterpret_cast<uint64_t>( stack.address ), stack.line } );
+        locationIndex[stack.address] = locations.size();
+        return locations.size();
+    }
+};
+
+
+// Write the samples (one sample for each node with a self count)
+static void writeSamples( const StackTrace::multi_stack_info &node, int64_t period,
+                          std::vector<uint64_t> &path, pprof_tables &tables,
+                          BufferedWriter &writer )
+{
+    if ( node.stack.address != nullptr )
+        path.push_back( tables.getLocation( node.stack ) );
+    int64_t self = node.N;
+    for ( const auto &child : node.children )
+        self -= child.N;
+    if ( self > 0 && !path.empty() ) {
+        ProtoBuffer sample, buf;
+        sample.writePacked( 1, std::vector<uint64_t>( path.rbegin(), path.rend() ) );
+        if ( period > 0 )
+            sample.writePacked( 2, { static_cast<uint64_t>( self ),
+                                     static_cast<uint64_t>( self * period ) } );
+        else
+            sample.writePacked( 2, { static_cast<uint64_t>( self ) } );
+        buf.writeBytes( 2, sample.str() );
+        writer.write( buf.str() );
+    }
+    for ( const auto &child : node.children )
+        writeSamples( child, period, path, tables, writer );
+    if ( node.stack.address != nullptr )
+        path.pop_back();
+}
+
+
+// Write the stack
+void StackTrace::multi_stack_info::printPprof( std::ostream &out, int64_t period ) const
+{
+    pprof_tables tables;
+    BufferedWriter writer( out );
+    ProtoBuffer buf, msg;
+    // Write the sample types
+    msg.writeVarint( 1, tables.getString( "samples" ) );
+    msg.writeVarint( 2, tables.getString( "count" ) );
+    buf.writeBytes( 1, msg.str() );
+    if ( period > 0 ) {
+        msg.clear();
+        msg.writeVarint( 1, tables.getString( "cpu" ) );
+        msg.writeVarint( 2, tables.getString( "nanoseconds" ) );
+        buf.writeBytes( 1, msg.str() );
+    }
+    writer.write( buf.str() );
+    // Write the samples (filling the tables)
+    std::vector<uint64_t> path;
+    writeSamples( *this, period, path, tables, writer );
+    // Write the mappings
+    for ( size_t i = 0; i < tables.mappings.size(); i++ ) {
+        const auto &map = tables.mappings[i];
+        buf.clear();
+        msg.clear();
+        msg.writeVarint( 1, i + 1 );
+        msg.writeVarint( 2, map.start );
+        msg.writeVarint( 3, map.limit );
+        msg.writeVarint( 5, map.filename );
+        msg.writeVarint( 7, !tables.functions.empty() );
+        buf.writeBytes( 3, msg.str() );
+        writer.write( buf.str() );
+    }
+    // Write the locations
+    for ( size_t i = 0; i < tables.locations.size(); i++ ) {
+        const auto &loc = tables.locations[i];
+        buf.clear();
+        msg.clear();
+        msg.writeVarint( 1, i + 1 );
+        if ( loc.mapping != 0 )
+            msg.writeVarint( 2, loc.mapping );
+        msg.writeVarint( 3, loc.address );
+        if ( loc.function != 0 ) {
+            ProtoBuffer line;
+            line.writeVarint( 1, loc.function );
+            if ( loc.line > 0 )
+                line.writeVarint( 2, loc.line );
+            msg.writeBytes( 4, line.str() );
+        }
+        buf.writeBytes( 4, msg.str() );
+        writer.write( buf.str() );
+    }
+    // Write the functions
+    for ( size_t i = 0; i < tables.functions.size(); i++ ) {
+        const auto &fun = tables.functions[i];
+        buf.clear();
+        msg.clear();
+        msg.writeVarint( 1, i + 1 );
+        msg.writeVarint( 2, fun.name );
+        msg.writeVarint( 3, fun.name );
+        msg.writeVarint( 4, fun.filename );
+        buf.writeBytes( 5, msg.str() );
+        writer.write( buf.str() );
+    }
+    // Write the string table
+    for ( const auto &str : tables.strings ) {
+        buf.clear();
+        buf.writeBytes( 6, str );
+        writer.write( buf.str() );
+    }
+    // Write the period
+    if ( period > 0 ) {
+        buf.clear();
+        msg.clear();
+        msg.writeVarint( 1, tables.getString( "cpu" ) );
+        msg.writeVarint( 2, tables.getString( "nanoseconds" ) );
+        buf.writeBytes( 11, msg.str() );
+        buf.writeVarint( 12, period );
+        writer.write( buf.str() );
+    }
+}
+
+
+/****************************************************************************
+ *  Print the stack in the callgrind format                                  *
+ ****************************************************************************/
+// Aggregated costs for the callgrind format
+struct callgrind_data {
+    struct function_struct {
+        uint32_t object, file;
+        std::map<uint32_t, int64_t> self;                        // line -> cost
+        std::map<std::pair<uint32_t, uint32_t>, int64_t> calls; // (callee, line) -> cost
+    };
+    std::vector<function_struct> functions;
+    std::vector<std::string> names[3]; // object, file, function
+    std::unordered_map<std::string, uint32_t> index[3];
+    std::unordered_map<const void *, uint32_t> addressIndex;
+    uint32_t getIndex( int type, const std::string &name )
+    {
+        auto it = index[type].find( name );
+        if ( it != index[type].end() )
+            return it->second;
+        names[type].push_back( name );
+        index[type][name] = names[type].size();
+        return names[type].size();
+    }
+    uint32_t getFunction( const StackTrace::stack_info &stack )
+    {
+        auto it = addressIndex.find( stack.address );
+        if ( it != addressIndex.end() )
+            return it->second;
+        auto id = getIndex( 2, getLabel( stack ) );
+        if ( id > functions.size() ) {
+            const char *obj  = stack.object[0] != 0 ? stack.object.data() : "???";
+            const char *file = stack.filename[0] != 0 ? stack.filename.data() : "???";
+            functions.push_back( { getIndex( 0, obj ), getIndex( 1, file ), {}, {} } );
+        }
+        addressIndex[stack.address] = id;
+        return id;
+    }
+};
+// Add the costs for a node and its children (the ids start at 1, 0 is the root)
+static void addCallgrind( const StackTrace::multi_stack_info &node, uint32_t parent,
+                          uint32_t line, callgrind_data &data )
+{
+    uint32_t id = parent;
+    if ( node.stack.address != nullptr ) {
+        id           = data.getFunction( node.stack );
+        int64_t self = node.N;
+        for ( const auto &child : node.children )
+            self -= child.N;
+        if ( self > 0 )
+            data.functions[id - 1].self[node.stack.line] += self;
+        if ( parent != 0 )
+            data.functions[parent - 1].calls[{ id, line }] += node.N;
+    }
+    for ( const auto &child : node.children )
+        addCallgrind( child, id, node.stack.line, data );
+}
+// Write the stack
+void StackTrace::multi_stack_info::printCallgrind( std::ostream &out,
+                                                   const std::string &event ) const
+{
+    // Aggregate the costs
+    callgrind_data data;
+    addCallgrind( *this, 0, 0, data );
+    // Write the data (names are compressed after the first use)
+    std::vector<bool> used[3];
+    for ( int i = 0; i < 3; i++ )
+        used[i].resize( data.names[i].size() + 1, false );
+    BufferedWriter writer( out );
+    auto writeName = [&data, &used, &writer]( const char *key, int type, uint32_t id ) {
+        writer.printf( "%s=(%u)", key, id );
+        if ( !used[type][id] ) {
+            writer.write( " " );
+            writer.write( data.names[type][id - 1] );
+            used[type][id] = true;
+        }
+        writer.write( "\n" );
+    };
+    writer.write( "# callgrind format\nversion: 1\ncreator: StackTrace\npositions: line\n" );
+    writer.printf( "events: %s\nsummary: %i\n", event.data(), N );
+    for ( uint32_t i = 1; i <= data.functions.size(); i++ ) {
+        const auto &fun = data.functions[i - 1];
+        writer.write( "\n" );
+        writeName( "ob", 0, fun.object );
+        writeName( "fl", 1, fun.file );
+        writeName( "fn", 2, i );
+        for ( const auto &[line, cost] : fun.self )
+            writer.printf( "%u %" PRId64 "\n", line, cost );
+        for ( const auto &[key, cost] : fun.calls ) {
+            const auto &callee = data.functions[key.first - 1];
+            writeName( "cob", 0, callee.object );
+            writeName( "cfl", 1, callee.file );
+            writeName( "cfn", 2, key.first );
+            writer.printf( "calls=%" PRId64 " 0\n%u %" PRId64 "\n", cost, key.second, cost );
+        }
+    }
+}
@@ -0,0 +1,1867 @@
+#include "StackTrace/ErrorHandlers.h"
+#include "StackTrace/Fingerprint.h"
+#include "StackTrace/StackTrace.h"
+#include "StackTrace/Utilities.h"
+#include "StackTraceInternal.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+// Detect the OS
+// clang-format off
+#if defined( WIN32 ) || defined( _WIN32 ) || defined( WIN64 ) || defined( _WIN64 ) || defined( _MSC_VER )
+    #define USE_WINDOWS
+#elif defined( __APPLE__ )
+    #define USE_MAC
+#elif defined( __linux ) || defined( __linux__ ) || defined( __unix ) || defined( __posix )
+    #define USE_LINUX
+#else
+    #error Unknown OS
+#endif
+// clang-format on
+
+
+// Include system dependent headers
+// clang-format off
+#if defined( STACKTRACE_USE_MPI ) && !defined( USE_WINDOWS )
+    #define USE_SOCKETS
+    #include <arpa/inet.h>
+    #include <cerrno>
+    #include <cstddef>
+    #include <fcntl.h>
+    #include <netdb.h>
+    #include <netinet/in.h>
+    #include <poll.h>
+    #include <sys/socket.h>
+    #include <sys/un.h>
+    #include <unistd.h>
+#endif
+// clang-format on
+
+
+/****************************************************************************
+ *  Global call stack functionality                                          *
+ *  The call stacks are gathered with a binomial tree reduction over the     *
+ *  ranks (rooted at the requesting rank).  Each rank forwards the request   *
+ *  to its children, merges the call stacks from its subtree and sends the   *
+ *  merged call stack to its parent so the root only receives O(log(P))      *
+ *  messages.  All of the communication is done by the monitor thread.       *
+ *  Each rank waits for its children until its deadline: the deadline is    *
+ *  extended as replies arrive (based on the observed response time), and   *
+ *  the ranks in subtrees that do not reply in time are reported as missing. *
+ *  Each level waits less than its parent (0.8 * wait), so a rank gives up   *
+ *  on a child that does not reply and still replies before its own parent   *
+ *  gives up on it (only the ranks that did not reply are reported missing). *
+ *  The root reports the partial results as each subtree replies.            *
+ *  By default the ranks only send the fingerprint and count of each unique  *
+ *  call stack (and a rank with the call stack).  The root then requests    *
+ *  the raw call stack (module relative addresses) for each fingerprint it  *
+ *  has not seen from a single rank, and resolves the symbols for the       *
+ *  unique addresses once, so the other ranks do not read the debug info    *
+ *  from the file system and the data sent scales with the number of unique *
+ *  call stacks rather than the number of ranks.                            *
+ *  Each parent caches the merged call stack counts it received from each   *
+ *  subtree and sends the id of the cached results with the request.  If    *
+ *  the merged counts for a subtree are the same as the results the parent  *
+ *  has cached, the subtree only replies that they have not changed, so      *
+ *  repeated snapshots of a hung/slow job send very little data.             *
+ *  The ranks are grouped by node: the ranks on a node reduce to a single    *
+ *  rank first and only that rank takes part in the tree over the nodes, so  *
+ *  the traffic between nodes scales with the number of nodes.               *
+ *  MPI does not provide a blocking wait that does not spin, so the monitor  *
+ *  thread polls with an interval that backs off while idle (MAX_IDLE, the   *
+ *  same rate as the original 50 ms sleep) and is short while a reduction or *
+ *  send is in progress (MAX_ACTIVE).  With the socket transport the thread  *
+ *  blocks in poll until a socket is ready, so it does not wake while idle.  *
+ *  Local requests and finalize wake the monitor thread immediately.         *
+ *  If MPI does not provide MPI_THREAD_MULTIPLE the monitor thread does not  *
+ *  call MPI: the messages are sent over sockets instead (see below).        *
+ ****************************************************************************/
+#ifdef STACKTRACE_USE_MPI
+using steady_clock = std::chrono::steady_clock;
+static constexpr int REQUEST_TAG      = 1; // Request for the call stacks of a subtree
+static constexpr int REPLY_TAG        = 2; // Merged call stacks for a subtree
+static constexpr int FRAMES_TAG       = 3; // Request for the raw call stacks of fingerprints
+static constexpr int FRAMES_REPLY_TAG = 4; // Raw call stacks for the fingerprints
+static constexpr int UNCHANGED_TAG    = 5; // The merged call stacks for a subtree have not changed
+static constexpr std::chrono::microseconds MIN_POLL( 10 );   // Poll interval after activity
+static constexpr std::chrono::microseconds MAX_ACTIVE( 100 ); // Max interval during a reduction
+static constexpr std::chrono::microseconds MAX_IDLE( 50000 ); // Max interval while idle
+static constexpr double LEVEL_TIME = 0.5; // Time reserved for each level of the tree (s)
+static constexpr double MIN_WAIT   = 4.0; // Minimum time to wait after a reply (s)
+static constexpr size_t MAX_FRAMES = 100000; // Max number of raw call stacks cached by the root
+static constexpr size_t MAX_DELTAS = 1024;   // Max number of subtree results cached
+static constexpr uint64_t NO_BASE  = ~static_cast<uint64_t>( 0 ); // No cached results
+static MPI_Comm globalCommForGlobalCommStack  = MPI_COMM_NULL;
+static volatile int globalMonitorThreadStatus = -1;
+static std::shared_ptr<std::thread> globalMonitorThread;
+static std::vector<int> globalNodeId; // Node of each rank (lowest rank on the node)
+static int globalRank        = 0;     // Rank in globalCommForGlobalCommStack
+static int globalSize        = 1;     // Size of globalCommForGlobalCommStack
+static bool globalUseSockets = false; // Send the messages over sockets (instead of MPI)
+static std::atomic<int64_t> globalLastRequest( 0 );     // Last request from another rank (ns)
+static std::atomic<size_t> globalFullReplies( 0 );      // Replies with call stacks received
+static std::atomic<size_t> globalUnchangedReplies( 0 ); // Unchanged replies received
+
+
+// Header for a request (followed by the ranks in the subtree)
+struct request_header {
+    uint64_t id;    // Unique id of the request (requesting rank and counter)
+    int root;       // Rank that requested the call stacks
+    int N;          // Number of ranks in the subtree (the first rank is the receiving rank)
+    double timeout; // Maximum time for the subtree (s)
+    double wait;    // Minimum time to wait for the children after a reply (s)
+    bool raw;       // Send the raw call stacks (the root resolves the symbols)
+    uint64_t base;  // Id of the results for the subtree cached by the parent (or NO_BASE)
+};
+
+
+// Header for a reply (followed by the missing ranks and the packed call stack)
+struct reply_header {
+    uint64_t id; // Id of the request
+};
+
+
+// Number of threads and the ranks with each unique call stack (fingerprint)
+class stack_counts
+{
+public:
+    struct count_struct {
+        int count = 0;            // Number of threads with the call stack
+        StackTrace::RankSet ranks; // Ranks with the call stack
+    };
+    //! Add the count for a call stack
+    void add( uint64_t fingerprint, int count, const StackTrace::RankSet &ranks );
+    //! Add the counts from another rank
+    void add( const stack_counts &rhs );
+    //! Return the counts
+    const std::map<uint64_t, count_struct> &data() const { return d_counts; }
+    //! Operator==
+    bool operator==( const stack_counts &rhs ) const;
+    size_t size() const;
+    char *pack( char *ptr ) const;
+    const char *unpack( const char *ptr, const char *end );
+
+private:
+    std::map<uint64_t, count_struct> d_counts;
+};
+
+
+// Raw call stacks (module relative addresses) for each unique call stack (fingerprint)
+class stack_frames
+{
+public:
+    using frame_key = std::array<uint64_t, 3>; // Module id, build id, offset
+    //! Add the raw call stack for a thread, returning the fingerprint
+    uint64_t add( const void *const *stack, size_t N );
+    //! Add the raw call stacks from another rank
+    void add( const stack_frames &rhs );
+    //! Check if the raw call stack is known
+    bool contains( uint64_t fingerprint ) const { return d_frames.count( fingerprint ) > 0; }
+    //! Return the number of call stacks
+    size_t count() const { return d_frames.size(); }
+    //! Get the raw call stacks for the given fingerprints
+    stack_frames subset( const std::vector<uint64_t> &fingerprints ) const;
+    //! Resolve the call stacks (symbols that are not in the cache are added)
+    StackTrace::multi_stack_info
+    resolve( const stack_counts &counts, std::map<frame_key, StackTrace::stack_info> &cache ) const;
+    void clear();
+    size_t size() const;
+    char *pack( char *ptr ) const;
+    const char *unpack( const char *ptr, const char *end );
+
+private:
+    std::map<uint64_t, std::vector<uint64_t>> d_frames; // Frames (module, build, offset)
+    std::map<uint64_t, std::string> d_modules;          // Name of each module
+};
+
+
+// Results for a local request (shared by the monitor thread and the caller)
+struct local_result {
+    std::mutex mutex;
+    std::condition_variable condition;
+    StackTrace::global_stack_info data;
+    stack_counts counts;
+    stack_frames frames;
+    bool updated  = false;
+    bool finished = false;
+};
+
+
+// Reduction in progress (only accessed by the monitor thread)
+using subtree_id = std::pair<uint64_t, uint64_t>; // Key for a subtree and id of cached results
+struct reduction_struct {
+    uint64_t id = 0;                             // Id of the request
+    int parent  = -1;                            // Rank to send the results to (-1 if local)
+    double wait = 0;                             // Minimum time to wait after a reply
+    steady_clock::time_point start;              // Time the reduction started
+    steady_clock::time_point timeout;            // Maximum time for the reduction
+    steady_clock::time_point deadline;           // Current deadline (adapts to the replies)
+    std::map<int, StackTrace::RankSet> waiting;  // Children (and their ranks) not replied
+    bool raw = false;                            // Merge the fingerprints of the call stacks
+    StackTrace::global_stack_info result;        // Merged results
+    stack_counts counts;                         // Merged call stack counts (if raw)
+    std::map<int, int> pending;                  // Requests for raw call stacks (by rank)
+    std::vector<uint64_t> requested;             // Fingerprints requested (sorted)
+    uint64_t key  = 0;                           // Key for the subtree (root and ranks)
+    uint64_t base = NO_BASE;                     // Id of the results cached by the parent
+    std::map<int, subtree_id> subtrees;          // Key and cached id for each child
+    std::shared_ptr<local_result> local;         // Results for a local request
+};
+
+
+// Message being sent (the buffer must be kept until the send completes)
+struct send_struct {
+    MPI_Request request;
+    std::vector<char> data;
+};
+
+
+// Local requests waiting to be started by the monitor thread
+struct local_request {
+    request_header header;
+    std::vector<int> ranks;
+    std::shared_ptr<local_result> result;
+};
+static std::mutex localRequestMutex;
+static std::condition_variable localRequestCondition;
+static std::vector<std::unique_ptr<local_request>> localRequests;
+static std::atomic<uint32_t> requestCounter( 0 );
+
+
+// Raw call stacks (only accessed by the monitor thread)
+struct saved_frames {
+    steady_clock::time_point expire;
+    stack_frames frames;
+};
+static stack_frames rootFrames; // Raw call stacks known by this rank as the root
+static std::map<uint64_t, saved_frames> savedFrames; // Raw call stacks for this rank (by id)
+
+
+// Merged call stack counts for a subtree (only accessed by the monitor thread)
+struct cached_counts {
+    uint64_t id   = NO_BASE;     // Id of the request with the results
+    uint64_t used = 0;           // Last time the results were used (for eviction)
+    StackTrace::RankSet missing; // Missing ranks
+    stack_counts counts;         // Merged call stack counts
+};
+static std::map<uint64_t, cached_counts> receivedCounts; // Results received (by subtree key)
+static std::map<uint64_t, cached_counts> sentCounts;     // Results sent (by subtree key)
+static uint64_t countsUsed = 0;                          // Counter for cached_counts::used
+
+
+// Symbols for the raw call stacks (shared by the requests from this rank)
+static std::mutex symbolMutex;
+static std::map<stack_frames::frame_key, StackTrace::stack_info> symbolCache;
+#endif
+static StackTrace::symbolizeType globalSymbolizeType = StackTrace::symbolizeType::root;
+#ifdef STACKTRACE_USE_MPI
+
+
+/****************************************************************************
+ *  Raw call stacks                                                          *
+ ****************************************************************************/
+template<class TYPE>
+static inline char *packValue( char *ptr, const TYPE &x )
+{
+    memcpy( ptr, &x, sizeof( TYPE ) );
+    return ptr + sizeof( TYPE );
+}
+// Unpack a value from [ptr,end), returning nullptr if there is not enough data
+template<class TYPE>
+static inline const char *unpackValue( const char *ptr, const char *end, TYPE &x )
+{
+    if ( !ptr || end - ptr < static_cast<ptrdiff_t>( sizeof( TYPE ) ) )
+        return nullptr;
+    memcpy( &x, ptr, sizeof( TYPE ) );
+    return ptr + sizeof( TYPE );
+}
+void stack_counts::add( uint64_t fingerprint, int count, const StackTrace::RankSet &ranks )
+{
+    auto &data = d_counts[fingerprint];
+    data.count += count;
+    data.ranks.insert( ranks );
+}
+void stack_counts::add( const stack_counts &rhs )
+{
+    for ( const auto &[fingerprint, data] : rhs.d_counts )
+        add( fingerprint, data.count, data.ranks );
+}
+bool stack_counts::operator==( const stack_counts &rhs ) const
+{
+    if ( d_counts.size() != rhs.d_counts.size() )
+        return false;
+    for ( auto it1 = d_counts.begin(), it2 = rhs.d_counts.begin(); it1 != d_counts.end();
+          ++it1, ++it2 ) {
+        if ( it1->first != it2->first || it1->second.count != it2->second.count ||
+             it1->second.ranks != it2->second.ranks )
+            return false;
+    }
+    return true;
+}
+size_t stack_counts::size() const
+{
+    size_t bytes = sizeof( int );
+    for ( const auto &[fingerprint, data] : d_counts )
+        bytes += sizeof( uint64_t ) + sizeof( int ) + data.ranks.size();
+    return bytes;
+}
+char *stack_counts::pack( char *ptr ) const
+{
+    ptr = packValue<int>( ptr, d_counts.size() );
+    for ( const auto &[fingerprint, data] : d_counts ) {
+        ptr = packValue( ptr, fingerprint );
+        ptr = packValue( ptr, data.count );
+        ptr = data.ranks.pack( ptr );
+    }
+    return ptr;
+}
+const char *stack_counts::unpack( const char *ptr, const char *end )
+{
+    d_counts.clear();
+    int N = 0;
+    ptr   = unpackValue( ptr, end, N );
+    for ( int i = 0; i < N && ptr; i++ ) {
+        uint64_t fingerprint = 0;
+        count_struct data;
+        ptr                   = unpackValue( ptr, end, fingerprint );
+        ptr                   = unpackValue( ptr, end, data.count );
+        ptr                   = ptr ? data.ranks.unpack( ptr, end ) : nullptr;
+        if ( ptr )
+            d_counts[fingerprint] = std::move( data );
+    }
+    if ( !ptr )
+        d_counts.clear();
+    return ptr;
+}
+uint64_t stack_frames::add( const void *const *stack, size_t N )
+{
+    auto fingerprint = StackTrace::fingerprint( stack, N );
+    if ( contains( fingerprint ) )
+        return fingerprint;
+    std::vector<StackTrace::module_address> address( N );
+    StackTrace::getModuleAddress( stack, N, address.data() );
+    std::vector<uint64_t> key( 3 * N );
+    for ( size_t i = 0; i < N; i++ ) {
+        key[3 * i + 0] = address[i].module;
+        key[3 * i + 1] = address[i].build;
+        key[3 * i + 2] = address[i].offset;
+        if ( address[i].module != 0 && d_modules.find( address[i].module ) == d_modules.end() )
+            d_modules[address[i].module] = StackTrace::getModuleName( address[i].module );
+    }
+    d_frames[fingerprint] = std::move( key );
+    return fingerprint;
+}
+void stack_frames::add( const stack_frames &rhs )
+{
+    d_frames.insert( rhs.d_frames.begin(), rhs.d_frames.end() );
+    d_modules.insert( rhs.d_modules.begin(), rhs.d_modules.end() );
+}
+stack_frames stack_frames::subset( const std::vector<uint64_t> &fingerprints ) const
+{
+    stack_frames data;
+    for ( auto fingerprint : fingerprints ) {
+        auto it = d_frames.find( fingerprint );
+        if ( it == d_frames.end() )
+            continue;
+        data.d_frames.insert( *it );
+        for ( size_t i = 0; i < it->second.size(); i += 3 ) {
+            auto it2 = d_modules.find( it->second[i] );
+            if ( it2 != d_modules.end() )
+                data.d_modules.insert( *it2 );
+        }
+    }
+    return data;
+}
+StackTrace::multi_stack_info
+stack_frames::resolve( const stack_counts &counts,
+                       std::map<frame_key, StackTrace::stack_info> &cache ) const
+{
+    // Get the unique frames that have not been resolved
+    std::vector<frame_key> frames;
+    for ( const auto &[fingerprint, data] : counts.data() ) {
+        auto it = d_frames.find( fingerprint );
+        if ( it == d_frames.end() )
+            continue;
+        const auto &key = it->second;
+        for ( size_t i = 0; i < key.size(); i += 3 ) {
+            frame_key frame = { key[i], key[i + 1], key[i + 2] };
+            if ( cache.find( frame ) == cache.end() )
+                frames.push_back( frame );
+        }
+    }
+    std::sort( frames.begin(), frames.end() );
+    frames.erase( std::unique( frames.begin(), frames.end() ), frames.end() );
+    // Resolve the frames for objects that are loaded in this process (all at once)
+    std::vector<void *> addresses;
+    std::vector<frame_key> resolved;
+    for ( const auto &frame : frames ) {
+        void *ptr = StackTrace::getLocalAddress( { frame[0], frame[1], frame[2] } );
+        if ( ptr ) {
+            addresses.push_back( ptr );
+            resolved.push_back( frame );
+        } else {
+            // The object is not loaded in this process (only the object and offset are known)
+            StackTrace::stack_info info;
+            auto it      = d_modules.find( frame[0] );
+            auto name    = it == d_modules.end() ? std::string() : it->second;
+            name         = name.substr( name.find_last_of( '/' ) + 1 );
+            info.address = info.address2 = reinterpret_cast<void *>( frame[2] );
+            strncpy( info.object.data(), name.data(), info.object.size() - 1 );
+            cache[frame] = info;
+        }
+    }
+    auto info = StackTrace::getStackInfo( addresses );
+    for ( size_t i = 0; i < resolved.size(); i++ )
+        cache[resolved[i]] = info[i];
+    // Create the call stacks (the frames are unknown if no rank with the call stack replied)
+    StackTrace::multi_stack_info multistack;
+    std::vector<StackTrace::stack_info> stack;
+    for ( const auto &[fingerprint, data] : counts.data() ) {
+        auto it = d_frames.find( fingerprint );
+        if ( it == d_frames.end() ) {
+            stack.resize( 1 );
+            stack[0].clear();
+            stack[0].address = stack[0].address2 = reinterpret_cast<void *>( fingerprint );
+            snprintf( stack[0].function.data(), stack[0].function.size(),
+                      "unresolved call stack (%016llx)",
+                      static_cast<unsigned long long>( fingerprint ) );
+        } else {
+            const auto &key = it->second;
+            stack.resize( key.size() / 3 );
+            for ( size_t i = 0; i < stack.size(); i++ )
+                stack[i] = cache[{ key[3 * i], key[3 * i + 1], key[3 * i + 2] }];
+        }
+        multistack.N += data.count;
+        multistack.ranks.insert( data.ranks );
+        multistack.add( stack.size(), stack.data(), data.count, data.ranks );
+    }
+    return multistack;
+}
+void stack_frames::clear()
+{
+    d_frames.clear();
+    d_modules.clear();
+}
+size_t stack_frames::size() const
+{
+    size_t bytes = 2 * sizeof( int );
+    for ( const auto &[fingerprint, key] : d_frames )
+        bytes += sizeof( uint64_t ) + sizeof( int ) + key.size() * sizeof( uint64_t );
+    for ( const auto &[id, name] : d_modules )
+        bytes += sizeof( uint64_t ) + sizeof( int ) + name.size();
+    return bytes;
+}
+char *stack_frames::pack( char *ptr ) const
+{
+    ptr = packValue<int>( ptr, d_frames.size() );
+    for ( const auto &[fingerprint, key] : d_frames ) {
+        ptr = packValue( ptr, fingerprint );
+        ptr = packValue<int>( ptr, key.size() );
+        memcpy( ptr, key.data(), key.size() * sizeof( uint64_t ) );
+        ptr += key.size() * sizeof( uint64_t );
+    }
+    ptr = packValue<int>( ptr, d_modules.size() );
+    for ( const auto &[id, name] : d_modules ) {
+        ptr = packValue( ptr, id );
+        ptr = packValue<int>( ptr, name.size() );
+        memcpy( ptr, name.data(), name.size() );
+        ptr += name.size();
+    }
+    return ptr;
+}
+const char *stack_frames::unpack( const char *ptr, const char *end )
+{
+    clear();
+    int N_frames = 0, N_modules = 0;
+    ptr = unpackValue( ptr, end, N_frames );
+    for ( int i = 0; i < N_frames && ptr; i++ ) {
+        uint64_t fingerprint = 0;
+        int N                = 0;
+        ptr                  = unpackValue( ptr, end, fingerprint );
+        ptr                  = unpackValue( ptr, end, N );
+        // The key has 3 values for each frame (module, build, offset)
+        size_t N_max = ptr ? ( end - ptr ) / sizeof( uint64_t ) : 0;
+        if ( !ptr || N < 0 || N % 3 != 0 || static_cast<size_t>( N ) > N_max ) {
+            ptr = nullptr;
+            break;
+        }
+        std::vector<uint64_t> key( N );
+        memcpy( key.data(), ptr, N * sizeof( uint64_t ) );
+        ptr += N * sizeof( uint64_t );
+        d_frames[fingerprint] = std::move( key );
+    }
+    ptr = unpackValue( ptr, end, N_modules );
+    for ( int i = 0; i < N_modules && ptr; i++ ) {
+        uint64_t id = 0;
+        int N       = 0;
+        ptr         = unpackValue( ptr, end, id );
+        ptr         = unpackValue( ptr, end, N );
+        if ( !ptr || N < 0 || end - ptr < N ) {
+            ptr = nullptr;
+            break;
+        }
+        d_modules[id] = std::string( ptr, N );
+        ptr += N;
+    }
+    if ( !ptr )
+        clear();
+    return ptr;
+}
+
+
+/****************************************************************************
+ *  Socket transport                                                         *
+ *  Used if MPI does not provide MPI_THREAD_MULTIPLE (the monitor thread     *
+ *  cannot call MPI).  Each rank listens on a Unix domain socket (used by    *
+ *  the ranks on the same node) and a TCP socket (used by the ranks on other *
+ *  nodes, only opened if there is more than one node).  The addresses are   *
+ *  exchanged by globalCallStackInitialize on the calling thread.  The       *
+ *  sockets are non-blocking and the monitor thread waits for them with      *
+ *  poll (a pipe wakes it for local requests), and each message is prefixed  *
+ *  by a header with the source rank, tag and size.                          *
+ *  Note: the sockets can be reached by other processes so each header also  *
+ *    contains a random token for the job (shared with MPI_Bcast).  A        *
+ *    connection is closed if a header is invalid or if it does not send a   *
+ *    valid header in time, the header is checked before the rest of the     *
+ *    message is read, and the source rank cannot change on a connection.    *
+ *    Unix domain connections must also be from the same user.               *
+ ****************************************************************************/
+#ifdef USE_SOCKETS
+static constexpr uint64_t MAX_MESSAGE = 0x40000000; // Max size of a message (bytes)
+static constexpr size_t READ_SIZE     = 0x10000;    // Max bytes to read at once
+static constexpr auto AUTH_TIMEOUT    = std::chrono::seconds( 10 ); // Time to send a header
+struct socket_address {
+    uint32_t ip;                                 // IPv4 address (network byte order)
+    uint16_t port;                               // TCP port (network byte order)
+    char path[sizeof( sockaddr_un::sun_path )]; // Name of the Unix domain socket
+};
+struct socket_header {
+    uint64_t token[2]; // Token for the job
+    int source;        // Rank that sent the message
+    int tag;           // Tag of the message
+    uint64_t size;     // Size of the message (bytes)
+};
+struct socket_connection {
+    int fd        = -1;
+    int source    = -1;                // Rank that sent the messages (incoming connections)
+    size_t offset = 0;                 // Bytes sent (outgoing connections)
+    steady_clock::time_point accepted; // Time the connection was accepted
+    std::vector<char> buf;             // Data to send or data received
+};
+static int socketListen[2]     = { -1, -1 };        // Unix domain and TCP sockets
+static uint64_t socketToken[2] = { 0, 0 };          // Token for the job
+static int socketWake[2]       = { -1, -1 };        // Pipe to wake the monitor thread
+static std::vector<socket_address> socketAddress;  // Address of each rank
+static std::map<int, socket_connection> socketOut; // Outgoing connections (by rank)
+static std::list<socket_connection> socketIn;      // Incoming connections
+static bool retrySocket()
+{
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR || errno == EINPROGRESS ||
+           errno == ENOTCONN;
+}
+static int openSocket( int domain )
+{
+    int fd = socket( domain, SOCK_STREAM, 0 );
+    if ( fd < 0 )
+        return -1;
+    fcntl( fd, F_SETFL, fcntl( fd, F_GETFL ) | O_NONBLOCK );
+#ifdef SO_NOSIGPIPE
+    int one = 1;
+    setsockopt( fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof( one ) );
+#endif
+    return fd;
+}
+static int sendSocket( int fd, const char *data, size_t bytes )
+{
+#ifdef MSG_NOSIGNAL
+    return send( fd, data, bytes, MSG_NOSIGNAL );
+#else
+    return send( fd, data, bytes, 0 );
+#endif
+}
+// Get the address of the Unix domain socket (Linux uses the abstract namespace so no file
+// is created)
+static socklen_t getUnixAddress( const char *name, sockaddr_un &addr )
+{
+    memset( &addr, 0, sizeof( addr ) );
+    addr.sun_family = AF_UNIX;
+    size_t N        = std::min( strlen( name ), sizeof( addr.sun_path ) - 2 );
+#ifdef USE_LINUX
+    memcpy( &addr.sun_path[1], name, N );
+    return offsetof( sockaddr_un, sun_path ) + 1 + N;
+#else
+    memcpy( addr.sun_path, name, N );
+    return sizeof( addr );
+#endif
+}
+// Get the IPv4 address of this host
+static uint32_t getHostAddress()
+{
+    char name[256] = { 0 };
+    gethostname( name, sizeof( name ) - 1 );
+    addrinfo hints;
+    memset( &hints, 0, sizeof( hints ) );
+    hints.ai_family   = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo *info    = nullptr;
+    uint32_t ip       = htonl( INADDR_LOOPBACK );
+    if ( getaddrinfo( name, nullptr, &hints, &info ) != 0 )
+        return ip;
+    for ( auto ptr = info; ptr; ptr = ptr->ai_next ) {
+        auto ip2 = reinterpret_cast<sockaddr_in *>( ptr->ai_addr )->sin_addr.s_addr;
+        if ( ( ntohl( ip2 ) >> 24 ) != 127 ) {
+            ip = ip2;
+            break;
+        }
+    }
+    freeaddrinfo( info );
+    return ip;
+}
+static void closeSockets()
+{
+    for ( auto &fd : socketListen ) {
+        if ( fd >= 0 )
+            close( fd );
+        fd = -1;
+    }
+    for ( auto &[rank, con] : socketOut ) {
+        if ( con.fd >= 0 )
+            close( con.fd );
+    }
+    for ( auto &con : socketIn )
+        close( con.fd );
+    for ( auto &fd : socketWake ) {
+        if ( fd >= 0 )
+            close( fd );
+        fd = -1;
+    }
+#ifndef USE_LINUX
+    if ( !socketAddress.empty() )
+        unlink( socketAddress[globalRank].path );
+#endif
+    socketOut.clear();
+    socketIn.clear();
+    socketAddress.clear();
+    socketToken[0] = 0;
+    socketToken[1] = 0;
+}
+// Open the sockets and exchange the addresses (collective over comm)
+static bool openSockets( MPI_Comm comm )
+{
+    // Create the token for the job
+    if ( globalRank == 0 ) {
+        std::random_device rd;
+        for ( auto &token : socketToken )
+            token = ( static_cast<uint64_t>( rd() ) << 32 ) ^ rd();
+    }
+    MPI_Bcast( socketToken, 2, MPI_UINT64_T, 0, comm );
+    // Open the sockets
+    socket_address address;
+    memset( &address, 0, sizeof( address ) );
+    auto time = steady_clock::now().time_since_epoch().count();
+#ifdef USE_LINUX
+    const char *prefix = "";
+#else
+    const char *prefix = "/tmp/";
+#endif
+    snprintf( address.path, sizeof( address.path ), "%sStackTrace.%i.%i.%llx", prefix,
+              static_cast<int>( getpid() ), globalRank, static_cast<unsigned long long>( time ) );
+    sockaddr_un addr;
+    auto len        = getUnixAddress( address.path, addr );
+    socketListen[0] = openSocket( AF_UNIX );
+    bool error      = socketListen[0] < 0 || pipe( socketWake ) != 0;
+    for ( int fd : socketWake ) {
+        if ( fd >= 0 )
+            fcntl( fd, F_SETFL, fcntl( fd, F_GETFL ) | O_NONBLOCK );
+    }
+    error = error || bind( socketListen[0], reinterpret_cast<sockaddr *>( &addr ), len ) != 0;
+    error = error || listen( socketListen[0], 128 ) != 0;
+    if ( globalNodeId.back() != 0 ) {
+        // There is more than one node (open the TCP socket on the address we send to the
+        // other ranks)
+        address.ip = getHostAddress();
+        sockaddr_in addr2;
+        memset( &addr2, 0, sizeof( addr2 ) );
+        addr2.sin_family      = AF_INET;
+        addr2.sin_addr.s_addr = address.ip;
+        socklen_t len2        = sizeof( addr2 );
+        socketListen[1]       = openSocket( AF_INET );
+        error                 = error || socketListen[1] < 0;
+        error = error || bind( socketListen[1], reinterpret_cast<sockaddr *>( &addr2 ), len2 ) != 0;
+        error = error || listen( socketListen[1], 128 ) != 0;
+        error = error || getsockname( socketListen[1], reinterpret_cast<sockaddr *>( &addr2 ),
+                                      &len2 ) != 0;
+        address.port = addr2.sin_port;
+    }
+    int failed = error ? 1 : 0;
+    MPI_Allreduce( MPI_IN_PLACE, &failed, 1, MPI_INT, MPI_MAX, comm );
+    if ( failed ) {
+        closeSockets();
+        return false;
+    }
+    socketAddress.resize( globalSize );
+    MPI_Allgather( &address, sizeof( address ), MPI_BYTE, socketAddress.data(),
+                   sizeof( address ), MPI_BYTE, comm );
+    return true;
+}
+// Connect to a rank (if not already connected)
+static socket_connection &connectSocket( int rank )
+{
+    auto &con = socketOut[rank];
+    if ( con.fd >= 0 )
+        return con;
+    const auto &address = socketAddress[rank];
+    int err             = -1;
+    if ( globalNodeId[rank] == globalNodeId[globalRank] ) {
+        sockaddr_un addr;
+        auto len = getUnixAddress( address.path, addr );
+        con.fd   = openSocket( AF_UNIX );
+        if ( con.fd >= 0 )
+            err = connect( con.fd, reinterpret_cast<sockaddr *>( &addr ), len );
+    } else {
+        sockaddr_in addr;
+        memset( &addr, 0, sizeof( addr ) );
+        addr.sin_family      = AF_INET;
+        addr.sin_addr.s_addr = address.ip;
+        addr.sin_port        = address.port;
+        con.fd               = openSocket( AF_INET );
+        if ( con.fd >= 0 )
+            err = connect( con.fd, reinterpret_cast<sockaddr *>( &addr ), sizeof( addr ) );
+    }
+    if ( con.fd >= 0 && err != 0 && errno != EINPROGRESS ) {
+        close( con.fd );
+        con.fd = -1;
+    }
+    return con;
+}
+// Send a message (the message is dropped if the rank cannot be reached; the reduction
+// treats the rank as missing)
+static void socketSend( int rank, int tag, const std::vector<char> &data )
+{
+    auto &con = connectSocket( rank );
+    if ( con.fd < 0 )
+        return;
+    socket_header header = { { socketToken[0], socketToken[1] }, globalRank, tag, data.size() };
+    auto ptr             = reinterpret_cast<const char *>( &header );
+    con.buf.insert( con.buf.end(), ptr, ptr + sizeof( header ) );
+    con.buf.insert( con.buf.end(), data.begin(), data.end() );
+}
+// Send any queued data, returning true if there is data left to send
+static bool socketFlush()
+{
+    bool pending = false;
+    for ( auto &[rank, con] : socketOut ) {
+        while ( con.fd >= 0 && con.offset < con.buf.size() ) {
+            auto N = sendSocket( con.fd, &con.buf[con.offset], con.buf.size() - con.offset );
+            if ( N > 0 ) {
+                con.offset += N;
+            } else if ( retrySocket() ) {
+                break;
+            } else {
+                // The connection failed (drop the data and reconnect on the next send)
+                close( con.fd );
+                con.fd = -1;
+                con.buf.clear();
+                con.offset = 0;
+            }
+        }
+        if ( con.offset == con.buf.size() ) {
+            con.buf.clear();
+            con.offset = 0;
+        }
+        pending = pending || !con.buf.empty();
+    }
+    return pending;
+}
+// Check that the peer of a Unix domain socket is the same user
+static bool sameUser( int fd )
+{
+#ifdef SO_PEERCRED
+    ucred cred;
+    socklen_t len = sizeof( cred );
+    return getsockopt( fd, SOL_SOCKET, SO_PEERCRED, &cred, &len ) == 0 && cred.uid == geteuid();
+#else
+    uid_t uid;
+    gid_t gid;
+    return getpeereid( fd, &uid, &gid ) == 0 && uid == geteuid();
+#endif
+}
+// Accept any new connections (closing the connections that have not sent a valid header)
+static void socketAccept()
+{
+    auto now = steady_clock::now();
+    for ( int i = 0; i < 2; i++ ) {
+        int fd = socketListen[i];
+        for ( int fd2 = fd < 0 ? -1 : accept( fd, nullptr, nullptr ); fd2 >= 0;
+              fd2     = accept( fd, nullptr, nullptr ) ) {
+            if ( i == 0 && !sameUser( fd2 ) ) {
+                close( fd2 );
+                continue;
+            }
+            fcntl( fd2, F_SETFL, fcntl( fd2, F_GETFL ) | O_NONBLOCK );
+            socketIn.emplace_back();
+            socketIn.back().fd       = fd2;
+            socketIn.back().accepted = now;
+        }
+    }
+    for ( auto &con : socketIn ) {
+        if ( con.fd >= 0 && con.source < 0 && now - con.accepted > AUTH_TIMEOUT ) {
+            close( con.fd );
+            con.fd = -1;
+        }
+    }
+}
+// Check the header of a message
+static bool validHeader( const socket_header &header, const socket_connection &con )
+{
+    uint64_t diff = ( header.token[0] ^ socketToken[0] ) | ( header.token[1] ^ socketToken[1] );
+    bool token    = diff == 0;
+    return token && header.source >= 0 && header.source < globalSize &&
+           header.size <= MAX_MESSAGE && ( con.source < 0 || con.source == header.source );
+}
+// Read the next message from a connection, returning true if the message is complete
+// (only the bytes for the current message are read)
+static bool socketRead( socket_connection &con )
+{
+    while ( con.fd >= 0 ) {
+        size_t bytes = sizeof( socket_header );
+        if ( con.buf.size() >= bytes ) {
+            socket_header header;
+            memcpy( &header, con.buf.data(), sizeof( header ) );
+            if ( !validHeader( header, con ) ) {
+                // Invalid message (close the connection)
+                close( con.fd );
+                con.fd = -1;
+                con.buf.clear();
+                return false;
+            }
+            con.source = header.source;
+            bytes += header.size;
+        }
+        size_t offset = con.buf.size();
+        if ( offset == bytes )
+            return true;
+        con.buf.resize( std::min( bytes, offset + READ_SIZE ) );
+        auto N = recv( con.fd, &con.buf[offset], con.buf.size() - offset, 0 );
+        con.buf.resize( offset + std::max<ssize_t>( N, 0 ) );
+        if ( N <= 0 ) {
+            if ( N == 0 || !retrySocket() ) {
+                close( con.fd );
+                con.fd = -1;
+            }
+            return false;
+        }
+    }
+    return false;
+}
+// Check if there are connections that have not sent a header (they are closed after
+// AUTH_TIMEOUT so the monitor thread must wake to check them)
+static bool socketUnauthenticated()
+{
+    for ( const auto &con : socketIn ) {
+        if ( con.fd >= 0 && con.source < 0 )
+            return true;
+    }
+    return false;
+}
+// Wake the monitor thread if it is waiting in socketWait
+static void socketWakeup()
+{
+    if ( socketWake[1] >= 0 ) {
+        char c                  = 0;
+        [[maybe_unused]] auto N = write( socketWake[1], &c, 1 );
+    }
+}
+// Wait until a socket is ready, the monitor thread is woken, or the timeout expires
+// (a negative timeout waits without a limit)
+static void socketWait( std::chrono::microseconds timeout )
+{
+    std::vector<pollfd> fds;
+    fds.push_back( { socketWake[0], POLLIN, 0 } );
+    for ( int fd : socketListen ) {
+        if ( fd >= 0 )
+            fds.push_back( { fd, POLLIN, 0 } );
+    }
+    for ( const auto &con : socketIn ) {
+        if ( con.fd >= 0 )
+            fds.push_back( { con.fd, POLLIN, 0 } );
+    }
+    for ( const auto &[rank, con] : socketOut ) {
+        if ( con.fd >= 0 && !con.buf.empty() )
+            fds.push_back( { con.fd, POLLOUT, 0 } );
+    }
+    int ms = timeout.count() < 0 ? -1 : static_cast<int>( ( timeout.count() + 999 ) / 1000 );
+    poll( fds.data(), fds.size(), ms );
+    char buf[64];
+    while ( read( socketWake[0], buf, sizeof( buf ) ) > 0 ) {}
+}
+// Get the next message that has been received
+static bool socketRecv( int &source, int &tag, std::vector<char> &data )
+{
+    socketAccept();
+    for ( auto it = socketIn.begin(); it != socketIn.end(); ) {
+        if ( socketRead( *it ) ) {
+            socket_header header;
+            memcpy( &header, it->buf.data(), sizeof( header ) );
+            source = header.source;
+            tag    = header.tag;
+            data.assign( it->buf.begin() + sizeof( header ), it->buf.end() );
+            it->buf.clear();
+            return true;
+        }
+        it = it->fd < 0 ? socketIn.erase( it ) : std::next( it );
+    }
+    return false;
+}
+#endif
+
+
+/****************************************************************************
+ *  Helper functions                                                         *
+ ****************************************************************************/
+static bool MPI_Active()
+{
+    int initialized = 0, finalized = 0;
+    MPI_Initialized( &initialized );
+    MPI_Finalized( &finalized );
+    return initialized != 0 && finalized == 0;
+}
+static void sendMessage( std::list<send_struct> &sends, int rank, int tag, std::vector<char> data )
+{
+#ifdef USE_SOCKETS
+    if ( globalUseSockets ) {
+        socketSend( rank, tag, data );
+        return;
+    }
+#endif
+    sends.emplace_back();
+    auto &send = sends.back();
+    send.data  = std::move( data );
+    MPI_Isend( send.data.data(), send.data.size(), MPI_CHAR, rank, tag,
+               globalCommForGlobalCommStack, &send.request );
+}
+// Test the sends, returning true if any sends are still in progress
+static bool testSends( std::list<send_struct> &sends )
+{
+#ifdef USE_SOCKETS
+    if ( globalUseSockets )
+        return socketFlush();
+#endif
+    for ( auto it = sends.begin(); it != sends.end(); ) {
+        int flag = 0;
+        MPI_Test( &it->request, &flag, MPI_STATUS_IGNORE );
+        it = flag ? sends.erase( it ) : std::next( it );
+    }
+    return !sends.empty();
+}
+static std::vector<char> packRequest( const request_header &header, const int *ranks )
+{
+    std::vector<char> data( sizeof( header ) + header.N * sizeof( int ) );
+    memcpy( data.data(), &header, sizeof( header ) );
+    memcpy( &data[sizeof( header )], ranks, header.N * sizeof( int ) );
+    return data;
+}
+static std::vector<char> packReply( const reduction_struct &reduction )
+{
+    reply_header header = { reduction.id };
+    const auto &result  = reduction.result;
+    size_t bytes        = reduction.raw ? reduction.counts.size() : result.stack.size();
+    std::vector<char> data( sizeof( header ) + result.missing.size() + bytes );
+    memcpy( data.data(), &header, sizeof( header ) );
+    auto ptr = result.missing.pack( &data[sizeof( header )] );
+    if ( reduction.raw )
+        reduction.counts.pack( ptr );
+    else
+        result.stack.pack( ptr );
+    return data;
+}
+static std::vector<char> packFrames( uint64_t id, const stack_frames &frames )
+{
+    reply_header header = { id };
+    std::vector<char> data( sizeof( header ) + frames.size() );
+    memcpy( data.data(), &header, sizeof( header ) );
+    frames.pack( &data[sizeof( header )] );
+    return data;
+}
+static steady_clock::time_point addTime( steady_clock::time_point t0, double dt )
+{
+    return t0 + std::chrono::duration_cast<steady_clock::duration>(
+                    std::chrono::duration<double>( dt ) );
+}
+// Receive the next message, returning false if there are no messages
+static bool recvMessage( int &source, int &tag, std::vector<char> &data )
+{
+#ifdef USE_SOCKETS
+    if ( globalUseSockets )
+        return socketRecv( source, tag, data );
+#endif
+    int flag = 0;
+    MPI_Status status;
+    int err =
+        MPI_Iprobe( MPI_ANY_SOURCE, MPI_ANY_TAG, globalCommForGlobalCommStack, &flag, &status );
+    if ( err != MPI_SUCCESS ) {
+        printf( "Internal error in StackTrace::getGlobalCallStacks::runGlobalMonitorThread\n" );
+        globalMonitorThreadStatus = 4;
+        return false;
+    } else if ( flag == 0 ) {
+        return false;
+    }
+    int count = 0;
+    MPI_Get_count( &status, MPI_CHAR, &count );
+    source = status.MPI_SOURCE;
+    tag    = status.MPI_TAG;
+    data.resize( count );
+    MPI_Recv( data.data(), count, MPI_CHAR, source, tag, globalCommForGlobalCommStack,
+              MPI_STATUS_IGNORE );
+    return true;
+}
+
+
+/****************************************************************************
+ *  Run the reduction                                                        *
+ ****************************************************************************/
+// Sort the ranks for a request by node (the root and its node are first)
+static std::vector<int> sortRanks( int root, std::vector<int> ranks )
+{
+    int size = globalSize;
+    auto key = [root, size]( int r ) {
+        return std::make_pair( ( globalNodeId[r] - globalNodeId[root] + size ) % size,
+                               ( r - root + size ) % size );
+    };
+    std::sort( ranks.begin(), ranks.end(), [key]( int a, int b ) { return key( a ) < key( b ); } );
+    return ranks;
+}
+// Get the children for a subtree as the range of ranks for each child (largest first).
+// The ranks are grouped by node with this rank first.  The ranks on this node form a
+// binomial tree (child m gets ranks [m,2m)) and the other nodes form a binomial tree over
+// the nodes (child m gets nodes [m,2m)), so only one rank per node talks to other nodes.
+static std::vector<std::pair<int, int>> getChildren( const int *ranks, int N )
+{
+    std::vector<int> start;
+    for ( int i = 0; i < N; i++ ) {
+        if ( i == 0 || globalNodeId[ranks[i]] != globalNodeId[ranks[i - 1]] )
+            start.push_back( i );
+    }
+    int N_nodes = start.size();
+    start.push_back( N );
+    std::vector<std::pair<int, int>> children;
+    for ( int m = 1; m < N_nodes; m *= 2 )
+        children.emplace_back( start[m], start[std::min( 2 * m, N_nodes )] - start[m] );
+    for ( int m = 1; m < start[1]; m *= 2 )
+        children.emplace_back( m, std::min( 2 * m, start[1] ) - m );
+    auto compare = []( auto a, auto b ) { return a.second > b.second; };
+    std::stable_sort( children.begin(), children.end(), compare );
+    return children;
+}
+// Get the key for a subtree (the root and the ranks in the subtree)
+static uint64_t subtreeKey( int root, const int *ranks, int N )
+{
+    uint64_t key = 0xcbf29ce484222325;
+    auto hash    = [&key]( int x ) { key = ( key ^ static_cast<uint32_t>( x ) ) * 0x100000001b3; };
+    hash( root );
+    for ( int i = 0; i < N; i++ )
+        hash( ranks[i] );
+    return key;
+}
+// Start the reduction for a subtree: forward the request to the children and get the
+// local call stacks
+static void startReduction( reduction_struct &data, const request_header &header,
+                            const int *ranks, std::list<send_struct> &sends )
+{
+    int rank      = globalRank;
+    data.id       = header.id;
+    data.wait     = header.wait;
+    data.raw      = header.raw;
+    data.start    = steady_clock::now();
+    data.timeout  = addTime( data.start, header.timeout );
+    data.deadline = std::min( data.timeout, addTime( data.start, header.wait ) );
+    data.key      = subtreeKey( header.root, ranks, header.N );
+    data.base     = header.base;
+    if ( sentCounts.size() > MAX_DELTAS )
+        sentCounts.clear(); // The parent will get the full results
+    // Forward the request to the children (reserving time for this level)
+    for ( auto [i, N] : getChildren( ranks, header.N ) ) {
+        auto key   = subtreeKey( header.root, &ranks[i], N );
+        auto cache = receivedCounts.find( key );
+        bool found = data.raw && cache != receivedCounts.end();
+        if ( found )
+            cache->second.used = ++countsUsed;
+        request_header header2  = header;
+        header2.N               = N;
+        header2.timeout         = std::max( header.timeout - LEVEL_TIME, LEVEL_TIME );
+        header2.wait            = 0.8 * header.wait;
+        header2.base            = found ? cache->second.id : NO_BASE;
+        data.subtrees[ranks[i]] = subtree_id( key, header2.base );
+        sendMessage( sends, ranks[i], REQUEST_TAG, packRequest( header2, &ranks[i] ) );
+        std::vector<int> subtree( ranks + i, ranks + i + N );
+        data.waiting[ranks[i]] = StackTrace::RankSet( subtree );
+    }
+    // Get the call stacks for this rank (the requesting rank adds its own, but keeps the
+    // raw call stacks so they do not need to be requested from other ranks)
+    if ( rank == header.root ) {
+        if ( !data.raw )
+            return;
+        if ( rootFrames.count() > MAX_FRAMES )
+            rootFrames.clear();
+        for ( const auto &trace : StackTrace::backtraceAll() )
+            rootFrames.add( trace.data(), trace.size() );
+    } else if ( data.raw ) {
+        auto &saved  = savedFrames[header.id];
+        saved.expire = addTime( data.start, 2 * header.timeout );
+        StackTrace::RankSet ranks( rank );
+        for ( const auto &trace : StackTrace::backtraceAll() )
+            data.counts.add( saved.frames.add( trace.data(), trace.size() ), 1, ranks );
+    } else {
+        data.result.stack = StackTrace::getAllCallStacks();
+        data.result.stack.setRanks( StackTrace::RankSet( rank ) );
+    }
+}
+// Publish the partial results for a local request
+static void publishResults( reduction_struct &data, bool finished )
+{
+    if ( !data.local )
+        return;
+    std::lock_guard<std::mutex> lock( data.local->mutex );
+    data.local->data = data.result;
+    if ( data.raw ) {
+        data.local->counts = data.counts;
+        data.local->frames = rootFrames.subset( data.requested );
+    }
+    for ( const auto &[rank, ranks] : data.waiting )
+        data.local->data.missing.insert( ranks );
+    data.local->updated  = true;
+    data.local->finished = finished;
+    data.local->condition.notify_all();
+}
+// Update the deadline (wait up to twice as long as the replies have taken so far)
+static void updateDeadline( reduction_struct &data )
+{
+    auto now      = steady_clock::now();
+    double time   = std::chrono::duration<double>( now - data.start ).count();
+    data.deadline = std::min( data.timeout, addTime( now, std::max( data.wait, 2 * time ) ) );
+}
+// Request the raw call stacks that are not known from a rank with each call stack
+static void requestFrames( reduction_struct &data, std::list<send_struct> &sends )
+{
+    std::map<int, std::vector<uint64_t>> requests;
+    for ( const auto &[fingerprint, count] : data.counts.data() ) {
+        auto it = std::lower_bound( data.requested.begin(), data.requested.end(), fingerprint );
+        if ( it != data.requested.end() && *it == fingerprint )
+            continue;
+        data.requested.insert( it, fingerprint );
+        if ( !rootFrames.contains( fingerprint ) )
+            requests[count.ranks.ranges()[0].first].push_back( fingerprint );
+    }
+    for ( const auto &[rank, fingerprints] : requests ) {
+        reply_header header = { data.id };
+        std::vector<char> buf( sizeof( header ) + fingerprints.size() * sizeof( uint64_t ) );
+        memcpy( buf.data(), &header, sizeof( header ) );
+        memcpy( &buf[sizeof( header )], fingerprints.data(), buf.size() - sizeof( header ) );
+        sendMessage( sends, rank, FRAMES_TAG, std::move( buf ) );
+        data.pending[rank]++;
+    }
+}
+// Add the raw call stacks from a rank
+static void addFrames( reduction_struct &data, int rank, const char *ptr, const char *end )
+{
+    auto it = data.pending.find( rank );
+    if ( it == data.pending.end() )
+        return;
+    if ( --it->second == 0 )
+        data.pending.erase( it );
+    stack_frames frames;
+    if ( frames.unpack( ptr, end ) )
+        rootFrames.add( frames );
+    updateDeadline( data );
+    publishResults( data, false );
+}
+// Add the results from a child (invalid results are treated as the subtree being missing)
+static void addResults( reduction_struct &data, int child, const char *ptr, const char *end,
+                        std::list<send_struct> &sends )
+{
+    auto it = data.waiting.find( child );
+    if ( it == data.waiting.end() )
+        return;
+    StackTrace::RankSet missing;
+    stack_counts counts;
+    StackTrace::multi_stack_info stack;
+    ptr = missing.unpack( ptr, end );
+    if ( data.raw )
+        ptr = ptr ? counts.unpack( ptr, end ) : nullptr;
+    else
+        ptr = ptr ? stack.unpack( ptr, end ) : nullptr;
+    if ( !ptr )
+        missing = it->second;
+    data.waiting.erase( it );
+    data.result.missing.insert( missing );
+    if ( ptr && data.raw ) {
+        auto &cache   = receivedCounts[data.subtrees[child].first];
+        cache.id      = data.id;
+        cache.used    = ++countsUsed;
+        cache.missing = missing;
+        cache.counts  = std::move( counts );
+        data.counts.add( cache.counts );
+        if ( data.parent < 0 )
+            requestFrames( data, sends );
+    } else if ( ptr ) {
+        data.result.stack.add( stack );
+    }
+    updateDeadline( data );
+    publishResults( data, false );
+}
+// Add the cached results for a child whose results have not changed
+static void addUnchanged( reduction_struct &data, int child, std::list<send_struct> &sends )
+{
+    auto it = data.waiting.find( child );
+    if ( it == data.waiting.end() )
+        return;
+    auto [key, base] = data.subtrees[child];
+    auto it2         = receivedCounts.find( key );
+    if ( it2 == receivedCounts.end() || it2->second.id != base ) {
+        // The cached results are no longer available (the subtree is missing)
+        data.result.missing.insert( it->second );
+    } else {
+        data.result.missing.insert( it2->second.missing );
+        data.counts.add( it2->second.counts );
+        if ( data.parent < 0 )
+            requestFrames( data, sends );
+    }
+    data.waiting.erase( it );
+    updateDeadline( data );
+    publishResults( data, false );
+}
+// Check if the results are the same as the results cached by the parent (updating the
+// results sent to the parent)
+static bool unchangedResults( const reduction_struct &data )
+{
+    auto &sent = sentCounts[data.key];
+    if ( data.base != NO_BASE && sent.id == data.base && sent.missing == data.result.missing &&
+         sent.counts == data.counts )
+        return true;
+    sent.id      = data.id;
+    sent.missing = data.result.missing;
+    sent.counts  = data.counts;
+    return false;
+}
+// Finish the reduction: the children that have not replied are missing
+static void finishReduction( reduction_struct &data, std::list<send_struct> &sends )
+{
+    for ( const auto &[rank, ranks] : data.waiting )
+        data.result.missing.insert( ranks );
+    data.waiting.clear();
+    data.pending.clear();
+    if ( data.parent >= 0 && data.raw && unchangedResults( data ) ) {
+        reply_header header = { data.id };
+        std::vector<char> buf( sizeof( header ) );
+        memcpy( buf.data(), &header, sizeof( header ) );
+        sendMessage( sends, data.parent, UNCHANGED_TAG, std::move( buf ) );
+    } else if ( data.parent >= 0 ) {
+        sendMessage( sends, data.parent, REPLY_TAG, packReply( data ) );
+    } else {
+        publishResults( data, true );
+    }
+}
+// Evict the least recently used results received from the children if there are too many.
+// The results that a pending reduction asked a child to send the changes from are kept
+// (otherwise the unchanged reply would be treated as the subtree being missing).
+static void evictCounts( const std::list<reduction_struct> &reductions )
+{
+    if ( receivedCounts.size() <= MAX_DELTAS )
+        return;
+    std::set<uint64_t> pinned;
+    for ( const auto &reduction : reductions ) {
+        for ( const auto &[child, subtree] : reduction.subtrees ) {
+            if ( subtree.second != NO_BASE && reduction.waiting.count( child ) )
+                pinned.insert( subtree.first );
+        }
+    }
+    std::vector<std::pair<uint64_t, uint64_t>> order;
+    for ( const auto &[key, cache] : receivedCounts ) {
+        if ( pinned.find( key ) == pinned.end() )
+            order.emplace_back( cache.used, key );
+    }
+    std::sort( order.begin(), order.end() );
+    size_t N = std::min( order.size(), receivedCounts.size() - MAX_DELTAS / 2 );
+    for ( size_t i = 0; i < N; i++ )
+        receivedCounts.erase( order[i].second );
+}
+
+/****************************************************************************
+ *  Monitor thread                                                           *
+ ****************************************************************************/
+// Check that a request is valid (the first rank must be this rank and all of the ranks must
+// be in the communicator)
+static bool validRequest( const std::vector<char> &data, request_header &header )
+{
+    if ( data.size() < sizeof( header ) )
+        return false;
+    memcpy( &header, data.data(), sizeof( header ) );
+    uint8_t raw = 0;
+    memcpy( &raw, &data[offsetof( request_header, raw )], sizeof( raw ) );
+    if ( header.N < 1 || header.N > globalSize || header.root < 0 || header.root >= globalSize ||
+         raw > 1 || !std::isfinite( header.timeout ) || !std::isfinite( header.wait ) ||
+         header.timeout < 0 || header.wait < 0 ||
+         data.size() != sizeof( header ) + header.N * sizeof( int ) )
+        return false;
+    std::vector<int> ranks( header.N );
+    memcpy( ranks.data(), &data[sizeof( header )], header.N * sizeof( int ) );
+    for ( int rank : ranks ) {
+        if ( rank < 0 || rank >= globalSize )
+            return false;
+    }
+    return ranks[0] == globalRank;
+}
+// Receive and process any messages, returning true if there were any messages
+// Note: messages that are too short or invalid are ignored
+static bool processMessages( std::list<reduction_struct> &reductions,
+                             std::list<send_struct> &sends )
+{
+    bool activity = false;
+    int source    = -1;
+    int tag       = 0;
+    std::vector<char> data;
+    while ( recvMessage( source, tag, data ) ) {
+        activity = true;
+        if ( tag == REQUEST_TAG ) {
+            // We received a request from our parent
+            request_header header;
+            if ( !validRequest( data, header ) )
+                continue;
+            auto t            = steady_clock::now().time_since_epoch();
+            globalLastRequest = std::chrono::duration_cast<std::chrono::nanoseconds>( t ).count();
+            reductions.emplace_back();
+            reductions.back().parent = source;
+            auto ranks = reinterpret_cast<const int *>( &data[sizeof( header )] );
+            startReduction( reductions.back(), header, ranks, sends );
+            continue;
+        }
+        reply_header header;
+        if ( data.size() < sizeof( header ) )
+            continue;
+        memcpy( &header, data.data(), sizeof( header ) );
+        const char *ptr = data.data() + sizeof( header );
+        const char *end = data.data() + data.size();
+        if ( tag == REPLY_TAG ) {
+            // We received the call stacks for a subtree (ignore replies that are too late)
+            globalFullReplies++;
+            for ( auto &reduction : reductions ) {
+                if ( reduction.id == header.id )
+                    addResults( reduction, source, ptr, end, sends );
+            }
+        } else if ( tag == UNCHANGED_TAG ) {
+            // The call stacks for a subtree have not changed since the last request
+            globalUnchangedReplies++;
+            for ( auto &reduction : reductions ) {
+                if ( reduction.id == header.id )
+                    addUnchanged( reduction, source, sends );
+            }
+        } else if ( tag == FRAMES_TAG ) {
+            // The root requested the raw call stacks for some of our call stacks
+            std::vector<uint64_t> fingerprints( ( end - ptr ) / sizeof( uint64_t ) );
+            memcpy( fingerprints.data(), ptr, fingerprints.size() * sizeof( uint64_t ) );
+            stack_frames frames;
+            auto it = savedFrames.find( header.id );
+            if ( it != savedFrames.end() )
+                frames = it->second.frames.subset( fingerprints );
+            auto reply = packFrames( header.id, frames );
+            sendMessage( sends, source, FRAMES_REPLY_TAG, std::move( reply ) );
+        } else if ( tag == FRAMES_REPLY_TAG ) {
+            // We received the raw call stacks for some of the fingerprints
+            for ( auto &reduction : reductions ) {
+                if ( reduction.id == header.id )
+                    addFrames( reduction, source, ptr, end );
+            }
+        }
+    }
+    return activity;
+}
+static void runGlobalMonitorThread()
+{
+    std::list<reduction_struct> reductions;
+    std::list<send_struct> sends;
+    auto interval = MIN_POLL;
+    while ( globalMonitorThreadStatus == 1 ) {
+        // Start any local requests
+        bool activity = false;
+        {
+            std::lock_guard<std::mutex> lock( localRequestMutex );
+            for ( auto &request : localRequests ) {
+                reductions.emplace_back();
+                reductions.back().local = request->result;
+                startReduction( reductions.back(), request->header, request->ranks.data(), sends );
+                activity = true;
+            }
+            localRequests.clear();
+        }
+        // Process any messages
+        activity = processMessages( reductions, sends ) || activity;
+        // Finish any reductions that are complete or have timed out
+        auto now = steady_clock::now();
+        for ( auto it = reductions.begin(); it != reductions.end(); ) {
+            if ( ( it->waiting.empty() && it->pending.empty() ) || now > it->deadline ) {
+                finishReduction( *it, sends );
+                it = reductions.erase( it );
+            } else {
+                ++it;
+            }
+        }
+        for ( auto it = savedFrames.begin(); it != savedFrames.end(); ) {
+            it = now > it->second.expire ? savedFrames.erase( it ) : std::next( it );
+        }
+        evictCounts( reductions );
+        bool sending = testSends( sends );
+        // Wait for more messages (backing off while there is no activity)
+        bool idle        = reductions.empty() && !sending;
+        auto maxInterval = idle ? MAX_IDLE : MAX_ACTIVE;
+        interval         = activity ? MIN_POLL : std::min( 2 * interval, maxInterval );
+#ifdef USE_SOCKETS
+        if ( globalUseSockets ) {
+            // Block until a socket is ready (only wake while idle if there are cached
+            // frames or connections that must be checked)
+            auto wait = interval;
+            if ( idle && savedFrames.empty() && !socketUnauthenticated() )
+                wait = std::chrono::microseconds( -1 );
+            socketWait( wait );
+            continue;
+        }
+#endif
+        std::unique_lock<std::mutex> lock( localRequestMutex );
+        localRequestCondition.wait_for( lock, interval, [] {
+            return !localRequests.empty() || globalMonitorThreadStatus != 1;
+        } );
+    }
+    // Cancel any outstanding requests
+    std::lock_guard<std::mutex> lock( localRequestMutex );
+    for ( auto &request : localRequests ) {
+        reduction_struct reduction;
+        reduction.local = request->result;
+        reduction.result.missing.insert( StackTrace::RankSet( request->ranks ) );
+        publishResults( reduction, true );
+    }
+    localRequests.clear();
+    for ( auto &reduction : reductions ) {
+        if ( reduction.parent < 0 )
+            finishReduction( reduction, sends );
+    }
+    for ( auto &send : sends )
+        MPI_Request_free( &send.request );
+}
+
+
+/****************************************************************************
+ *  Initialize/finalize the global call stacks                               *
+ ****************************************************************************/
+void StackTrace::globalCallStackInitialize( MPI_Comm comm )
+{
+    globalMonitorThreadStatus = 3;
+    // Check that we have the necessary MPI thread support
+    if ( !MPI_Active() ) {
+        printf( "Warning: MPI not initialized before calling globalCallStackInitialize\n" );
+        return;
+    }
+    int rank = 0;
+    MPI_Comm_rank( comm, &rank );
+    int provided;
+    MPI_Query_thread( &provided );
+    globalUseSockets = provided != MPI_THREAD_MULTIPLE;
+#ifndef USE_SOCKETS
+    if ( globalUseSockets ) {
+        if ( rank == 0 )
+            printf( "Warning: getGlobalCallStacks requires support for MPI_THREAD_MULTIPLE\n" );
+        return;
+    }
+#endif
+    // Check that we have support to get call stacks from threads
+    int N_threads = 0;
+    if ( rank == 0 ) {
+        std::thread thread( StackTrace::Utilities::sleep_ms, 200 );
+        std::this_thread::yield();
+        auto thread_ids = registeredThreads();
+        N_threads       = thread_ids.size();
+        thread.join();
+    }
+    MPI_Bcast( &N_threads, 1, MPI_INT, 0, comm );
+    if ( N_threads == 1 ) {
+        if ( rank == 0 )
+            printf( "Warning: getAllCallStacks not supported on this OS\n" );
+        return;
+    }
+    // Create the communicator and get the node for each rank
+    MPI_Comm_dup( comm, &globalCommForGlobalCommStack );
+    int size = 1;
+    MPI_Comm_size( comm, &size );
+    MPI_Comm nodeComm;
+    MPI_Comm_split_type( comm, MPI_COMM_TYPE_SHARED, 0, MPI_INFO_NULL, &nodeComm );
+    int node = rank;
+    MPI_Allreduce( &rank, &node, 1, MPI_INT, MPI_MIN, nodeComm );
+    MPI_Comm_free( &nodeComm );
+    globalNodeId.resize( size );
+    MPI_Allgather( &node, 1, MPI_INT, globalNodeId.data(), 1, MPI_INT, comm );
+    globalRank = rank;
+    globalSize = size;
+#ifdef USE_SOCKETS
+    // Open the sockets if the monitor thread cannot use MPI
+    if ( globalUseSockets && !openSockets( comm ) ) {
+        if ( rank == 0 )
+            printf( "Warning: getGlobalCallStacks requires support for MPI_THREAD_MULTIPLE "
+                    "or sockets\n" );
+        MPI_Comm_free( &globalCommForGlobalCommStack );
+        globalCommForGlobalCommStack = MPI_COMM_NULL;
+        return;
+    }
+#endif
+    // Initialize the helper thread
+    globalMonitorThreadStatus = 1;
+    globalMonitorThread.reset( new std::thread( runGlobalMonitorThread ) );
+    std::this_thread::sleep_for( std::chrono::milliseconds( 50 ) );
+}
+void StackTrace::globalCallStackFinalize()
+{
+    if ( globalMonitorThread ) {
+        {
+            std::lock_guard<std::mutex> lock( localRequestMutex );
+            globalMonitorThreadStatus = 2;
+        }
+        localRequestCondition.notify_one();
+#ifdef USE_SOCKETS
+        socketWakeup();
+#endif
+        globalMonitorThread->join();
+        globalMonitorThread.reset();
+    }
+#ifdef USE_SOCKETS
+    closeSockets();
+#endif
+    if ( globalCommForGlobalCommStack != MPI_COMM_NULL )
+        MPI_Comm_free( &globalCommForGlobalCommStack );
+    globalCommForGlobalCommStack = MPI_COMM_NULL;
+}
+
+
+/****************************************************************************
+ *  Get the call stacks from the remote processes                            *
+ ****************************************************************************/
+using globalCallback = std::function<void( const StackTrace::global_stack_info & )>;
+// Start a request for the call stacks from the remote processes (the results are nullptr
+// if the request could not be started).  If ranks is not null only the given ranks are
+// queried (the tree only contains this rank and the given ranks).
+static std::shared_ptr<local_result> startRemoteRequest( const StackTrace::RankSet *ranks )
+{
+    if ( globalMonitorThreadStatus == -1 ) {
+        // User did not call globalCallStackInitialize
+        printf( "Warning: getGlobalCallStacks called without call to globalCallStackInitialize\n" );
+        return nullptr;
+    } else if ( globalMonitorThreadStatus != 1 ) {
+        // globalCallStackInitialize is not supported
+        return nullptr;
+    }
+    // Create the request (the tree is rooted at this rank).  The id is unique (the rank
+    // and a counter) so any number of requests may be outstanding.
+    int rank = globalRank;
+    std::vector<int> list( 1, rank );
+    if ( ranks ) {
+        for ( auto [first, last] : ranks->ranges() ) {
+            for ( int r = std::max( first, 0 ); r <= std::min( last, globalSize - 1 ); r++ ) {
+                if ( r != rank )
+                    list.push_back( r );
+            }
+        }
+    } else {
+        for ( int r = 0; r < globalSize; r++ ) {
+            if ( r != rank )
+                list.push_back( r );
+        }
+    }
+    int size        = list.size();
+    double levels   = 2 + std::ceil( std::log2( size ) );
+    bool raw        = globalSymbolizeType == StackTrace::symbolizeType::root;
+    auto request    = std::make_unique<local_request>();
+    auto id         = ( static_cast<uint64_t>( rank ) << 32 ) + requestCounter++;
+    request->header = { id, rank, size, 10.0 + levels * LEVEL_TIME, MIN_WAIT, raw, NO_BASE };
+    request->ranks  = sortRanks( rank, std::move( list ) );
+    request->result = std::make_shared<local_result>();
+    auto result     = request->result;
+    {
+        std::lock_guard<std::mutex> lock( localRequestMutex );
+        if ( globalMonitorThreadStatus != 1 )
+            return nullptr; // The monitor thread has stopped
+        localRequests.push_back( std::move( request ) );
+#ifdef USE_SOCKETS
+        socketWakeup(); // Wake the thread before finalize can close the pipe
+#endif
+    }
+    localRequestCondition.notify_one();
+    return result;
+}
+// Wait for the results (the monitor thread runs the reduction).  The raw call stacks
+// are resolved here (the symbols for each address are only resolved once and are kept
+// for later requests).
+static StackTrace::global_stack_info waitRemoteResults( std::shared_ptr<local_result> result,
+                                                        const globalCallback &callback )
+{
+    if ( !result )
+        return StackTrace::global_stack_info();
+    std::unique_lock<std::mutex> lock( result->mutex );
+    while ( true ) {
+        result->condition.wait( lock, [&result] { return result->updated || result->finished; } );
+        result->updated = false;
+        bool finished   = result->finished;
+        if ( !finished && !callback )
+            continue;
+        auto data   = result->data;
+        auto counts = result->counts;
+        auto frames = result->frames;
+        lock.unlock();
+        {
+            std::lock_guard<std::mutex> lock2( symbolMutex );
+            if ( symbolCache.size() > MAX_FRAMES )
+                symbolCache.clear();
+            data.stack.add( frames.resolve( counts, symbolCache ) );
+        }
+        if ( finished )
+            return data;
+        callback( data );
+        lock.lock();
+    }
+}
+static StackTrace::global_stack_info getRemoteCallStacks( const globalCallback &callback )
+{
+    return waitRemoteResults( startRemoteRequest( nullptr ), callback );
+}
+StackTrace::global_stack_info StackTrace::getGlobalCallStacks( MPI_Comm comm,
+                                                               globalCallback callback )
+{
+    // Get the ranks in comm (in the communicator passed to globalCallStackInitialize)
+    if ( globalCommForGlobalCommStack == MPI_COMM_NULL )
+        return getGlobalCallStacks( std::move( callback ) );
+    MPI_Group group1, group2;
+    MPI_Comm_group( comm, &group1 );
+    MPI_Comm_group( globalCommForGlobalCommStack, &group2 );
+    int size = 0;
+    MPI_Group_size( group1, &size );
+    std::vector<int> ranks1( size ), ranks2( size );
+    for ( int i = 0; i < size; i++ )
+        ranks1[i] = i;
+    MPI_Group_translate_ranks( group1, size, ranks1.data(), group2, ranks2.data() );
+    MPI_Group_free( &group1 );
+    MPI_Group_free( &group2 );
+    ranks2.erase( std::remove( ranks2.begin(), ranks2.end(), MPI_UNDEFINED ), ranks2.end() );
+    return getGlobalCallStacks( RankSet( ranks2 ), std::move( callback ) );
+}
+#else
+struct local_result {
+};
+using globalCallback = std::function<void( const StackTrace::global_stack_info & )>;
+static std::shared_ptr<local_result> startRemoteRequest( const StackTrace::RankSet * )
+{
+    return nullptr;
+}
+static StackTrace::global_stack_info waitRemoteResults( std::shared_ptr<local_result>,
+                                                        const globalCallback & )
+{
+    return {};
+}
+static StackTrace::global_stack_info getRemoteCallStacks( const globalCallback &callback )
+{
+    return waitRemoteResults( startRemoteRequest( nullptr ), callback );
+}
+#endif
+// Get the rank/size in the communicator for the global call stacks (used by MPIWatchdog)
+void StackTrace::detail::getGlobalRank( int &rank, int &size )
+{
+#ifdef STACKTRACE_USE_MPI
+    bool init = globalCommForGlobalCommStack != MPI_COMM_NULL;
+    rank      = init ? globalRank : 0;
+    size      = init ? globalSize : 1;
+#else
+    rank = 0;
+    size = 1;
+#endif
+}
+// Get the time the last request for the global call stacks was received from another rank
+// (steady_clock, ns)
+int64_t StackTrace::detail::getLastRemoteRequest()
+{
+#ifdef STACKTRACE_USE_MPI
+    return globalLastRequest.load();
+#else
+    return 0;
+#endif
+}
+// Get the number of replies received from the children (used by the tests)
+void StackTrace::detail::getReplyCounts( size_t &full, size_t &unchanged )
+{
+#ifdef STACKTRACE_USE_MPI
+    full      = globalFullReplies.load();
+    unchanged = globalUnchangedReplies.load();
+#else
+    full      = 0;
+    unchanged = 0;
+#endif
+}
+void StackTrace::setGlobalSymbolizeType( StackTrace::symbolizeType type )
+{
+    globalSymbolizeType = type;
+}
+StackTrace::symbolizeType StackTrace::getGlobalSymbolizeType() { return globalSymbolizeType; }
+void StackTrace::detail::setLocalRanks( [[maybe_unused]] multi_stack_info &stack )
+{
+#ifdef STACKTRACE_USE_MPI
+    if ( globalCommForGlobalCommStack != MPI_COMM_NULL )
+        stack.setRanks( StackTrace::RankSet( globalRank ) );
+#endif
+}
+// Get the call stacks for this rank (empty if this rank is not in the requested ranks)
+static StackTrace::multi_stack_info getLocalCallStacks( const StackTrace::RankSet *ranks = nullptr )
+{
+#ifdef STACKTRACE_USE_MPI
+    int rank = globalRank;
+#else
+    int rank = 0;
+#endif
+    if ( ranks && !ranks->contains( rank ) )
+        return StackTrace::multi_stack_info();
+    auto stack = StackTrace::getAllCallStacks();
+    StackTrace::detail::setLocalRanks( stack );
+    return stack;
+}
+StackTrace::RankSet StackTrace::sampleRanks( double fraction )
+{
+#ifdef STACKTRACE_USE_MPI
+    int size = globalCommForGlobalCommStack == MPI_COMM_NULL ? 1 : globalSize;
+#else
+    int size = 1;
+#endif
+    // Choose N distinct ranks (Floyd's algorithm, O(N) random numbers)
+    int N = std::max<int>( std::lround( std::max( std::min( fraction, 1.0 ), 0.0 ) * size ), 1 );
+    std::random_device rd;
+    std::mt19937_64 gen( rd() );
+    std::set<int> ranks;
+    for ( int j = size - N; j < size; j++ ) {
+        int r = std::uniform_int_distribution<int>( 0, j )( gen );
+        ranks.insert( ranks.count( r ) ? j : r );
+    }
+    return RankSet( std::vector<int>( ranks.begin(), ranks.end() ) );
+}
+StackTrace::multi_stack_info StackTrace::detail::getRemoteCallStacks()
+{
+    return ::getRemoteCallStacks( nullptr ).stack;
+}
+StackTrace::multi_stack_info StackTrace::getGlobalCallStacks()
+{
+    auto multistack = getLocalCallStacks();
+    multistack.add( detail::getRemoteCallStacks() );
+    return multistack;
+}
+// Get the call stacks for the given ranks (all ranks if null)
+static StackTrace::global_stack_info getGlobalCallStacks( const StackTrace::RankSet *ranks,
+                                                          const globalCallback &callback )
+{
+    // Add the local call stacks to the remote call stacks
+    auto local = getLocalCallStacks( ranks );
+    auto add   = [&local]( const StackTrace::global_stack_info &remote ) {
+        StackTrace::global_stack_info data = { local, remote.missing };
+        data.stack.add( remote.stack );
+        return data;
+    };
+    globalCallback callback2;
+    if ( callback )
+        callback2 = [&callback, &add]( const StackTrace::global_stack_info &remote ) {
+            callback( add( remote ) );
+        };
+    return add( waitRemoteResults( startRemoteRequest( ranks ), callback2 ) );
+}
+StackTrace::global_stack_info
+StackTrace::getGlobalCallStacks( std::function<void( const global_stack_info & )> callback )
+{
+    return ::getGlobalCallStacks( nullptr, callback );
+}
+StackTrace::global_stack_info
+StackTrace::getGlobalCallStacks( const RankSet &ranks,
+                                 std::function<void( const global_stack_info & )> callback )
+{
+    return ::getGlobalCallStacks( &ranks, callback );
+}
+
+
+/****************************************************************************
+ *  Asynchronous requests for the global call stacks                         *
+ ****************************************************************************/
+struct StackTrace::global_stack_request::data_struct {
+    multi_stack_info local;               // Call stacks for this rank
+    std::shared_ptr<local_result> remote; // Results from the monitor thread (may be null)
+};
+bool StackTrace::global_stack_request::test() const
+{
+#ifdef STACKTRACE_USE_MPI
+    if ( d_data && d_data->remote ) {
+        std::lock_guard<std::mutex> lock( d_data->remote->mutex );
+        return d_data->remote->finished;
+    }
+#endif
+    return true;
+}
+void StackTrace::global_stack_request::wait() const
+{
+#ifdef STACKTRACE_USE_MPI
+    if ( d_data && d_data->remote ) {
+        auto &remote = *d_data->remote;
+        std::unique_lock<std::mutex> lock( remote.mutex );
+        remote.condition.wait( lock, [&remote] { return remote.finished; } );
+    }
+#endif
+}
+bool StackTrace::global_stack_request::wait_for( [[maybe_unused]] double timeout ) const
+{
+#ifdef STACKTRACE_USE_MPI
+    if ( d_data && d_data->remote ) {
+        auto &remote = *d_data->remote;
+        auto time    = std::chrono::duration<double>( timeout );
+        std::unique_lock<std::mutex> lock( remote.mutex );
+        return remote.condition.wait_for( lock, time, [&remote] { return remote.finished; } );
+    }
+#endif
+    return true;
+}
+StackTrace::global_stack_info StackTrace::global_stack_request::get() const
+{
+    if ( !d_data )
+        return global_stack_info();
+    auto remote            = waitRemoteResults( d_data->remote, nullptr );
+    global_stack_info data = { d_data->local, remote.missing };
+    data.stack.add( remote.stack );
+    return data;
+}
+static StackTrace::global_stack_request getGlobalCallStacksAsync( const StackTrace::RankSet *ranks )
+{
+    auto data    = std::make_shared<StackTrace::global_stack_request::data_struct>();
+    data->local  = getLocalCallStacks( ranks );
+    data->remote = startRemoteRequest( ranks );
+    return StackTrace::global_stack_request( data );
+}
+StackTrace::global_stack_request StackTrace::getGlobalCallStacksAsync()
+{
+    return ::getGlobalCallStacksAsync( nullptr );
+}
+StackTrace::global_stack_request StackTrace::getGlobalCallStacksAsync( const RankSet &ranks )
+{
+    return ::getGlobalCallStacksAsync( &ranks );
+}
@@ -0,0 +1,70 @@
+// This file contains optional hooks that interpose malloc/free for the heap profiler
+// It is built as a separate library (stacktrace_heap_hooks) that must be explicitly linked
+// Note: the hooks only call into the heap profiler which returns immediately when it is
+//    not running (frees are only checked while sampled allocations are live)
+#include "StackTrace/HeapProfiler.h"
+
+#include <cerrno>
+#include <cstddef>
+
+
+/****************************************************************************
+ *  Allocation hooks for the heap profiler                                   *
+ *  Note: these use the glibc internal allocation functions                  *
+ ****************************************************************************/
+extern "C" {
+int stacktrace_heap_hooks = 1;
+void *__libc_malloc( size_t );
+void *__libc_calloc( size_t, size_t );
+void *__libc_realloc( void *, size_t );
+void *__libc_memalign( size_t, size_t );
+void __libc_free( void * );
+void *malloc( size_t size )
+{
+    void *ptr = __libc_malloc( size );
+    StackTrace::HeapProfiler::recordAlloc( ptr, size );
+    return ptr;
+}
+void *calloc( size_t N, size_t size )
+{
+    void *ptr = __libc_calloc( N, size );
+    StackTrace::HeapProfiler::recordAlloc( ptr, N * size );
+    return ptr;
+}
+void *realloc( void *ptr, size_t size )
+{
+    // Note: the original block is still live if realloc fails (glibc frees it for size 0)
+    void *ptr2 = __libc_realloc( ptr, size );
+    if ( ptr2 != nullptr || size == 0 )
+        StackTrace::HeapProfiler::recordFree( ptr );
+    StackTrace::HeapProfiler::recordAlloc( ptr2, size );
+    return ptr2;
+}
+void *memalign( size_t alignment, size_t size )
+{
+    void *ptr = __libc_memalign( alignment, size );
+    StackTrace::HeapProfiler::recordAlloc( ptr, size );
+    return ptr;
+}
+void *aligned_alloc( size_t alignment, size_t size )
+{
+    void *ptr = __libc_memalign( alignment, size );
+    StackTrace::HeapProfiler::recordAlloc( ptr, size );
+    return ptr;
+}
+int posix_memalign( void **ptr, size_t alignment, size_t size )
+{
+    if ( alignment % sizeof( void * ) != 0 || ( alignment & ( alignment - 1 ) ) != 0 )
+        return EINVAL;
+    *ptr = __libc_memalign( alignment, size );
+    if ( *ptr == nullptr )
+        return ENOMEM;
+    StackTrace::HeapProfiler::recordAlloc( *ptr, size );
+    return 0;
+}
+void free( void *ptr )
+{
+    StackTrace::HeapProfiler::recordFree( ptr );
+    __libc_free( ptr );
+}
+}
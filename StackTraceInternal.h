@@ -0,0 +1,42 @@
+#ifndef included_StackTrace_Internal
+#define included_StackTrace_Internal
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "StackTrace/StackTrace.h"
+
+
+// Internal functions shared between the source files (not part of the public interface)
+namespace StackTrace::detail {
+
+
+//! Write a watchdog report, returning false if the file could not be opened (Watchdog.cpp)
+bool writeWatchdogReport( const char *reason, const std::string &filename, printStackType type );
+
+
+//! Get the call stacks from the other processes (StackTraceGlobal.cpp)
+multi_stack_info getRemoteCallStacks();
+
+
+//! Label the call stacks with this rank if the global call stacks are used (StackTraceGlobal.cpp)
+void setLocalRanks( multi_stack_info &stack );
+
+
+//! Get the rank/size in the communicator for the global call stacks (StackTraceGlobal.cpp)
+void getGlobalRank( int &rank, int &size );
+
+
+//! Get the time the last global call stack request was received (steady_clock, ns)
+int64_t getLastRemoteRequest();
+
+
+//! Get the number of replies with the call stacks and unchanged replies received from the
+//! children in the global call stack reductions (StackTraceGlobal.cpp)
+void getReplyCounts( size_t &full, size_t &unchanged );
+
+
+} // namespace StackTrace::detail
+
+#endif
@@ -0,0 +1,74 @@
+// This file contains optional hooks that interpose pthread_mutex_lock for the lock profiler
+// It is built as a separate library (stacktrace_lock_hooks) that must be explicitly linked
+// Note: the hook calls the next pthread_mutex_lock directly when the profiler is not running
+#include "StackTrace/LockProfiler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <ctime>
+
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <pthread.h>
+#include <unistd.h>
+
+
+/****************************************************************************
+ *  pthread_mutex_lock hook for the lock profiler                            *
+ *  Note: the owner of a pthread mutex is not known so only the waiting      *
+ *    call stack is recorded                                                 *
+ ****************************************************************************/
+static thread_local bool lock_busy __attribute__( ( tls_model( "initial-exec" ) ) ) = false;
+typedef int ( *pthread_mutex_lock_fun )( pthread_mutex_t * );
+static std::atomic<pthread_mutex_lock_fun> libc_mutex_lock_ptr( nullptr );
+static int libc_mutex_lock( pthread_mutex_t *mutex )
+{
+    // Note: __pthread_mutex_lock is not exported by newer versions of glibc
+    auto fun = libc_mutex_lock_ptr.load( std::memory_order_relaxed );
+    if ( !fun ) {
+        void *ptr = dlsym( RTLD_NEXT, "pthread_mutex_lock" );
+        if ( !ptr ) {
+            const char msg[] = "stacktrace_lock_hooks: unable to find pthread_mutex_lock\n";
+            [[maybe_unused]] auto tmp = write( STDERR_FILENO, msg, sizeof( msg ) - 1 );
+            abort();
+        }
+        fun = reinterpret_cast<pthread_mutex_lock_fun>( ptr );
+        libc_mutex_lock_ptr.store( fun, std::memory_order_relaxed );
+    }
+    return fun( mutex );
+}
+extern "C" {
+int pthread_mutex_lock( pthread_mutex_t *mutex )
+{
+    if ( !StackTrace::LockProfiler::running() || lock_busy )
+        return libc_mutex_lock( mutex );
+    int err = pthread_mutex_trylock( mutex );
+    if ( err != EBUSY )
+        return err;
+    // Wait up to the threshold for the lock
+    int64_t threshold = StackTrace::LockProfiler::threshold();
+    timespec start, end, deadline;
+    clock_gettime( CLOCK_MONOTONIC, &start );
+    clock_gettime( CLOCK_REALTIME, &deadline );
+    deadline.tv_sec += ( deadline.tv_nsec + threshold ) / 1000000000;
+    deadline.tv_nsec = ( deadline.tv_nsec + threshold ) % 1000000000;
+    err              = pthread_mutex_timedlock( mutex, &deadline );
+    if ( err != ETIMEDOUT )
+        return err;
+    // We waited longer than the threshold, get the call stack and wait for the lock
+    lock_busy                = true;
+    constexpr int MAX_FRAMES = StackTrace::LockProfiler::owner_stack::MAX_FRAMES;
+    void *frames[MAX_FRAMES + 1];
+    int N = std::max( backtrace( frames, MAX_FRAMES + 1 ) - 1, 0 );
+    err   = libc_mutex_lock( mutex );
+    clock_gettime( CLOCK_MONOTONIC, &end );
+    int64_t ns = 1000000000 * ( end.tv_sec - start.tv_sec ) + ( end.tv_nsec - start.tv_nsec );
+    if ( err == 0 )
+        StackTrace::LockProfiler::recordWait( N, &frames[1], 0, nullptr, ns );
+    lock_busy = false;
+    return err;
+}
+}
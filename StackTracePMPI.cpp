@@ -0,0 +1,222 @@
+// This file contains optional PMPI wrappers that time the blocking MPI calls (MPIWatchdog)
+// It is built as a separate library (stacktrace_pmpi) that must be linked before MPI
+#include "StackTrace/ErrorHandlers.h"
+#include "StackTrace/MPIWatchdog.h"
+
+#include <cstdint>
+#include <type_traits>
+
+
+/****************************************************************************
+ *  Helper functions                                                         *
+ ****************************************************************************/
+extern "C" {
+int stacktrace_mpi_hooks = 1;
+}
+static inline const char *commName( MPI_Comm comm )
+{
+    if ( comm == MPI_COMM_WORLD )
+        return "MPI_COMM_WORLD";
+    if ( comm == MPI_COMM_SELF )
+        return "MPI_COMM_SELF";
+    return nullptr;
+}
+template<class COMM>
+static inline uint64_t commId( COMM comm )
+{
+    if constexpr ( std::is_pointer_v<COMM> )
+        return reinterpret_cast<uintptr_t>( comm );
+    else
+        return static_cast<uint64_t>( comm );
+}
+// Record a blocking MPI call for the duration of the scope
+class BlockingCall final
+{
+public:
+    BlockingCall( const char *call, MPI_Comm comm )
+    {
+        StackTrace::MPIWatchdog::enter( call, commName( comm ), commId( comm ) );
+    }
+    explicit BlockingCall( const char *call )
+    {
+        StackTrace::MPIWatchdog::enter( call, nullptr, 0 );
+    }
+    ~BlockingCall() { StackTrace::MPIWatchdog::leave(); }
+};
+
+
+/****************************************************************************
+ *  Collectives                                                              *
+ ****************************************************************************/
+int MPI_Barrier( MPI_Comm comm )
+{
+    BlockingCall call( "MPI_Barrier", comm );
+    return PMPI_Barrier( comm );
+}
+int MPI_Bcast( void *buf, int count, MPI_Datatype type, int root, MPI_Comm comm )
+{
+    BlockingCall call( "MPI_Bcast", comm );
+    return PMPI_Bcast( buf, count, type, root, comm );
+}
+int MPI_Reduce( const void *sendbuf, void *recvbuf, int count, MPI_Datatype type, MPI_Op op,
+                int root, MPI_Comm comm )
+{
+    BlockingCall call( "MPI_Reduce", comm );
+    return PMPI_Reduce( sendbuf, recvbuf, count, type, op, root, comm );
+}
+int MPI_Allreduce( const void *sendbuf, void *recvbuf, int count, MPI_Datatype type, MPI_Op op,
+                   MPI_Comm comm )
+{
+    BlockingCall call( "MPI_Allreduce", comm );
+    return PMPI_Allreduce( sendbuf, recvbuf, count, type, op, comm );
+}
+int MPI_Gather( const void *sendbuf, int sendcount, MPI_Datatype sendtype, void *recvbuf,
+                int recvcount, MPI_Datatype recvtype, int root, MPI_Comm comm )
+{
+    BlockingCall call( "MPI_Gather", comm );
+    return PMPI_Gather( sendbuf, sendcount, sendtype, recvbuf, recvcount, recvtype, root, comm );
+}
+int MPI_Gatherv( const void *sendbuf, int sendcount, MPI_Datatype sendtype, void *recvbuf,
+                 const int recvcounts[], const int displs[], MPI_Datatype recvtype, int root,
+                 MPI_Comm comm )
+{
+    BlockingCall call( "MPI_Gatherv", comm );
+    return PMPI_Gatherv(
+        sendbuf, sendcount, sendtype, recvbuf, recvcounts, displs, recvtype, root, comm );
+}
+int MPI_Scatter( const void *sendbuf, int sendcount, MPI_Datatype sendtype, void *recvbuf,
+                 int recvcount, MPI_Datatype recvtype, int root, MPI_Comm comm )
+{
+    BlockingCall call( "MPI_Scatter", comm );
+    return PMPI_Scatter( sendbuf, sendcount, sendtype, recvbuf, recvcount, recvtype, root, comm );
+}
+int MPI_Scatterv( const void *sendbuf, const int sendcounts[], const int displs[],
+                  MPI_Datatype sendtype, void *recvbuf, int recvcount, MPI_Datatype recvtype,
+                  int root, MPI_Comm comm )
+{
+    BlockingCall call( "MPI_Scatterv", comm );
+    return PMPI_Scatterv(
+        sendbuf, sendcounts, displs, sendtype, recvbuf, recvcount, recvtype, root, comm );
+}
+int MPI_Allgather( const void *sendbuf, int sendcount, MPI_Datatype sendtype, void *recvbuf,
+                   int recvcount, MPI_Datatype recvtype, MPI_Comm comm )
+{
+    BlockingCall call( "MPI_Allgather", comm );
+    return PMPI_Allgather( sendbuf, sendcount, sendtype, recvbuf, recvcount, recvtype, comm );
+}
+int MPI_Allgatherv( const void *sendbuf, int sendcount, MPI_Datatype sendtype, void *recvbuf,
+                    const int recvcounts[], const int displs[], MPI_Datatype recvtype,
+                    MPI_Comm comm )
+{
+    BlockingCall call( "MPI_Allgatherv", comm );
+    return PMPI_Allgatherv(
+        sendbuf, sendcount, sendtype, recvbuf, recvcounts, displs, recvtype, comm );
+}
+int MPI_Alltoall( const void *sendbuf, int sendcount, MPI_Datatype sendtype, void *recvbuf,
+                  int recvcount, MPI_Datatype recvtype, MPI_Comm comm )
+{
+    BlockingCall call( "MPI_Alltoall", comm );
+    return PMPI_Alltoall( sendbuf, sendcount, sendtype, recvbuf, recvcount, recvtype, comm );
+}
+int MPI_Alltoallv( const void *sendbuf, const int sendcounts[], const int sdispls[],
+                   MPI_Datatype sendtype, void *recvbuf, const int recvcounts[],
+                   const int rdispls[], MPI_Datatype recvtype, MPI_Comm comm )
+{
+    BlockingCall call( "MPI_Alltoallv", comm );
+    return PMPI_Alltoallv(
+        sendbuf, sendcounts, sdispls, sendtype, recvbuf, recvcounts, rdispls, recvtype, comm );
+}
+int MPI_Reduce_scatter( const void *sendbuf, void *recvbuf, const int recvcounts[],
+                        MPI_Datatype type, MPI_Op op, MPI_Comm comm )
+{
+    BlockingCall call( "MPI_Reduce_scatter", comm );
+    return PMPI_Reduce_scatter( sendbuf, recvbuf, recvcounts, type, op, comm );
+}
+int MPI_Reduce_scatter_block( const void *sendbuf, void *recvbuf, int recvcount,
+                              MPI_Datatype type, MPI_Op op, MPI_Comm comm )
+{
+    BlockingCall call( "MPI_Reduce_scatter_block", comm );
+    return PMPI_Reduce_scatter_block( sendbuf, recvbuf, recvcount, type, op, comm );
+}
+int MPI_Scan( const void *sendbuf, void *recvbuf, int count, MPI_Datatype type, MPI_Op op,
+              MPI_Comm comm )
+{
+    BlockingCall call( "MPI_Scan", comm );
+    return PMPI_Scan( sendbuf, recvbuf, count, type, op, comm );
+}
+int MPI_Exscan( const void *sendbuf, void *recvbuf, int count, MPI_Datatype type, MPI_Op op,
+                MPI_Comm comm )
+{
+    BlockingCall call( "MPI_Exscan", comm );
+    return PMPI_Exscan( sendbuf, recvbuf, count, type, op, comm );
+}
+int MPI_Comm_split( MPI_Comm comm, int color, int key, MPI_Comm *newcomm )
+{
+    BlockingCall call( "MPI_Comm_split", comm );
+    return PMPI_Comm_split( comm, color, key, newcomm );
+}
+int MPI_Comm_dup( MPI_Comm comm, MPI_Comm *newcomm )
+{
+    BlockingCall call( "MPI_Comm_dup", comm );
+    return PMPI_Comm_dup( comm, newcomm );
+}
+
+
+/****************************************************************************
+ *  Blocking point to point calls                                            *
+ ****************************************************************************/
+int MPI_Send( const void *buf, int count, MPI_Datatype type, int dest, int tag, MPI_Comm comm )
+{
+    BlockingCall call( "MPI_Send", comm );
+    return PMPI_Send( buf, count, type, dest, tag, comm );
+}
+int MPI_Ssend( const void *buf, int count, MPI_Datatype type, int dest, int tag, MPI_Comm comm )
+{
+    BlockingCall call( "MPI_Ssend", comm );
+    return PMPI_Ssend( buf, count, type, dest, tag, comm );
+}
+int MPI_Recv( void *buf, int count, MPI_Datatype type, int source, int tag, MPI_Comm comm,
+              MPI_Status *status )
+{
+    BlockingCall call( "MPI_Recv", comm );
+    return PMPI_Recv( buf, count, type, source, tag, comm, status );
+}
+int MPI_Sendrecv( const void *sendbuf, int sendcount, MPI_Datatype sendtype, int dest,
+                  int sendtag, void *recvbuf, int recvcount, MPI_Datatype recvtype, int source,
+                  int recvtag, MPI_Comm comm, MPI_Status *status )
+{
+    BlockingCall call( "MPI_Sendrecv", comm );
+    return PMPI_Sendrecv( sendbuf, sendcount, sendtype, dest, sendtag, recvbuf, recvcount,
+                          recvtype, source, recvtag, comm, status );
+}
+int MPI_Probe( int source, int tag, MPI_Comm comm, MPI_Status *status )
+{
+    BlockingCall call( "MPI_Probe", comm );
+    return PMPI_Probe( source, tag, comm, status );
+}
+
+
+/****************************************************************************
+ *  Waits (the communicator is not known)                                    *
+ ****************************************************************************/
+int MPI_Wait( MPI_Request *request, MPI_Status *status )
+{
+    BlockingCall call( "MPI_Wait" );
+    return PMPI_Wait( request, status );
+}
+int MPI_Waitall( int count, MPI_Request requests[], MPI_Status statuses[] )
+{
+    BlockingCall call( "MPI_Waitall" );
+    return PMPI_Waitall( count, requests, statuses );
+}
+int MPI_Waitany( int count, MPI_Request requests[], int *index, MPI_Status *status )
+{
+    BlockingCall call( "MPI_Waitany" );
+    return PMPI_Waitany( count, requests, index, status );
+}
+int MPI_Waitsome( int incount, MPI_Request requests[], int *outcount, int indices[],
+                  MPI_Status statuses[] )
+{
+    BlockingCall call( "MPI_Waitsome" );
+    return PMPI_Waitsome( incount, requests, outcount, indices, statuses );
+}
@@ -212,6 +212,38 @@ std::vector<std::thread::native_handle_type> activeThreads()
 }
 
 
+/****************************************************************************
+ *  Get the system thread id (uses signaling for other threads)              *
+ ****************************************************************************/
+#ifdef USE_LINUX
+static volatile int thread_system_id;
+static void _systemThreadID_signal_handler( int ) { thread_system_id = syscall( SYS_gettid ); }
+#endif
+int getSystemThreadID( std::thread::native_handle_type id )
+{
+#if defined( USE_LINUX )
+    if ( id == thisThread() )
+        return syscall( SYS_gettid );
+    StackTrace_mutex.lock();
+    thread_system_id = -1;
+    auto old         = signal( thread_callstack_signal, _systemThreadID_signal_handler );
+    pthread_kill( id, thread_callstack_signal );
+    auto t1 = std::chrono::high_resolution_clock::now();
+    auto t2 = t1;
+    while ( thread_system_id == -1 && std::chrono::duration<double>( t2 - t1 ).count() < 0.1 ) {
+        std::this_thread::yield();
+        t2 = std::chrono::high_resolution_clock::now();
+    }
+    int tid = thread_system_id;
+    signal( thread_callstack_signal, old );
+    StackTrace_mutex.unlock();
+    return tid;
+#else
+    return -1;
+#endif
+}
+
+
 /****************************************************************************
  *  Register threads with the StackTrace                                     *
  ****************************************************************************/
@@ -0,0 +1,281 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "StackTrace/ExceptionProfiler.h"
+#include "StackTrace/HeapProfiler.h"
+#include "StackTrace/LockProfiler.h"
+#include "StackTrace/StackTrace.h"
+#include "StackTrace/Utilities.h"
+
+
+using namespace StackTrace;
+
+
+// Keep the test functions out of line and uncloned (GCC names the clones as local symbols that
+// cannot be resolved, e.g. allocateMemory.constprop.0 at -O3)
+// clang-format off
+#if defined( __GNUC__ ) && !defined( __clang__ )
+    #define NO_INLINE __attribute__( ( noinline, noclone ) )
+#elif defined( __GNUC__ )
+    #define NO_INLINE __attribute__( ( noinline ) )
+#else
+    #define NO_INLINE
+#endif
+// clang-format on
+
+
+// Class to store pass/failures
+class UnitTest
+{
+public:
+    void passes( const std::string &msg ) { passes_.push_back( msg ); }
+    void failure( const std::string &msg ) { failure_.push_back( msg ); }
+    void expected( const std::string &msg ) { expected_.push_back( msg ); }
+
+    void print() const
+    {
+        printf( "\nTests passed:\n" );
+        for ( const auto &msg : passes_ )
+            printf( "   %s\n", msg.data() );
+        printf( "\nTests expected failed:\n" );
+        for ( const auto &msg : expected_ )
+            printf( "   %s\n", msg.data() );
+        printf( "\nTests failed:\n" );
+        for ( const auto &msg : failure_ )
+            printf( "   %s\n", msg.data() );
+    }
+
+    int N_failed() const { return failure_.size(); }
+
+private:
+    std::vector<std::string> passes_;
+    std::vector<std::string> failure_;
+    std::vector<std::string> expected_;
+};
+
+
+// Search the call stack for a function
+int findFunction( const multi_stack_info &stack, const char *name )
+{
+    if ( strstr( stack.stack.function.data(), name ) )
+        return stack.N;
+    int N = 0;
+    for ( const auto &child : stack.children )
+        N += findFunction( child, name );
+    return N;
+}
+
+
+// Allocate memory (the memory is returned to the caller)
+NO_INLINE std::vector<void *> allocateMemory( int N, size_t bytes )
+{
+    std::vector<void *> ptr( N, nullptr );
+    for ( int i = 0; i < N; i++ ) {
+        ptr[i] = malloc( bytes );
+        memset( ptr[i], 0, bytes );
+    }
+    // Trick compiler to skip inline for this function with fake recursion
+    if ( N < 0 )
+        ptr = allocateMemory( N, bytes );
+    return ptr;
+}
+
+
+// Test the heap profiler
+void testHeapProfiler( UnitTest &ut )
+{
+    if ( !HeapProfiler::hooksInstalled() ) {
+        ut.failure( "Heap profiler hooks are not installed" );
+        return;
+    }
+    HeapProfiler::start( 64 * 1024 );
+    size_t bytes0 = HeapProfiler::liveBytes();
+    double t0     = Utilities::time();
+    auto ptr      = allocateMemory( 4000, 8192 );
+    double t1     = Utilities::time();
+    size_t bytes1 = HeapProfiler::liveBytes() - bytes0;
+    auto profile  = HeapProfiler::getProfile();
+    cleanupStackTrace( profile );
+    int kb = findFunction( profile, "allocateMemory" );
+    // A failed realloc must not drop the samples for the (still live) blocks
+    bool realloc_failed = true;
+    for ( auto tmp : ptr )
+        realloc_failed = realloc_failed && realloc( tmp, size_t( 1 ) << 60 ) == nullptr;
+    size_t bytes3 = HeapProfiler::liveBytes() - bytes0;
+    for ( auto tmp : ptr )
+        free( tmp );
+    HeapProfiler::stop();
+    size_t bytes2 = HeapProfiler::liveBytes();
+    printf( "Heap profile:\n" );
+    profile.print( std::cout, "   " );
+    printf( "Time to allocate: %0.4f\n", t1 - t0 );
+    printf( "Estimated bytes allocated: %i (%i)\n", static_cast<int>( bytes1 ), 4000 * 8192 );
+    printf( "Bytes attributed to allocateMemory: %i\n\n", 1024 * kb );
+    if ( bytes1 > 0.7 * 4000 * 8192 && bytes1 < 1.3 * 4000 * 8192 )
+        ut.passes( "Heap profiler estimated memory allocated" );
+    else
+        ut.failure( "Heap profiler estimated memory allocated" );
+    if ( kb > 0.7 * 4000 * 8 && kb < 1.3 * 4000 * 8 )
+        ut.passes( "Heap profiler found allocateMemory" );
+    else
+        ut.failure( "Heap profiler found allocateMemory" );
+    if ( realloc_failed && bytes3 == bytes1 )
+        ut.passes( "Heap profiler kept blocks after failed realloc" );
+    else
+        ut.failure( "Heap profiler kept blocks after failed realloc" );
+    if ( bytes2 < bytes0 + 0.1 * 4000 * 8192 )
+        ut.passes( "Heap profiler tracked free" );
+    else
+        ut.failure( "Heap profiler tracked free" );
+}
+
+
+// Hold a lock (the owner)
+template<class TYPE>
+NO_INLINE void holdLock( TYPE &mutex, int ms )
+{
+    mutex.lock();
+    std::this_thread::sleep_for( std::chrono::milliseconds( ms ) );
+    mutex.unlock();
+    // Trick compiler to skip inline for this function with fake recursion
+    if ( ms < 0 )
+        holdLock( mutex, ms );
+}
+
+
+// Wait for a lock (the waiter)
+template<class TYPE>
+NO_INLINE void waitLock( TYPE &mutex, int ms )
+{
+    std::this_thread::sleep_for( std::chrono::milliseconds( ms ) );
+    mutex.lock();
+    mutex.unlock();
+    // Trick compiler to skip inline for this function with fake recursion
+    if ( ms < 0 )
+        waitLock( mutex, ms );
+}
+
+
+// Test the lock profiler
+template<class TYPE>
+void testLockProfiler( UnitTest &ut, const std::string &name, bool owner )
+{
+    TYPE mutex;
+    LockProfiler::clear();
+    LockProfiler::start( 1e-3 );
+    for ( int i = 0; i < 5; i++ ) {
+        std::thread thread( holdLock<TYPE>, std::ref( mutex ), 50 );
+        waitLock( mutex, 10 );
+        thread.join();
+    }
+    LockProfiler::stop();
+    auto waiters = LockProfiler::getWaiters();
+    auto owners  = LockProfiler::getOwners();
+    cleanupStackTrace( waiters );
+    cleanupStackTrace( owners );
+    int N_wait  = findFunction( waiters, "waitLock" );
+    int N_owner = findFunction( owners, "holdLock" );
+    printf( "%s contention (%i):\n", name.data(), static_cast<int>( LockProfiler::contentions() ) );
+    waiters.print( std::cout, "   " );
+    owners.print( std::cout, "   " );
+    printf( "Time waiting: %i us\n\n", N_wait );
+    if ( LockProfiler::contentions() == 5 && N_wait > 5 * 30000 && N_wait < 5 * 200000 )
+        ut.passes( "Lock profiler found waiter: " + name );
+    else
+        ut.failure( "Lock profiler found waiter: " + name );
+    if ( !owner )
+        return;
+    if ( N_owner == N_wait )
+        ut.passes( "Lock profiler found owner: " + name );
+    else
+        ut.failure( "Lock profiler found owner: " + name );
+}
+
+
+// Throw an exception
+void throwError( int i )
+{
+    if ( i % 2 == 0 )
+        throw std::logic_error( "logic_error" );
+    throw std::runtime_error( "runtime_error" );
+}
+
+
+// Test the exception profiler
+void testExceptionProfiler( UnitTest &ut )
+{
+    if ( !ExceptionProfiler::hooksInstalled() ) {
+        ut.failure( "Exception profiler hooks are not installed" );
+        return;
+    }
+    ExceptionProfiler::clear();
+    ExceptionProfiler::start();
+    bool found = true;
+    for ( int i = 0; i < 100; i++ ) {
+        try {
+            throwError( i );
+        } catch ( const std::exception &e ) {
+            auto stack = getStackInfo( ExceptionProfiler::getThrowStack( &e ) );
+            bool test  = false;
+            for ( const auto &tmp : stack )
+                test = test || strstr( tmp.function.data(), "throwError" );
+            found = found && test;
+        }
+    }
+    ExceptionProfiler::stop();
+    auto profile = ExceptionProfiler::getProfile();
+    cleanupStackTrace( profile );
+    int N_throw   = findFunction( profile, "throwError" );
+    int N_runtime = findFunction( profile, "throw std::runtime_error" );
+    int N_logic   = findFunction( profile, "throw std::logic_error" );
+    printf( "Exception profile:\n" );
+    profile.print( std::cout, "   " );
+    printf( "\n" );
+    if ( ExceptionProfiler::throws() == 100 && N_throw == 100 )
+        ut.passes( "Exception profiler found throwError" );
+    else
+        ut.failure( "Exception profiler found throwError" );
+    if ( N_runtime == 50 && N_logic == 50 )
+        ut.passes( "Exception profiler found types" );
+    else
+        ut.failure( "Exception profiler found types" );
+    if ( found )
+        ut.passes( "Exception profiler getThrowStack" );
+    else
+        ut.failure( "Exception profiler getThrowStack" );
+}
+
+
+/****************************************************************
+ * Run the hook tests                                            *
+ ****************************************************************/
+int main( int, char *[] )
+{
+    int num_failed = 0;
+    {
+        UnitTest ut;
+
+        // Test the heap profiler
+        testHeapProfiler( ut );
+
+        // Test the lock profiler
+        testLockProfiler<StackTrace::mutex>( ut, "StackTrace::mutex", true );
+        testLockProfiler<StackTrace::shared_mutex>( ut, "StackTrace::shared_mutex", true );
+        testLockProfiler<std::mutex>( ut, "std::mutex", false );
+
+        // Test the exception profiler
+        testExceptionProfiler( ut );
+
+        // Finished testing, report the results
+        ut.print();
+        num_failed = ut.N_failed();
+    }
+    return num_failed;
+}
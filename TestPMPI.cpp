@@ -0,0 +1,152 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "StackTrace/ErrorHandlers.h"
+#include "StackTrace/MPIWatchdog.h"
+#include "StackTrace/StackTrace.h"
+#include "StackTrace/Utilities.h"
+
+
+using namespace StackTrace;
+
+
+// Class to store pass/failures
+class UnitTest
+{
+public:
+    void passes( const std::string &msg ) { passes_.push_back( msg ); }
+    void failure( const std::string &msg ) { failure_.push_back( msg ); }
+
+    void print() const
+    {
+        printf( "\nTests passed:\n" );
+        for ( const auto &msg : passes_ )
+            printf( "   %s\n", msg.data() );
+        printf( "\nTests failed:\n" );
+        for ( const auto &msg : failure_ )
+            printf( "   %s\n", msg.data() );
+    }
+
+    int N_failed() const { return failure_.size(); }
+
+private:
+    std::vector<std::string> passes_;
+    std::vector<std::string> failure_;
+};
+
+
+// Read a file
+std::string readFile( const std::string &filename )
+{
+    std::ifstream fid( filename );
+    std::stringstream ss;
+    ss << fid.rdbuf();
+    return ss.str();
+}
+
+
+// Test the cost of recording a call that does not block (the cost is bound by reading the time
+// stamp counter, the bound for unoptimized builds is loose)
+void testOverhead( UnitTest &ut )
+{
+#ifdef NDEBUG
+    constexpr double MAX_NS = 100;
+#else
+    constexpr double MAX_NS = 1000;
+#endif
+    // Use the fastest of several trials to limit the noise from other processes
+    constexpr int N = 1000000;
+    double ns       = 1e100;
+    for ( int k = 0; k < 5; k++ ) {
+        auto t0 = std::chrono::steady_clock::now();
+        for ( int i = 0; i < N; i++ ) {
+            MPIWatchdog::enter( "MPI_Barrier", "MPI_COMM_WORLD", 0 );
+            MPIWatchdog::leave();
+        }
+        auto t1 = std::chrono::steady_clock::now();
+        ns      = std::min( ns, std::chrono::duration<double, std::nano>( t1 - t0 ).count() / N );
+    }
+    printf( "MPI watchdog overhead: %0.1f ns per call\n", ns );
+    if ( ns < MAX_NS )
+        ut.passes( "MPI watchdog overhead" );
+    else
+        ut.failure( "MPI watchdog overhead: " + std::to_string( ns ) + " ns" );
+}
+
+
+// Test that a blocked barrier is reported
+void testBlockedBarrier( UnitTest &ut, int rank )
+{
+    auto filename = "TestPMPI." + std::to_string( rank ) + ".txt";
+    std::remove( filename.data() );
+    MPIWatchdog::start( 1.0, filename );
+    MPI_Barrier( MPI_COMM_WORLD );
+    // Rank 1 arrives late so the barrier blocks on rank 0
+    if ( rank == 1 )
+        std::this_thread::sleep_for( std::chrono::seconds( 3 ) );
+    MPI_Barrier( MPI_COMM_WORLD );
+    MPIWatchdog::stop();
+    size_t N = MPIWatchdog::reports();
+    if ( rank == 0 ) {
+        auto report = readFile( filename );
+        if ( N == 1 && report.find( "MPI_Barrier on MPI_COMM_WORLD" ) != std::string::npos )
+            ut.passes( "MPI watchdog reported blocked barrier" );
+        else
+            ut.failure( "MPI watchdog reported blocked barrier: " + std::to_string( N ) );
+    } else {
+        if ( N == 0 )
+            ut.passes( "MPI watchdog did not report" );
+        else
+            ut.failure( "MPI watchdog did not report: " + std::to_string( N ) );
+    }
+    std::remove( filename.data() );
+}
+
+
+// The main function
+int main( int argc, char *argv[] )
+{
+    int provided = 0;
+    MPI_Init_thread( &argc, &argv, MPI_THREAD_MULTIPLE, &provided );
+    int rank = 0, size = 0;
+    MPI_Comm_rank( MPI_COMM_WORLD, &rank );
+    MPI_Comm_size( MPI_COMM_WORLD, &size );
+    Utilities::setAbortBehavior( true, 3 );
+    Utilities::setErrorHandlers();
+    globalCallStackInitialize( MPI_COMM_WORLD );
+    UnitTest ut;
+
+    // Check that the wrappers are installed
+    if ( MPIWatchdog::hooksInstalled() )
+        ut.passes( "MPI watchdog hooks are installed" );
+    else
+        ut.failure( "MPI watchdog hooks are not installed" );
+
+    // Run the tests
+    if ( rank == 0 )
+        testOverhead( ut );
+    if ( size > 1 )
+        testBlockedBarrier( ut, rank );
+
+    // Print the test results
+    int N_errors = ut.N_failed();
+    ut.print();
+    if ( N_errors == 0 && rank == 0 )
+        std::cout << "\nAll tests passed\n";
+
+    // Shutdown
+    globalCallStackFinalize();
+    Utilities::clearErrorHandlers();
+    clearSignals();
+    clearSymbols();
+    MPI_Barrier( MPI_COMM_WORLD );
+    MPI_Finalize();
+    return N_errors;
+}
@@ -0,0 +1,205 @@
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "StackTrace/Profiler.h"
+#include "StackTrace/StackTrace.h"
+#include "StackTrace/Utilities.h"
+
+
+using namespace StackTrace;
+
+
+// Class to store pass/failures
+class UnitTest
+{
+public:
+    void passes( const std::string &msg ) { passes_.push_back( msg ); }
+    void failure( const std::string &msg ) { failure_.push_back( msg ); }
+    void expected( const std::string &msg ) { expected_.push_back( msg ); }
+
+    void print() const
+    {
+        printf( "\nTests passed:\n" );
+        for ( const auto &msg : passes_ )
+            printf( "   %s\n", msg.data() );
+        printf( "\nTests expected failed:\n" );
+        for ( const auto &msg : expected_ )
+            printf( "   %s\n", msg.data() );
+        printf( "\nTests failed:\n" );
+        for ( const auto &msg : failure_ )
+            printf( "   %s\n", msg.data() );
+    }
+
+    int N_failed() const { return failure_.size(); }
+
+private:
+    std::vector<std::string> passes_;
+    std::vector<std::string> failure_;
+    std::vector<std::string> expected_;
+};
+
+
+// Perform some work for the given time (s)
+[[gnu::noinline]] double busyWork( double time )
+{
+    double x  = 0;
+    double t0 = Utilities::time();
+    while ( Utilities::time() - t0 < time ) {
+        for ( int i = 0; i < 10000; i++ )
+            x += std::sqrt( static_cast<double>( i ) + x );
+    }
+    // Trick compiler to skip inline for this function with fake recursion
+    if ( x < 0 )
+        x = busyWork( time );
+    return x;
+}
+void busyThread( double time )
+{
+    StackTrace::registerThread();
+    busyWork( time );
+}
+
+
+// Search the call stack for a function
+bool findFunction( const multi_stack_info &stack, const char *name )
+{
+    if ( strstr( stack.stack.function.data(), name ) )
+        return true;
+    for ( const auto &child : stack.children ) {
+        if ( findFunction( child, name ) )
+            return true;
+    }
+    return false;
+}
+
+
+// Test exporting the profile
+void testExport( UnitTest &ut, const multi_stack_info &profile )
+{
+    // Test the folded format
+    std::stringstream folded;
+    double t0 = Utilities::time();
+    profile.printFolded( folded );
+    double t1 = Utilities::time();
+    int N     = 0;
+    std::string line;
+    while ( std::getline( folded, line ) )
+        N += atoi( line.substr( line.rfind( ' ' ) ).data() );
+    int N2 = 0;
+    for ( const auto &child : profile.children )
+        N2 += child.N;
+    printf( "Time to write folded stack: %0.4f\n", t1 - t0 );
+    if ( N == N2 && folded.str().find( "busyWork" ) != std::string::npos )
+        ut.passes( "printFolded" );
+    else
+        ut.failure( "printFolded" );
+    // Test the flame graph
+    std::stringstream svg;
+    t0 = Utilities::time();
+    profile.printFlameGraph( svg, "TestProfiler" );
+    t1 = Utilities::time();
+    printf( "Time to write flame graph: %0.4f\n", t1 - t0 );
+    auto str = svg.str();
+    if ( str.find( "<svg" ) != std::string::npos && str.find( "</svg>" ) != std::string::npos &&
+         str.find( "busyWork" ) != std::string::npos )
+        ut.passes( "printFlameGraph" );
+    else
+        ut.failure( "printFlameGraph" );
+    // Test the pprof format
+    std::stringstream pprof;
+    t0 = Utilities::time();
+    profile.printPprof( pprof, 4000000 );
+    t1 = Utilities::time();
+    printf( "Time to write pprof: %0.4f\n", t1 - t0 );
+    str = pprof.str();
+    if ( !str.empty() && str[0] == 0x0a && str.find( "busyWork" ) != std::string::npos )
+        ut.passes( "printPprof" );
+    else
+        ut.failure( "printPprof" );
+    // Test the callgrind format
+    std::stringstream callgrind;
+    t0 = Utilities::time();
+    profile.printCallgrind( callgrind );
+    t1 = Utilities::time();
+    printf( "Time to write callgrind: %0.4f\n\n", t1 - t0 );
+    str = callgrind.str();
+    if ( str.find( "# callgrind format" ) == 0 && str.find( "busyWork" ) != std::string::npos &&
+         str.find( "calls=" ) != std::string::npos )
+        ut.passes( "printCallgrind" );
+    else
+        ut.failure( "printCallgrind" );
+}
+
+
+// Test the sampling profiler
+void testProfiler( UnitTest &ut, Profiler::Backend backend )
+{
+    std::string name = backend == Profiler::Backend::perf ? "perf" : "signal";
+    Profiler::clear();
+    Profiler::start( 250, backend );
+    if ( !Profiler::running() ) {
+        ut.expected( "Profiler is not supported" );
+        return;
+    }
+    std::thread thread1( busyThread, 0.5 );
+    std::thread thread2( busyThread, 0.5 );
+    busyWork( 0.5 );
+    auto backend2 = Profiler::backend();
+    thread1.join();
+    thread2.join();
+    Profiler::stop();
+    size_t N_samples = Profiler::samples();
+    double t0        = Utilities::time();
+    auto profile     = Profiler::getProfile();
+    double t1        = Utilities::time();
+    cleanupStackTrace( profile );
+    printf( "Profile using %s (%i samples, %i dropped):\n", name.data(),
+            static_cast<int>( N_samples ), static_cast<int>( Profiler::dropped() ) );
+    profile.print( std::cout, "   " );
+    printf( "Time to get profile: %0.4f\n\n", t1 - t0 );
+    if ( backend == Profiler::Backend::signal )
+        testExport( ut, profile );
+    if ( backend2 != backend )
+        ut.expected( "Profiler fell back to the signal backend" );
+    if ( N_samples > 0 && profile.N == static_cast<int>( N_samples ) )
+        ut.passes( "Profiler collected samples (" + name + ")" );
+    else
+        ut.failure( "Profiler collected samples (" + name + ")" );
+    if ( findFunction( profile, "busyWork" ) )
+        ut.passes( "Profiler sampled busyWork (" + name + ")" );
+    else
+        ut.failure( "Profiler sampled busyWork (" + name + ")" );
+    Profiler::clear();
+    if ( Profiler::samples() == 0 && Profiler::getProfile().empty() )
+        ut.passes( "Profiler::clear (" + name + ")" );
+    else
+        ut.failure( "Profiler::clear (" + name + ")" );
+}
+
+
+/****************************************************************
+ * Run the profiler tests                                        *
+ ****************************************************************/
+int main( int, char *[] )
+{
+    int num_failed = 0;
+    {
+        UnitTest ut;
+
+        // Test the sampling profiler
+        testProfiler( ut, Profiler::Backend::signal );
+        testProfiler( ut, Profiler::Backend::perf );
+
+        // Finished testing, report the results
+        ut.print();
+        num_failed = ut.N_failed();
+    }
+    return num_failed;
+}
@@ -1,5 +1,6 @@
 #include <algorithm>
 #include <cmath>
+#include <csignal>
 #include <complex>
 #include <cstdio>
 #include <cstdlib>
@@ -10,10 +11,16 @@
 
 
 #include "StackTrace/ErrorHandlers.h"
+#include "StackTrace/Fingerprint.h"
 #include "StackTrace/StackTrace.h"
 #include "StackTrace/Utilities.h"
+#include "StackTrace/Watchdog.h"
+#include "StackTraceInternal.h"
 
 
+#if defined( STACKTRACE_USE_MPI ) && !defined( _WIN32 )
+    #include <unistd.h>
+#endif
 #ifdef USE_TIMER
     #include "MemoryApp.h"
     #include "ProfilerApp.h"
@@ -46,8 +53,14 @@ std::string rootPath;
         return y;
     }
     int startup( int argc, char *argv[] ) {
+        // "--funneled" tests the global call stacks without MPI_THREAD_MULTIPLE
+        int required = MPI_THREAD_MULTIPLE;
+        for ( int i = 1; i < argc; i++ ) {
+            if ( strcmp( argv[i], "--funneled" ) == 0 )
+                required = MPI_THREAD_FUNNELED;
+        }
         int provided_thread_support;
-        MPI_Init_thread( &argc, &argv, MPI_THREAD_MULTIPLE, &provided_thread_support );
+        MPI_Init_thread( &argc, &argv, required, &provided_thread_support );
         return getRank();
     }
     void shutdown( ) {
@@ -243,11 +256,33 @@ void testCurrentStack( UnitTest &results, bool &decoded_symbols )
         results.failure( "non empty call stack" );
     }
     if ( rank == 0 ) {
-        ts1        = time();
-        auto trace = StackTrace::backtrace();
-        ts2        = time();
+        ts1                         = time();
+        [[maybe_unused]] auto trace = StackTrace::backtrace();
+        ts2                         = time();
         std::cout << "Time to get backtrace: " << ts2 - ts1 << std::endl << std::endl;
     }
+    // Test capturing the raw call stack into a fixed capacity buffer
+    StackTrace::RawStack<> raw1, raw2;
+    StackTrace::RawStack<4> raw3;
+    raw1.capture();
+    raw2.capture( 1 );
+    raw3.capture( 0, 2 );
+    bool pass = raw1.size() > 2 && raw1.size() == raw2.size() + 1 && raw1[1] == raw2[0];
+    pass      = pass && raw3.size() == 2 && raw3[1] == raw1[1];
+    auto copy = raw1;
+    pass      = pass && copy == raw1 && copy != raw2;
+    pass      = pass && std::vector<void *>( copy ) == std::vector<void *>( raw1.begin(), raw1.end() );
+    addMessage( results, pass, "RawStack" );
+    // Test creating a multi-stack with counts (the counts must match the number of stacks)
+    std::vector<std::vector<void *>> trace( 2, std::vector<void *>( copy ) );
+    auto multistack = StackTrace::generateMultiStack( trace, { 2, 3 } );
+    pass            = multistack.N == 5;
+    try {
+        StackTrace::generateMultiStack( trace, { 1 } );
+        pass = false;
+    } catch ( const std::logic_error & ) {
+    }
+    addMessage( results, pass, "generateMultiStack counts" );
 }
 
 
@@ -318,7 +353,7 @@ void testFullStack( UnitTest & )
 
 
 // Test stack trace of another thread
-void testGlobalStack( UnitTest &, bool all,
+void testGlobalStack( UnitTest &results, bool all,
                       const std::basic_string<wchar_t> & = std::basic_string<wchar_t>() )
 {
     barrier();
@@ -329,8 +364,16 @@ void testGlobalStack( UnitTest &, bool all,
     sleep_ms( 50 ); // Give threads time to start
     double t1 = time();
     StackTrace::multi_stack_info call_stack;
-    if ( rank == 0 || all )
+    StackTrace::RankSet missing;
+    int N_updates = 0;
+    if ( all ) {
         call_stack = StackTrace::getGlobalCallStacks();
+    } else if ( rank == 0 ) {
+        auto callback = [&N_updates]( const StackTrace::global_stack_info & ) { N_updates++; };
+        auto result   = StackTrace::getGlobalCallStacks( callback );
+        call_stack    = std::move( result.stack );
+        missing       = std::move( result.missing );
+    }
     cleanupStackTrace( call_stack );
     double t2 = time();
     thread1.join();
@@ -339,6 +382,30 @@ void testGlobalStack( UnitTest &, bool all,
     barrier();
     if ( !all && rank != 0 )
         return;
+    std::string msg = all ? "global call stack (all ranks)" : "global call stack";
+    if ( StackTrace::getGlobalSymbolizeType() == StackTrace::symbolizeType::rank )
+        msg += " (symbolize on each rank)";
+    addMessage( results, call_stack.N == 4 * getSize(), msg );
+    if ( !all ) {
+        bool pass = missing.empty() && N_updates <= getSize();
+        addMessage( results, pass, "global call stack (missing ranks)" );
+    }
+    if ( getSize() > 1 ) {
+        bool pass = call_stack.ranks.count() == static_cast<size_t>( getSize() );
+        for ( const auto &child : call_stack.children ) {
+            const auto &ranges = child.ranks.ranges();
+            pass = pass && !ranges.empty() && ranges.front().first >= 0 &&
+                   ranges.back().second < getSize();
+        }
+        addMessage( results, pass, msg + " (ranks)" );
+    }
+    if ( getSize() > 2 && !all ) {
+        // Rank 0 is getting the call stacks while the other ranks are waiting
+        auto list = StackTrace::findStragglers( call_stack );
+        bool pass = !list.empty() && list[0].ranks == StackTrace::RankSet( 0 );
+        addMessage( results, pass, msg + " (stragglers)" );
+        std::cout << StackTrace::printStragglers( call_stack, missing );
+    }
     if ( rank == 0 && !all ) {
         std::cout << "Call stack (global):" << std::endl;
         call_stack.print( std::cout );
@@ -348,6 +415,261 @@ void testGlobalStack( UnitTest &, bool all,
 }
 
 
+// Test getting the global call stacks asynchronously (with multiple outstanding requests)
+void testGlobalStackAsync( UnitTest &results )
+{
+    barrier();
+    std::thread thread1( sleep_ms, 2000 );
+    std::thread thread2( sleep_ms, 2000 );
+    std::thread thread3( sleep_s, 2 );
+    sleep_ms( 50 ); // Give threads time to start
+    auto request1 = StackTrace::getGlobalCallStacksAsync();
+    auto request2 = StackTrace::getGlobalCallStacksAsync();
+    bool pass     = request1.valid() && request2.valid();
+    request1.wait();
+    pass         = pass && request1.test() && request2.wait_for( 30 );
+    auto result1 = request1.get();
+    auto result2 = request2.get();
+    thread1.join();
+    thread2.join();
+    thread3.join();
+    barrier();
+    pass = pass && result1.stack.N == 4 * getSize() && result2.stack.N == 4 * getSize();
+    pass = pass && result1.missing.empty() && result2.missing.empty();
+    addMessage( results, pass, "global call stack (async)" );
+}
+
+
+// Test getting the global call stacks for a subset of the ranks
+void testGlobalStackSubset( UnitTest &results )
+{
+    barrier();
+    const int rank = getRank();
+    const int size = getSize();
+#ifdef STACKTRACE_USE_MPI
+    MPI_Comm comm;
+    MPI_Comm_split( MPI_COMM_WORLD, rank % 2, rank, &comm );
+#endif
+    std::thread thread1( sleep_ms, 2000 );
+    std::thread thread2( sleep_ms, 2000 );
+    std::thread thread3( sleep_s, 2 );
+    sleep_ms( 50 ); // Give threads time to start
+    bool pass = true;
+    if ( rank == 0 ) {
+        auto check = [size]( const StackTrace::global_stack_info &result,
+                             const StackTrace::RankSet &ranks ) {
+            bool pass = result.stack.N == 4 * static_cast<int>( ranks.count() );
+            pass      = pass && result.missing.empty();
+            return pass && ( size == 1 || result.stack.ranks == ranks );
+        };
+        // Query the first and last ranks
+        StackTrace::RankSet ranks( std::vector<int>( { 0, size - 1 } ) );
+        pass = check( StackTrace::getGlobalCallStacks( ranks ), ranks );
+        // Query a rank without this rank
+        ranks = StackTrace::RankSet( size - 1 );
+        pass  = pass && check( StackTrace::getGlobalCallStacks( ranks ), ranks );
+        // Query a random sample of the ranks
+        ranks = StackTrace::sampleRanks( 0.5 );
+        pass  = pass && ranks.count() == std::max<size_t>( std::lround( 0.5 * size ), 1 );
+        pass  = pass && check( StackTrace::getGlobalCallStacks( ranks ), ranks );
+#ifdef STACKTRACE_USE_MPI
+        // Query the ranks in a sub-communicator (the even ranks)
+        ranks.clear();
+        for ( int i = 0; i < size; i += 2 )
+            ranks.insert( i );
+        pass = pass && check( StackTrace::getGlobalCallStacks( comm, nullptr ), ranks );
+#endif
+    }
+    thread1.join();
+    thread2.join();
+    thread3.join();
+    barrier();
+#ifdef STACKTRACE_USE_MPI
+    MPI_Comm_free( &comm );
+#endif
+    if ( rank == 0 )
+        addMessage( results, pass, "global call stack (subset)" );
+}
+
+
+// Test repeated global call stacks (the ranks only send the changes)
+void testGlobalStackDelta( UnitTest &results )
+{
+    barrier();
+    const int rank = getRank();
+    std::thread thread1( sleep_ms, 2000 );
+    std::thread thread2( sleep_ms, 2000 );
+    std::thread thread3( sleep_s, 2 );
+    sleep_ms( 50 ); // Give threads time to start
+    StackTrace::global_stack_info result1, result2, result3;
+    double t1 = time();
+    if ( rank == 0 )
+        result1 = StackTrace::getGlobalCallStacks( nullptr );
+    double t2 = time();
+    // Count the replies the root receives from its children for the repeated request
+    size_t full1 = 0, unchanged1 = 0, full2 = 0, unchanged2 = 0;
+    StackTrace::detail::getReplyCounts( full1, unchanged1 );
+    if ( rank == 0 )
+        result2 = StackTrace::getGlobalCallStacks( nullptr );
+    double t3 = time();
+    StackTrace::detail::getReplyCounts( full2, unchanged2 );
+    thread1.join();
+    thread2.join();
+    thread3.join();
+    barrier();
+    // Get the call stacks after the threads finished (the call stacks changed)
+    if ( rank == 0 )
+        result3 = StackTrace::getGlobalCallStacks( nullptr );
+    barrier();
+    if ( rank != 0 )
+        return;
+    bool pass = result1.stack.N == 4 * getSize() && result2.stack.N == 4 * getSize();
+    pass      = pass && result3.stack.N == getSize() && result3.missing.empty();
+    pass      = pass && result1.stack.ranks == result2.stack.ranks && result2.missing.empty();
+    addMessage( results, pass, "global call stack (delta)" );
+    if ( getSize() > 1 ) {
+        // The call stacks did not change, so all children should reply that they are unchanged
+        bool unchanged = full2 == full1 && unchanged2 > unchanged1;
+        addMessage( results, unchanged, "global call stack (delta) unchanged replies" );
+        if ( !unchanged )
+            printf( "Replies for the repeated request: %i full, %i unchanged\n",
+                    static_cast<int>( full2 - full1 ), static_cast<int>( unchanged2 - unchanged1 ) );
+    }
+    std::cout << "Time to get call stack (global, repeated): " << t2 - t1 << ", " << t3 - t2
+              << std::endl;
+}
+
+
+// Test that only the rank that does not respond is missing (its parent in the tree must
+// still reply in time).  The last rank is the deepest in the tree and is stopped with SIGSTOP.
+void testGlobalStackMissing( [[maybe_unused]] UnitTest &results )
+{
+#if defined( STACKTRACE_USE_MPI ) && !defined( _WIN32 )
+    barrier();
+    const int rank = getRank();
+    const int size = getSize();
+    if ( size < 4 )
+        return;
+    std::vector<int> pid( size, 0 );
+    int pid0 = getpid();
+    MPI_Allgather( &pid0, 1, MPI_INT, pid.data(), 1, MPI_INT, MPI_COMM_WORLD );
+    bool pass = true;
+    if ( rank == 0 ) {
+        kill( pid[size - 1], SIGSTOP );
+        double t1   = time();
+        auto result = StackTrace::getGlobalCallStacks( nullptr );
+        double t2   = time();
+        kill( pid[size - 1], SIGCONT );
+        StackTrace::RankSet ranks;
+        ranks.insert( 0, size - 2 );
+        pass = result.missing == StackTrace::RankSet( size - 1 ) && result.stack.ranks == ranks;
+        if ( !pass )
+            std::cout << "Missing ranks: " << result.missing.print() << std::endl;
+        std::cout << "Time to get call stack (global, stopped rank): " << t2 - t1 << std::endl;
+    }
+    barrier();
+    if ( rank == 0 )
+        addMessage( results, pass, "global call stack (missing rank)" );
+#endif
+}
+
+
+// Test the set of ranks
+void testRankSet( UnitTest &results )
+{
+    StackTrace::RankSet set( std::vector<int>( { 5, 1, 2, 3, 9, 8 } ) );
+    StackTrace::RankSet set2( 4 );
+    set2.insert( 10 );
+    set2.insert( 12 );
+    bool pass = set.print() == "[1-3,5,8-9]" && set.count() == 6;
+    pass      = pass && set.contains( 2 ) && !set.contains( 4 ) && !set.contains( 10 );
+    set.insert( set2 );
+    pass = pass && set.print() == "[1-5,8-10,12]" && set.count() == 9;
+    pass = pass && set.ranks() == std::vector<int>( { 1, 2, 3, 4, 5, 8, 9, 10, 12 } );
+    std::vector<char> data( set.size() );
+    set.pack( data.data() );
+    StackTrace::RankSet set3;
+    set3.unpack( data.data() );
+    pass = pass && set3 == set && StackTrace::RankSet().empty();
+    addMessage( results, pass, "RankSet" );
+    // Test the ranks in a multi_stack_info
+    auto stack = StackTrace::getCallStack();
+    StackTrace::multi_stack_info multistack;
+    multistack.add( stack.size(), stack.data(), 1, StackTrace::RankSet( 3 ) );
+    multistack.add( stack.size() - 1, &stack[1], 2, set2 );
+    pass     = multistack.children[0].ranks.print() == "[3-4,10,12]";
+    auto str = multistack.printString();
+    pass     = pass && str.find( "[3] [3-4,10,12] " ) != std::string::npos;
+    pass     = pass && str.find( "[1] [3] " ) != std::string::npos;
+    data.resize( multistack.size() );
+    multistack.pack( data.data() );
+    StackTrace::multi_stack_info multistack2;
+    multistack2.unpack( data.data() );
+    auto multistack3 = StackTrace::generateFromString( str );
+    pass             = pass && multistack2.printString() == str;
+    pass             = pass && multistack3.children[0].ranks == multistack.children[0].ranks;
+    addMessage( results, pass, "multi_stack_info ranks" );
+    // Test unpacking truncated or invalid data
+    const char *end = data.data() + data.size();
+    pass            = multistack2.unpack( data.data(), end ) == end;
+    pass            = pass && multistack2.printString() == str;
+    pass            = pass && !multistack2.unpack( data.data(), end - 1 ) && multistack2.empty();
+    data.resize( set.size() );
+    set.pack( data.data() );
+    end  = data.data() + data.size();
+    pass = pass && set3.unpack( data.data(), end ) == end && set3 == set;
+    pass = pass && !set3.unpack( data.data(), end - 1 );
+    int N_ranges = -1;
+    memcpy( data.data(), &N_ranges, sizeof( int ) );
+    pass = pass && !set3.unpack( data.data(), end );
+    addMessage( results, pass, "unpack invalid data" );
+    // Test removing ranks
+    set.erase( StackTrace::RankSet( std::vector<int>( { 1, 4, 5, 6, 9, 12 } ) ) );
+    pass = set.print() == "[2-3,8,10]" && set.count() == 4;
+    set.erase( set );
+    addMessage( results, pass && set.empty(), "RankSet::erase" );
+}
+
+
+// Test finding the ranks that differ from the others
+void testStragglers( UnitTest &results )
+{
+    // Create call stacks with 1 rank in compute and the others in MPI_Allreduce
+    auto frame = []( const char *function, int i ) {
+        StackTrace::stack_info info;
+        info.address  = reinterpret_cast<void *>( static_cast<uintptr_t>( 0x1000 + i ) );
+        info.address2 = info.address;
+        strcpy( info.function.data(), function );
+        return info;
+    };
+    std::vector<StackTrace::stack_info> stack1 = { frame( "MPI_Allreduce", 3 ),
+                                                   frame( "solve", 2 ), frame( "main", 1 ) };
+    std::vector<StackTrace::stack_info> stack2 = { frame( "compute", 4 ), frame( "solve", 2 ),
+                                                   frame( "main", 1 ) };
+    std::vector<StackTrace::stack_info> stack3 = { frame( "sleep", 5 ), frame( "worker", 6 ) };
+    StackTrace::RankSet ranks1( std::vector<int>( { 0, 1, 2, 3, 5, 6, 7 } ) );
+    StackTrace::RankSet ranks2( std::vector<int>( { 0, 1, 2, 3, 4, 5, 6, 7 } ) );
+    StackTrace::multi_stack_info multistack;
+    multistack.add( stack1.size(), stack1.data(), 7, ranks1 );
+    multistack.add( stack2.size(), stack2.data(), 1, StackTrace::RankSet( 4 ) );
+    multistack.add( stack3.size(), stack3.data(), 8, ranks2 );
+    multistack.N     = 16;
+    multistack.ranks = ranks2;
+    auto list        = StackTrace::findStragglers( multistack );
+    bool pass        = list.size() == 1;
+    if ( pass ) {
+        pass = list[0].ranks == StackTrace::RankSet( 4 ) && list[0].majority == 7;
+        pass = pass && strcmp( list[0].frame.function.data(), "compute" ) == 0;
+        pass = pass && strcmp( list[0].caller.function.data(), "solve" ) == 0;
+    }
+    auto msg = StackTrace::printStragglers( multistack );
+    pass     = pass && msg.find( "[4] in compute while 7 ranks are in MPI_Allreduce" ) != msg.npos;
+    addMessage( results, pass, "findStragglers" );
+    if ( getRank() == 0 )
+        std::cout << msg << std::endl;
+}
+
+
 // Test finding the active threads
 void testActiveThreads( UnitTest &results )
 {
@@ -459,7 +781,7 @@ void test_exec( UnitTest &results )
 
 
 // Test throw costs
-void test_throw( UnitTest & )
+void test_throw( UnitTest &results )
 {
     // Verify we can still get the global call stack
     barrier();
@@ -495,12 +817,41 @@ void test_throw( UnitTest & )
             }
         }
         auto t3 = std::chrono::high_resolution_clock::now();
+        for ( int i = 0; i < N; i++ ) {
+            try {
+                auto capture = StackTrace::captureType::none;
+                StackTrace::Utilities::abort( "Test", SOURCE_LOCATION_CURRENT(), capture );
+            } catch ( std::exception &e ) {
+            }
+        }
+        auto t4 = std::chrono::high_resolution_clock::now();
         int dt1 = std::chrono::duration_cast<std::chrono::microseconds>( t2 - t1 ).count() / N;
         int dt2 = std::chrono::duration_cast<std::chrono::microseconds>( t3 - t2 ).count() / N;
+        int dt3 = std::chrono::duration_cast<std::chrono::microseconds>( t4 - t3 ).count() / N;
         std::cout << "Cost for std::logic_error: " << dt1 << "us" << std::endl;
         std::cout << "Cost to call abort(): " << dt2 << "us" << std::endl;
+        std::cout << "Cost to call abort() without capture: " << dt3 << "us" << std::endl;
         std::cout << std::endl;
     }
+
+    // Test the capture type and the cached message
+    bool pass = true;
+    for ( auto capture : { StackTrace::captureType::none, StackTrace::captureType::stack } ) {
+        try {
+            StackTrace::Utilities::abort( "Test", SOURCE_LOCATION_CURRENT(), capture );
+        } catch ( StackTrace::abort_error &e ) {
+            bool stack = capture != StackTrace::captureType::none;
+            auto msg   = e.what();
+            bool trace = strstr( msg, "Stack Trace" ) != nullptr;
+            pass       = pass && e.bytes == 0 && e.stack.empty() != stack;
+            pass       = pass && msg == e.what() && trace == stack;
+            // Modifying a copy must not change the cached message
+            auto copy    = e;
+            copy.message = "Copy";
+            pass         = pass && strstr( copy.what(), "Copy" ) && msg == e.what();
+        }
+    }
+    addMessage( results, pass, "abort capture type" );
 }
 
 
@@ -531,6 +882,61 @@ void testTerminate( UnitTest &results )
 }
 
 
+// Test the watchdog
+static std::string readFile( const std::string &filename )
+{
+    std::string str;
+    auto fid = fopen( filename.c_str(), "rb" );
+    if ( fid == nullptr )
+        return str;
+    char buf[1024];
+    size_t N;
+    while ( ( N = fread( buf, 1, sizeof( buf ), fid ) ) > 0 )
+        str.append( buf, N );
+    fclose( fid );
+    return str;
+}
+static void heartbeat_ms( int N )
+{
+    double t0 = time();
+    while ( 1000 * ( time() - t0 ) < N ) {
+        StackTrace::heartbeat();
+        std::this_thread::sleep_for( std::chrono::milliseconds( 5 ) );
+    }
+}
+void testWatchdog( UnitTest &results )
+{
+    barrier();
+    auto filename = "TestStack.watchdog." + std::to_string( getRank() );
+    remove( filename.data() );
+    // Test a single thread that stops making progress
+    StackTrace::Watchdog::start( 0.2, filename );
+    std::thread thread( [] {
+        StackTrace::Watchdog::watchThread();
+        heartbeat_ms( 300 );
+        sleep_ms( 600 );
+        StackTrace::heartbeat();
+    } );
+    heartbeat_ms( 1000 );
+    thread.join();
+    size_t N_thread = StackTrace::Watchdog::reports();
+    // Test the process not making progress
+    sleep_ms( 600 );
+    StackTrace::Watchdog::stop();
+    size_t N_process = StackTrace::Watchdog::reports() - N_thread;
+    auto report      = readFile( filename );
+    remove( filename.data() );
+    bool pass1 = N_thread == 1 && report.find( "No heartbeat from thread" ) != std::string::npos;
+    bool pass2 =
+        N_process == 1 && report.find( "No heartbeat from the process" ) != std::string::npos;
+    addMessage( results, pass1, "Watchdog detected stalled thread" );
+    addMessage( results, pass2, "Watchdog detected stalled process" );
+    if ( getRank() == 0 && !( pass1 && pass2 ) )
+        std::cout << "Watchdog report:\n" << report << std::endl;
+    barrier();
+}
+
+
 // Test getting type name
 void testTypeName( UnitTest &results )
 {
@@ -544,6 +950,68 @@ void testTypeName( UnitTest &results )
 }
 
 
+// Test fingerprinting call stacks
+std::vector<void *> getStack( int i )
+{
+    if ( i > 0 )
+        return StackTrace::backtrace();
+    std::vector<void *> stack = StackTrace::backtrace();
+    // Trick compiler to skip inline for this function with fake recursion
+    if ( i < 0 )
+        stack = getStack( i + 1 );
+    return stack;
+}
+void testFingerprint( UnitTest &results )
+{
+    std::vector<void *> stack[3];
+    for ( int i = 0; i < 3; i++ )
+        stack[i] = getStack( i % 2 );
+    auto &stack1 = stack[0];
+    auto &stack2 = stack[1];
+    auto hash1   = StackTrace::fingerprint( stack1 );
+    auto hash2   = StackTrace::fingerprint( stack2 );
+    auto hash3   = StackTrace::fingerprint( stack[2] );
+    addMessage( results, hash1 == hash3 && hash1 != hash2, "fingerprint" );
+    // Test converting to/from module relative addresses
+    std::vector<StackTrace::module_address> address( stack1.size() );
+    StackTrace::getModuleAddress( stack1.data(), stack1.size(), address.data() );
+    bool pass = !address.empty() && address[0].module != 0;
+    for ( size_t i = 0; i < stack1.size(); i++ ) {
+        if ( address[i].module != 0 )
+            pass = pass && StackTrace::getLocalAddress( address[i] ) == stack1[i];
+    }
+    addMessage( results, pass, "module relative address" );
+    // Test the cost to fingerprint a call stack
+    int N     = 100000;
+    double t0 = StackTrace::Utilities::time();
+    for ( int i = 0; i < N; i++ )
+        hash3 ^= StackTrace::fingerprint( stack1 );
+    double t1 = StackTrace::Utilities::time();
+    if ( getRank() == 0 )
+        printf( "Time to fingerprint call stack (%i frames): %0.1f ns (%i)\n",
+                static_cast<int>( stack1.size() ),
+                1e9 * ( t1 - t0 ) / N,
+                static_cast<int>( hash3 & 1 ) );
+    // Test the fingerprint table from multiple threads
+    StackTrace::FingerprintTable table;
+    auto fun = [&table, &stack1, &stack2]( int i ) {
+        for ( int j = 0; j < 1000; j++ )
+            table.add( ( i + j ) % 2 == 0 ? stack1 : stack2 );
+    };
+    std::vector<std::thread> threads;
+    for ( int i = 0; i < 4; i++ )
+        threads.emplace_back( fun, i );
+    for ( auto &thread : threads )
+        thread.join();
+    auto entries = table.entries();
+    pass         = table.size() == 2 && entries.size() == 2 && table.dropped() == 0;
+    pass         = pass && table.count( hash1 ) == 2000 && table.count( hash2 ) == 2000;
+    for ( const auto &entry : entries )
+        pass = pass && ( entry.stack == stack1 || entry.stack == stack2 );
+    addMessage( results, pass, "FingerprintTable" );
+}
+
+
 // The main function
 int main( int argc, char *argv[] )
 {
@@ -581,9 +1049,20 @@ int main( int argc, char *argv[] )
         // Test getting the full stacktrace of all thread
         testFullStack( results );
 
+        // Test the set of ranks
+        testRankSet( results );
+        testStragglers( results );
+
         // Test getting the global stack trace of all threads/processes
         testGlobalStack( results, false );
         testGlobalStack( results, true );
+        StackTrace::setGlobalSymbolizeType( StackTrace::symbolizeType::rank );
+        testGlobalStack( results, false );
+        StackTrace::setGlobalSymbolizeType( StackTrace::symbolizeType::root );
+        testGlobalStackAsync( results );
+        testGlobalStackSubset( results );
+        testGlobalStackDelta( results );
+        testGlobalStackMissing( results );
 
         // Test getting the symbols
         auto symbols = StackTrace::getSymbols();
@@ -614,8 +1093,10 @@ int main( int argc, char *argv[] )
         // Test generating call stack from a string
         if ( rank == 0 ) {
             testStackFile( results, rootPath + "ExampleStack.txt" );
-            for ( int i = 1; i < argc; i++ )
-                testStackFile( results, argv[i] );
+            for ( int i = 1; i < argc; i++ ) {
+                if ( argv[i][0] != '-' )
+                    testStackFile( results, argv[i] );
+            }
         }
         barrier();
 
@@ -626,6 +1107,12 @@ int main( int argc, char *argv[] )
         auto bytes = StackTrace::Utilities::getSystemMemory();
         addMessage( results, bytes > 1e7 && bytes < 1e14, "getSystemMemory" );
 
+        // Test fingerprinting call stacks
+        testFingerprint( results );
+
+        // Test the watchdog
+        testWatchdog( results );
+
         // Test terminate
         testTerminate( results );
     }
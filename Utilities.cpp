@@ -114,15 +114,17 @@ void setAbortBehavior( bool throwException, int stackType )
     abort_throwException = throwException;
     StackTrace::setDefaultStackType( static_cast<printStackType>( stackType ) );
 }
-void abort( const std::string &message, const source_location &source )
+void abort( const std::string &message, const source_location &source, captureType capture )
 {
     abort_error err;
     err.message   = message;
     err.source    = source;
     err.type      = terminateType::abort;
-    err.bytes     = getMemoryUsage();
     err.stackType = StackTrace::getDefaultStackType();
-    err.stack     = StackTrace::backtrace();
+    if ( capture == captureType::full )
+        err.bytes = getMemoryUsage();
+    if ( capture != captureType::none )
+        err.stack.capture();
     throw err;
 }
 static std::mutex terminate_mutex;
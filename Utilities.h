@@ -14,8 +14,13 @@ namespace StackTrace::Utilities {
 /*!
  * Aborts the run after printing an error message with file and
  * line number information.
+ * @param message           The error message
+ * @param source            The source location of the error
+ * @param capture           What to capture (call stack/memory usage)
  */
-[[noreturn]] void abort( const std::string &message, const source_location &source );
+[[noreturn]] void abort( const std::string &message,
+                         const source_location &source,
+                         captureType capture = getDefaultCaptureType() );
 
 
 /*!
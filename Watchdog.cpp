@@ -0,0 +1,268 @@
+#include "StackTrace/Watchdog.h"
+#include "StackTrace/StackTrace.h"
+#include "StackTrace/Utilities.h"
+#include "StackTraceInternal.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+// Detect the OS
+// clang-format off
+#if defined( WIN32 ) || defined( _WIN32 ) || defined( WIN64 ) || defined( _WIN64 ) || defined( _MSC_VER )
+    #define USE_WINDOWS
+#elif defined( __APPLE__ )
+    #define USE_MAC
+#elif defined( __linux ) || defined( __linux__ ) || defined( __unix ) || defined( __posix )
+    #define USE_LINUX
+#else
+    #error Unknown OS
+#endif
+// clang-format on
+
+
+// Include system dependent headers
+// clang-format off
+#ifdef USE_WINDOWS
+    #include <process.h>
+    #define getpid _getpid
+#else
+    #include <unistd.h>
+#endif
+// clang-format on
+
+
+using StackTrace::detail::writeWatchdogReport;
+
+
+/****************************************************************************
+ *  Internal data for the watchdog                                           *
+ ****************************************************************************/
+static constexpr int MAX_THREADS = 1024; // Maximum number of watched threads
+
+
+// Current time (ns)
+static inline int64_t now()
+{
+    auto t = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>( t ).count();
+}
+
+
+// Data for a watched thread
+//    state: 0 - free, 1 - being claimed, 2 - watched
+// Note: the slot may be released and claimed again while the watchdog thread reads it
+struct watch_slot {
+    std::atomic<int> state       = 0;
+    std::atomic<int64_t> last    = 0; // Time of the last heartbeat (ns)
+    std::atomic<int64_t> timeout = 0; // Timeout for the thread (ns), 0 uses the default
+    std::atomic<int> tid         = -1;
+};
+
+
+// Watchdog data (the settings are protected by watchdog_mutex)
+static std::mutex watchdog_mutex;
+static std::condition_variable watchdog_cv;
+static std::thread watchdog_thread;
+static bool watchdog_running    = false;
+static int64_t watchdog_timeout = 0;
+static std::string watchdog_filename;
+static StackTrace::printStackType watchdog_type = StackTrace::printStackType::threaded;
+static std::atomic<size_t> watchdog_reports( 0 );
+static std::atomic<int64_t> watchdog_last( 0 );
+static watch_slot watchdog_slots[MAX_THREADS];
+
+
+// Slot for the current thread (released when the thread exits)
+thread_local struct WatchedThread {
+    int index = -1;
+    ~WatchedThread() { StackTrace::Watchdog::unwatchThread(); }
+} watchedThread;
+
+
+/****************************************************************************
+ *  Record a heartbeat                                                       *
+ ****************************************************************************/
+void StackTrace::heartbeat()
+{
+    int64_t t = now();
+    int index = watchedThread.index;
+    if ( index >= 0 )
+        watchdog_slots[index].last.store( t, std::memory_order_relaxed );
+    // Only update the process heartbeat every 1 ms to limit contention between threads
+    if ( t - watchdog_last.load( std::memory_order_relaxed ) > 1000000 )
+        watchdog_last.store( t, std::memory_order_relaxed );
+}
+
+
+/****************************************************************************
+ *  Watch / unwatch the current thread                                       *
+ ****************************************************************************/
+void StackTrace::Watchdog::watchThread( double timeout )
+{
+    if ( watchedThread.index >= 0 )
+        unwatchThread();
+    for ( int i = 0; i < MAX_THREADS; i++ ) {
+        int state = 0;
+        if ( !watchdog_slots[i].state.compare_exchange_strong( state, 1 ) )
+            continue;
+        auto &slot = watchdog_slots[i];
+        slot.timeout.store( timeout > 0 ? static_cast<int64_t>( 1e9 * timeout ) : 0 );
+        slot.tid.store( getSystemThreadID( thisThread() ) );
+        slot.last.store( now() );
+        slot.state.store( 2, std::memory_order_release );
+        watchedThread.index = i;
+        StackTrace::registerThread();
+        return;
+    }
+    throw std::logic_error( "Maximum number of watched threads exceeded" );
+}
+void StackTrace::Watchdog::unwatchThread()
+{
+    int index = watchedThread.index;
+    if ( index < 0 )
+        return;
+    watchdog_slots[index].state.store( 0, std::memory_order_release );
+    watchedThread.index = -1;
+}
+
+
+/****************************************************************************
+ *  Write a report                                                           *
+ ****************************************************************************/
+// Write a report (also used by MPIWatchdog), returning false if the file could not be opened
+bool StackTrace::detail::writeWatchdogReport( const char *reason, const std::string &filename,
+                                              StackTrace::printStackType type )
+{
+    // Get the call stacks
+    StackTrace::global_stack_info stack;
+    if ( type == StackTrace::printStackType::global )
+        stack = StackTrace::getGlobalCallStacks( nullptr );
+    else if ( type != StackTrace::printStackType::none )
+        stack.stack = StackTrace::getAllCallStacks();
+    StackTrace::cleanupStackTrace( stack.stack );
+    // Write the report
+    std::ofstream fid( filename, std::ios::app );
+    if ( !fid.is_open() ) {
+        fprintf( stderr, "Watchdog: unable to open %s\n", filename.data() );
+        return false;
+    }
+    fid << "Watchdog: " << reason << std::endl;
+    fid << "Time: " << StackTrace::Utilities::time() << " s" << std::endl;
+    fid << "Bytes used: " << StackTrace::Utilities::getMemoryUsage() << std::endl;
+    if ( type == StackTrace::printStackType::global )
+        fid << StackTrace::printStragglers( stack.stack, stack.missing );
+    if ( !stack.stack.empty() ) {
+        fid << "Call stacks:" << std::endl;
+        stack.stack.print( fid, "   " );
+    }
+    fid << std::endl;
+    return true;
+}
+
+
+/****************************************************************************
+ *  Watchdog thread                                                          *
+ ****************************************************************************/
+static void runWatchdogThread()
+{
+    // Check the heartbeats 4 times per timeout (at most every second)
+    int64_t interval = std::min<int64_t>( watchdog_timeout / 4, 1000000000 );
+    int64_t reported = 0;
+    // Heartbeat that was last reported for each slot (only used by this thread)
+    // Note: a new claim stores the current time in last, so it is never equal to an old report
+    std::vector<int64_t> slotReported( MAX_THREADS, 0 );
+    char reason[128];
+    std::unique_lock<std::mutex> lock( watchdog_mutex );
+    while ( watchdog_running ) {
+        watchdog_cv.wait_for( lock, std::chrono::nanoseconds( interval ) );
+        if ( !watchdog_running )
+            break;
+        int64_t t = now();
+        // Check the process (this includes the stacks of all threads)
+        int64_t last = watchdog_last.load( std::memory_order_relaxed );
+        if ( t - last > watchdog_timeout && last != reported ) {
+            reported = last;
+            for ( int i = 0; i < MAX_THREADS; i++ ) {
+                auto &slot = watchdog_slots[i];
+                if ( slot.state.load( std::memory_order_acquire ) == 2 )
+                    slotReported[i] = slot.last.load( std::memory_order_relaxed );
+            }
+            snprintf( reason, sizeof( reason ), "No heartbeat from the process for %0.1f s",
+                      1e-9 * ( t - last ) );
+            lock.unlock();
+            if ( writeWatchdogReport( reason, watchdog_filename, watchdog_type ) )
+                watchdog_reports++;
+            lock.lock();
+            continue;
+        }
+        // Check the watched threads
+        for ( int i = 0; i < MAX_THREADS; i++ ) {
+            auto &slot = watchdog_slots[i];
+            if ( slot.state.load( std::memory_order_acquire ) != 2 )
+                continue;
+            last            = slot.last.load( std::memory_order_relaxed );
+            int64_t timeout = slot.timeout.load( std::memory_order_relaxed );
+            timeout         = timeout > 0 ? timeout : watchdog_timeout;
+            if ( t - last > timeout && last != slotReported[i] ) {
+                slotReported[i] = last;
+                snprintf( reason, sizeof( reason ), "No heartbeat from thread %i for %0.1f s",
+                          slot.tid.load( std::memory_order_relaxed ), 1e-9 * ( t - last ) );
+                lock.unlock();
+                if ( writeWatchdogReport( reason, watchdog_filename, watchdog_type ) )
+                    watchdog_reports++;
+                lock.lock();
+            }
+        }
+    }
+}
+
+
+/****************************************************************************
+ *  Start/stop the watchdog                                                  *
+ ****************************************************************************/
+void StackTrace::Watchdog::start( double timeout, const std::string &filename,
+                                  printStackType type )
+{
+    std::lock_guard<std::mutex> lock( watchdog_mutex );
+    if ( watchdog_running )
+        return;
+    if ( timeout <= 0 )
+        throw std::logic_error( "Watchdog timeout must be positive" );
+    watchdog_timeout  = static_cast<int64_t>( 1e9 * timeout );
+    watchdog_filename = filename;
+    watchdog_type     = type;
+    if ( watchdog_filename.empty() )
+        watchdog_filename = "StackTrace.watchdog." + std::to_string( getpid() );
+    int64_t t = now();
+    watchdog_last.store( t );
+    for ( auto &slot : watchdog_slots )
+        slot.last.store( t );
+    watchdog_running = true;
+    watchdog_thread  = std::thread( runWatchdogThread );
+}
+void StackTrace::Watchdog::stop()
+{
+    std::unique_lock<std::mutex> lock( watchdog_mutex );
+    if ( !watchdog_running )
+        return;
+    watchdog_running = false;
+    lock.unlock();
+    watchdog_cv.notify_all();
+    watchdog_thread.join();
+}
+bool StackTrace::Watchdog::running()
+{
+    std::lock_guard<std::mutex> lock( watchdog_mutex );
+    return watchdog_running;
+}
+size_t StackTrace::Watchdog::reports() { return watchdog_reports.load(); }
@@ -0,0 +1,70 @@
+#ifndef included_StackTrace_Watchdog
+#define included_StackTrace_Watchdog
+
+#include <cstddef>
+#include <string>
+
+#include "StackTrace/StackTrace.h"
+
+
+namespace StackTrace {
+
+
+/*!
+ * @brief  Record progress for the watchdog
+ * @details  This function records that the process (and the current thread if it is
+ *    watched) is making progress.  It is intended to be called frequently and only
+ *    reads the clock and updates an atomic value.
+ */
+void heartbeat();
+
+
+namespace Watchdog {
+
+
+/*!
+ * @brief  Start the watchdog
+ * @details  This function starts a background thread that checks that the process and
+ *    any watched threads are making progress (calling heartbeat).  If the process or a
+ *    watched thread does not call heartbeat for the given time, the call stacks are
+ *    captured, cleaned up and appended to the report file.  The program is not
+ *    terminated and a stall is only reported once (until heartbeat is called again).
+ * @param[in] timeout   Time without a heartbeat before a stall is reported (s)
+ * @param[in] filename  File to write the reports (default is StackTrace.watchdog.<pid>)
+ * @param[in] type      Stacks to capture (threaded: all threads, global: all processes)
+ */
+void start( double timeout, const std::string &filename = "",
+            printStackType type = printStackType::threaded );
+
+
+//! Stop the watchdog
+void stop();
+
+
+//! Check if the watchdog is running
+bool running();
+
+
+/*!
+ * @brief  Watch the current thread
+ * @details  This function adds the current thread to the list of threads the watchdog
+ *    checks: the thread must call heartbeat at least once every timeout seconds.
+ *    The thread is also registered with the stack trace and is no longer watched when
+ *    the thread exits.
+ * @param[in] timeout   Timeout for the thread (s), a value <= 0 uses the watchdog timeout
+ */
+void watchThread( double timeout = -1 );
+
+
+//! Stop watching the current thread
+void unwatchThread();
+
+
+//! Return the number of reports written
+size_t reports();
+
+
+} // namespace Watchdog
+} // namespace StackTrace
+
+#endif